@@ -0,0 +1,685 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Benchmarks for the evaluator hot paths. Each case runs    *
+ * until it has taken at least the minimum time and reports  *
+ * nanoseconds and heap allocations per operation. Linked    *
+ * with --wrap so that malloc, calloc and realloc are counted *
+ *************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc.h"
+#include "readline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Each case repeats until it has run at least this long
+#define MIN_BENCH_NS 200000000.0
+
+// Expressions per generated corpus
+#define CORPUS_SIZE 256
+
+// Most cases one run records for --save and --compare
+#define MAX_CASES 64
+
+// Slowdown in percent --compare tolerates before failing
+#define DEFAULT_TOLERANCE 10.0
+
+typedef struct
+{
+    char** exps;
+    size_t* lens;
+    int count;
+} Corpus;
+
+typedef void (*BenchFn)(void* arg, long iterations);
+
+typedef struct
+{
+    char name[64];
+    double ns_per_op;
+} CaseResult;
+
+void* __real_malloc(size_t);
+void* __real_calloc(size_t, size_t);
+void* __real_realloc(void*, size_t);
+
+static long num_allocs = 0; // bumped by the wrapped allocators
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15u;
+static volatile double sink; // keeps results from being optimized away
+
+static CaseResult case_results[MAX_CASES];
+static int num_cases = 0;
+static int num_repeats = 1; // timings per case, the fastest is kept
+
+static CalcContext bench_ctx;
+static double* bench_results;
+static unsigned char* bench_mask;
+
+void runCase(const char*, BenchFn, void*, long);
+void makeCorpus(Corpus*, int, const char*);
+void encodeCorpus(const Corpus*, Corpus*);
+void freeCorpus(Corpus*);
+uint64_t nextRandom();
+double nowNs();
+void benchEval(void*, long);
+void benchEvalErrors(void*, long);
+void benchEvalString(void*, long);
+void benchEvalBinary(void*, long);
+void benchProgram(void*, long);
+void benchColumns(void*, long);
+void benchFormat(void*, long);
+void benchFormatFixed(void*, long);
+void benchReadline(void*, long);
+void redirectInput(const Corpus*);
+bool saveResults(const char*);
+bool compareResults(const char*, double);
+
+/* __wrap_malloc, __wrap_calloc, __wrap_realloc
+ * ...Count every heap allocation made by the code under test
+ */
+void* __wrap_malloc(size_t size)
+{
+    num_allocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    num_allocs++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    num_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+int main(int argc, char* argv[])
+{
+    static const int lengths[] = {4, 64, 4096};
+    static const char* mixes[] = {"+-", "*/", "+-*/"};
+    static const char* mix_names[] = {"add", "mul", "mixed"};
+    char name[64];
+    Corpus corpus;
+    Corpus wire_corpus;
+    CalcProgram prog;
+    const char* var_names[] = {"x", "y", "z"};
+    const char* program_exp = "x * 2 + y / 4 - z * x + 1.5";
+    double values[3 * 1024];
+    const double* columns[3];
+    double format_values[CORPUS_SIZE];
+    void* arg[3];
+    const char* save_path = NULL;
+    const char* compare_path = NULL;
+    double tolerance = DEFAULT_TOLERANCE;
+    bool ok = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+            save_path = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            compare_path = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc
+                 && atoi(argv[i + 1]) > 0)
+            num_repeats = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--save FILE] [--compare FILE] "
+                            "[--tolerance PERCENT] [--repeat N]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    initContext(&bench_ctx);
+
+    printf("%-32s %14s %14s\n", "benchmark", "ns/op", "allocs/op");
+
+    for (int m = 0; m < 3; m++)
+    {
+        for (int l = 0; l < 3; l++)
+        {
+            makeCorpus(&corpus, lengths[l], mixes[m]);
+            snprintf(name, sizeof(name), "evalExpression/%s/%d",
+                     mix_names[m], lengths[l]);
+            runCase(name, benchEval, &corpus, 1);
+
+            encodeCorpus(&corpus, &wire_corpus);
+            snprintf(name, sizeof(name), "evalBinary/%s/%d",
+                     mix_names[m], lengths[l]);
+            runCase(name, benchEvalBinary, &wire_corpus, 1);
+
+            freeCorpus(&wire_corpus);
+            freeCorpus(&corpus);
+        }
+    }
+
+    // Failing expressions, gathered in an error sink: the last number of
+    // each becomes a bad operand
+    makeCorpus(&corpus, 64, "+-*/");
+    for (int i = 0; i < corpus.count; i++)
+        corpus.exps[i][corpus.lens[i] - 1] = 'x';
+    runCase("evalExpression/invalid/64", benchEvalErrors, &corpus, 1);
+    freeCorpus(&corpus);
+
+    // The thread's default context, reused by every call
+    makeCorpus(&corpus, 64, "+-*/");
+    runCase("evalString/mixed/64", benchEvalString, &corpus, 1);
+    freeCorpus(&corpus);
+
+    // Compiled program, one row of bindings per op
+    for (int i = 0; i < 3 * 1024; i++)
+        values[i] = (double)(nextRandom() % 1000) + 1.0;
+
+    compileExpression(&bench_ctx, program_exp, strlen(program_exp),
+                      var_names, 3, &prog);
+    arg[0] = &prog;
+    arg[1] = values;
+    runCase("runProgram/row", benchProgram, arg, 1);
+
+    // Same program over columns of 1024 rows, reported per row
+    for (int v = 0; v < 3; v++)
+        columns[v] = values + v * 1024;
+    bench_results = (double *)malloc(sizeof(double) * 1024);
+    bench_mask = (unsigned char *)malloc(1024);
+    arg[1] = columns;
+    runCase("runProgramColumns/row", benchColumns, arg, 1024);
+    freeProgram(&prog);
+
+    for (int i = 0; i < CORPUS_SIZE; i++)
+        format_values[i] = (double)(nextRandom() % 100000000) / 977.0;
+    runCase("formatResult", benchFormat, format_values, 1);
+    runCase("formatResultFixed/10", benchFormatFixed, format_values, 1);
+
+    for (int l = 0; l < 3; l++)
+    {
+        makeCorpus(&corpus, lengths[l] * 16, "+-*/");
+        redirectInput(&corpus);
+        snprintf(name, sizeof(name), "readline/%zu-chars", corpus.lens[0]);
+        runCase(name, benchReadline, &corpus, 1);
+        freeCorpus(&corpus);
+    }
+
+    free(bench_results);
+    free(bench_mask);
+    freeContext(&bench_ctx);
+
+    if (save_path != NULL)
+        ok = saveResults(save_path);
+    if (ok && compare_path != NULL)
+        ok = compareResults(compare_path, tolerance);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* runCase
+ * ...Time a benchmark, doubling its iteration count until it runs for
+ * ...at least MIN_BENCH_NS, and print the per-operation cost. With
+ * ...--repeat the timed run is repeated at that count and the fastest
+ * ...kept, so a busy machine is less likely to fail --compare
+ * ...Parameters:
+ * ......const char* name -- benchmark name
+ * ......BenchFn fn -- runs the given number of iterations
+ * ......void* arg -- passed through to fn
+ * ......long ops_per_iter -- operations one iteration performs
+ * ...Returns:
+ * ......Nothing
+ */
+void runCase(const char* name, BenchFn fn, void* arg, long ops_per_iter)
+{
+    long iterations = 1;
+    long allocs_before;
+    double start;
+    double elapsed;
+    double again;
+    double ops;
+
+    fn(arg, 1); // warm up caches and grow reusable buffers
+
+    while (true)
+    {
+        allocs_before = num_allocs;
+        start = nowNs();
+        fn(arg, iterations);
+        elapsed = nowNs() - start;
+
+        if (elapsed >= MIN_BENCH_NS)
+            break;
+
+        iterations *= 2;
+    }
+
+    for (int r = 1; r < num_repeats; r++)
+    {
+        start = nowNs();
+        fn(arg, iterations);
+        again = nowNs() - start;
+        if (again < elapsed)
+            elapsed = again;
+    }
+
+    ops = (double)iterations * ops_per_iter;
+    printf("%-32s %14.1f %14.3f\n", name, elapsed / ops,
+           (double)(num_allocs - allocs_before) / ops);
+
+    if (num_cases < MAX_CASES)
+    {
+        snprintf(case_results[num_cases].name,
+                 sizeof(case_results[num_cases].name), "%s", name);
+        case_results[num_cases].ns_per_op = elapsed / ops;
+        num_cases++;
+    }
+}
+
+/* makeCorpus
+ * ...Generate expressions with a given number of operators drawn from
+ * ...a given set, operands between 0.5 and 1000
+ * ...Parameters:
+ * ......Corpus* corpus -- receives CORPUS_SIZE expressions
+ * ......int num_ops -- operators per expression
+ * ......const char* ops -- operator characters to draw from
+ * ...Returns:
+ * ......Nothing
+ */
+void makeCorpus(Corpus* corpus, int num_ops, const char* ops)
+{
+    size_t num_op_chars = strlen(ops);
+    size_t cap = (size_t)num_ops * 16 + 16;
+    size_t len;
+
+    corpus->count = CORPUS_SIZE;
+    corpus->exps = (char **)malloc(sizeof(char*) * CORPUS_SIZE);
+    corpus->lens = (size_t *)malloc(sizeof(size_t) * CORPUS_SIZE);
+
+    for (int i = 0; i < CORPUS_SIZE; i++)
+    {
+        corpus->exps[i] = (char *)malloc(cap);
+        len = (size_t)sprintf(corpus->exps[i], "%d.5",
+                              (int)(nextRandom() % 1000));
+
+        for (int j = 0; j < num_ops; j++)
+        {
+            len += (size_t)sprintf(corpus->exps[i] + len, " %c %d.5",
+                                   ops[nextRandom() % num_op_chars],
+                                   (int)(nextRandom() % 1000));
+        }
+
+        corpus->lens[i] = len;
+    }
+}
+
+/* encodeCorpus
+ * ...Convert a corpus from makeCorpus to the binary WireCode format
+ * ...Parameters:
+ * ......const Corpus* text -- corpus of text expressions
+ * ......Corpus* wire -- receives the same expressions in binary
+ * ...Returns:
+ * ......Nothing
+ */
+void encodeCorpus(const Corpus* text, Corpus* wire)
+{
+    const char* p;
+    char* end;
+    unsigned char* out;
+    uint64_t bits;
+    double value;
+
+    wire->count = text->count;
+    wire->exps = (char **)malloc(sizeof(char*) * text->count);
+    wire->lens = (size_t *)malloc(sizeof(size_t) * text->count);
+
+    for (int i = 0; i < text->count; i++)
+    {
+        // Every "N.5" becomes 9 bytes and every " op " one byte
+        wire->exps[i] = (char *)malloc(text->lens[i] * 9);
+        out = (unsigned char *)wire->exps[i];
+
+        for (p = text->exps[i]; *p != '\0'; p++)
+        {
+            if (*p == ' ')
+                continue;
+
+            if (strchr("+-*/", *p) != NULL)
+            {
+                *out++ = (unsigned char)(strchr("+-*/", *p) - "+-*/"
+                                         + WIRE_ADD);
+                continue;
+            }
+
+            value = strtod(p, &end);
+            memcpy(&bits, &value, sizeof(bits));
+            *out++ = WIRE_NUMBER;
+            for (int b = 0; b < 8; b++, bits >>= 8)
+                *out++ = (unsigned char)bits;
+            p = end - 1;
+        }
+
+        wire->lens[i] = (size_t)(out - (unsigned char *)wire->exps[i]);
+    }
+}
+
+/* freeCorpus
+ * ...Release a generated corpus
+ * ...Parameters:
+ * ......Corpus* corpus -- corpus to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeCorpus(Corpus* corpus)
+{
+    for (int i = 0; i < corpus->count; i++)
+        free(corpus->exps[i]);
+    free(corpus->exps);
+    free(corpus->lens);
+}
+
+/* benchEval
+ * ...evalExpression over a corpus, one expression per iteration
+ */
+void benchEval(void* arg, long iterations)
+{
+    Corpus* corpus = (Corpus *)arg;
+    double result;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        int dex = (int)(i % corpus->count);
+        evalExpression(&bench_ctx, corpus->exps[dex], corpus->lens[dex],
+                       &result);
+        sink = result;
+    }
+}
+
+/* benchEvalErrors
+ * ...evalExpression over a corpus of failing expressions with an error
+ * ...sink attached, cleared after every pass over the corpus
+ */
+void benchEvalErrors(void* arg, long iterations)
+{
+    Corpus* corpus = (Corpus *)arg;
+    CalcErrorSink errors;
+    double result;
+
+    initErrorSink(&errors);
+    bench_ctx.errors = &errors;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        int dex = (int)(i % corpus->count);
+        if (dex == 0)
+            clearErrorSink(&errors);
+        evalExpression(&bench_ctx, corpus->exps[dex], corpus->lens[dex],
+                       &result);
+        sink = result;
+    }
+
+    bench_ctx.errors = NULL;
+    freeErrorSink(&errors);
+}
+
+/* benchEvalString
+ * ...evalString over a corpus, one expression per iteration
+ */
+void benchEvalString(void* arg, long iterations)
+{
+    Corpus* corpus = (Corpus *)arg;
+    double result;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        evalString(corpus->exps[i % corpus->count], &result);
+        sink = result;
+    }
+}
+
+/* benchEvalBinary
+ * ...evalBinary over an encoded corpus, one expression per iteration
+ */
+void benchEvalBinary(void* arg, long iterations)
+{
+    Corpus* corpus = (Corpus *)arg;
+    double result;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        int dex = (int)(i % corpus->count);
+        evalBinary(&bench_ctx, (const unsigned char *)corpus->exps[dex],
+                   corpus->lens[dex], &result);
+        sink = result;
+    }
+}
+
+/* benchProgram
+ * ...runProgram on one row of bindings per iteration
+ */
+void benchProgram(void* arg, long iterations)
+{
+    void** args = (void **)arg;
+    const CalcProgram* prog = (const CalcProgram *)args[0];
+    const double* values = (const double *)args[1];
+    double result;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        runProgram(&bench_ctx, prog, values + (i % 1024) * 3, &result);
+        sink = result;
+    }
+}
+
+/* benchColumns
+ * ...runProgramColumns over 1024 rows per iteration
+ */
+void benchColumns(void* arg, long iterations)
+{
+    void** args = (void **)arg;
+    const CalcProgram* prog = (const CalcProgram *)args[0];
+    const double* const* columns = (const double* const*)args[1];
+
+    for (long i = 0; i < iterations; i++)
+    {
+        runProgramColumns(&bench_ctx, prog, columns, 1024,
+                          bench_results, bench_mask);
+        sink = bench_results[i % 1024];
+    }
+}
+
+/* benchFormat
+ * ...formatResult, shortest round-trip output, one value per iteration
+ */
+void benchFormat(void* arg, long iterations)
+{
+    const double* values = (const double *)arg;
+    char buf[RESULT_STR_SIZE];
+
+    for (long i = 0; i < iterations; i++)
+        sink = (double)formatResult(values[i % CORPUS_SIZE], buf,
+                                    sizeof(buf));
+}
+
+/* benchFormatFixed
+ * ...formatResultFixed at 10 decimal places, one value per iteration
+ */
+void benchFormatFixed(void* arg, long iterations)
+{
+    const double* values = (const double *)arg;
+    char buf[RESULT_STR_SIZE];
+
+    for (long i = 0; i < iterations; i++)
+        sink = (double)formatResultFixed(values[i % CORPUS_SIZE], 10, buf,
+                                         sizeof(buf));
+}
+
+/* benchReadline
+ * ...readline on stdin, one line per iteration, starting over at the
+ * ...end of the input set up by redirectInput
+ */
+void benchReadline(void* arg, long iterations)
+{
+    char* line;
+
+    (void)arg;
+
+    for (long i = 0; i < iterations; i++)
+    {
+        if ((line = readline()) == NULL)
+        {
+            rewind(stdin);
+            line = readline();
+        }
+
+        sink = (double)line[0];
+        free(line);
+    }
+}
+
+/* redirectInput
+ * ...Point stdin at a temporary file holding every expression in a
+ * ...corpus, one per line, so readline reads from the page cache
+ * ...Parameters:
+ * ......const Corpus* corpus -- expressions to write
+ * ...Returns:
+ * ......Nothing
+ */
+void redirectInput(const Corpus* corpus)
+{
+    char path[] = "/tmp/calc-bench-XXXXXX";
+    int fd = mkstemp(path);
+    FILE* file;
+
+    if (fd < 0 || (file = fdopen(fd, "w")) == NULL)
+    {
+        fprintf(stderr, "Cannot create %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < corpus->count; i++)
+    {
+        fwrite(corpus->exps[i], 1, corpus->lens[i], file);
+        fputc('\n', file);
+    }
+    fclose(file);
+
+    if (freopen(path, "r", stdin) == NULL)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+}
+
+/* saveResults
+ * ...Write the time per operation of every case run, one "name ns" line
+ * ...each, as a baseline for --compare
+ * ...Parameters:
+ * ......const char* path -- file to write
+ * ...Returns:
+ * ......true if the file was written, false otherwise
+ */
+bool saveResults(const char* path)
+{
+    FILE* file = fopen(path, "w");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "Cannot create %s\n", path);
+        return false;
+    }
+
+    for (int i = 0; i < num_cases; i++)
+        fprintf(file, "%s %.1f\n", case_results[i].name,
+                case_results[i].ns_per_op);
+    fclose(file);
+
+    return true;
+}
+
+/* compareResults
+ * ...Compare every case run with a baseline from --save and report the
+ * ...change. Cases missing from either side are skipped
+ * ...Parameters:
+ * ......const char* path -- baseline file
+ * ......double tolerance -- slowdown in percent allowed for any case
+ * ...Returns:
+ * ......false if a case slowed down by more than tolerance or the
+ * ...... baseline cannot be read, true otherwise
+ */
+bool compareResults(const char* path, double tolerance)
+{
+    FILE* file = fopen(path, "r");
+    char name[64];
+    double base_ns;
+    double change;
+    bool ok = true;
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return false;
+    }
+
+    printf("\n%-32s %14s %14s %9s\n", "benchmark", "baseline ns",
+           "ns/op", "change");
+
+    while (fscanf(file, "%63s %lf", name, &base_ns) == 2)
+    {
+        for (int i = 0; i < num_cases; i++)
+        {
+            if (strcmp(case_results[i].name, name) != 0 || base_ns <= 0.0)
+                continue;
+
+            change = (case_results[i].ns_per_op / base_ns - 1.0) * 100.0;
+            printf("%-32s %14.1f %14.1f %+8.1f%%%s\n", name, base_ns,
+                   case_results[i].ns_per_op, change,
+                   change > tolerance ? "  REGRESSION" : "");
+            ok = ok && change <= tolerance;
+        }
+    }
+    fclose(file);
+
+    if (!ok)
+        fprintf(stderr, "Slower than %s by more than %.1f%%\n", path,
+                tolerance);
+
+    return ok;
+}
+
+/* nextRandom
+ * ...xorshift64 generator, so every run sees the same corpus
+ * ...Returns:
+ * ......the next pseudo-random number
+ */
+uint64_t nextRandom()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return rng_state;
+}
+
+/* nowNs
+ * ...Read the monotonic clock
+ * ...Returns:
+ * ......the current time in nanoseconds
+ */
+double nowNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
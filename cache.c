@@ -0,0 +1,357 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Bounded least-recently-used cache of expression results,  *
+ * keyed by the expression text with insignificant           *
+ * whitespace removed                                        *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Buckets allocated by the first insert
+#define MIN_CACHE_BUCKETS 64
+
+struct CacheEntry
+{
+    struct CacheEntry* newer; // recency list, newest first
+    struct CacheEntry* older;
+    struct CacheEntry* chain; // next entry in the same bucket
+    uint64_t hash;
+    double value;
+    size_t key_len;
+    char key[];
+};
+
+static size_t normalizeKey(ResultCache*, const char*, size_t);
+static uint64_t hashKey(const char*, size_t);
+static void unlinkEntry(ResultCache*, CacheEntry*);
+static void pushNewest(ResultCache*, CacheEntry*);
+static void evictOldest(ResultCache*);
+static bool growBuckets(ResultCache*);
+
+/* initCache
+ * ...Prepare an empty result cache
+ * ...Parameters:
+ * ......ResultCache* cache -- cache to initialize
+ * ......size_t max_bytes -- memory the entries and their index may use
+ * ...Returns:
+ * ......Nothing
+ */
+void initCache(ResultCache* cache, size_t max_bytes)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->max_bytes = max_bytes;
+}
+
+/* freeCache
+ * ...Release every entry of a cache and reset it to empty
+ * ...Parameters:
+ * ......ResultCache* cache -- cache to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeCache(ResultCache* cache)
+{
+    size_t max_bytes = cache->max_bytes;
+
+    while (cache->oldest != NULL)
+        evictOldest(cache);
+
+    free((void *)cache->buckets);
+    free(cache->key_buf);
+    initCache(cache, max_bytes);
+}
+
+/* lookupCache
+ * ...Find the cached result of an expression, marking it most recently
+ * ...used. The expression's normalized key is kept for storeCache
+ * ...Parameters:
+ * ......ResultCache* cache -- cache to search
+ * ......const char* exp -- characters of the expression
+ * ......size_t len -- number of characters in exp
+ * ......double* result -- set to the cached result if found
+ * ...Returns:
+ * ......true on a hit, false on a miss
+ */
+bool lookupCache(ResultCache* cache, const char* exp, size_t len,
+                 double* result)
+{
+    CacheEntry* entry;
+
+    cache->key_len = normalizeKey(cache, exp, len);
+    if (cache->key_buf == NULL)
+        return false; // no room for the key, so nothing can be cached
+
+    cache->key_hash = hashKey(cache->key_buf, cache->key_len);
+    if (cache->num_buckets == 0)
+        return false;
+
+    entry = cache->buckets[cache->key_hash & (cache->num_buckets - 1)];
+    for (; entry != NULL; entry = entry->chain)
+    {
+        if (entry->hash == cache->key_hash && entry->key_len == cache->key_len
+            && memcmp(entry->key, cache->key_buf, cache->key_len) == 0)
+        {
+            unlinkEntry(cache, entry);
+            pushNewest(cache, entry);
+            *result = entry->value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* storeCache
+ * ...Remember the result for the key of the last lookupCache miss,
+ * ...evicting the least recently used entries to stay within budget.
+ * ...Entries that do not fit at all are not stored
+ * ...Parameters:
+ * ......ResultCache* cache -- cache to add to
+ * ......double value -- result of the expression
+ * ...Returns:
+ * ......Nothing
+ */
+void storeCache(ResultCache* cache, double value)
+{
+    size_t entry_size = sizeof(CacheEntry) + cache->key_len;
+    CacheEntry* entry;
+    size_t dex;
+
+    if (cache->key_buf == NULL || entry_size > cache->max_bytes / 4)
+        return;
+
+    if (cache->num_entries >= cache->num_buckets && !growBuckets(cache))
+        return;
+
+    while (cache->bytes + entry_size > cache->max_bytes
+           && cache->oldest != NULL)
+        evictOldest(cache);
+
+    entry = (CacheEntry *)malloc(entry_size);
+    if (entry == NULL)
+        return;
+
+    entry->hash = cache->key_hash;
+    entry->value = value;
+    entry->key_len = cache->key_len;
+    memcpy(entry->key, cache->key_buf, cache->key_len);
+
+    dex = entry->hash & (cache->num_buckets - 1);
+    entry->chain = cache->buckets[dex];
+    cache->buckets[dex] = entry;
+    pushNewest(cache, entry);
+
+    cache->num_entries++;
+    cache->bytes += entry_size;
+}
+
+/* normalizeKey
+ * ...Copy an expression into the cache's key buffer without the
+ * ...whitespace that cannot change its meaning. A run of whitespace is
+ * ...kept, as one space, between two characters that would otherwise
+ * ...join into one token, and wherever it might split an exponent such
+ * ...as 1e-5, so two texts share a key only if they parse alike
+ * ...Parameters:
+ * ......ResultCache* cache -- cache whose key buffer is filled
+ * ......const char* exp -- characters of the expression
+ * ......size_t len -- number of characters in exp
+ * ...Returns:
+ * ......the length of the key, with cache->key_buf NULL if the buffer
+ * ...... could not be grown
+ */
+static size_t normalizeKey(ResultCache* cache, const char* exp, size_t len)
+{
+    char* key;
+    size_t key_len = 0;
+    size_t i = 0;
+    char prev;
+    char next;
+
+    if (len > cache->key_cap)
+    {
+        key = (char *)realloc(cache->key_buf, len);
+        if (key == NULL)
+        {
+            free(cache->key_buf);
+            cache->key_buf = NULL;
+            cache->key_cap = 0;
+            return 0;
+        }
+        cache->key_buf = key;
+        cache->key_cap = len;
+    }
+
+    key = cache->key_buf;
+
+    while (i < len)
+    {
+        if (!isspace((unsigned char)exp[i]))
+        {
+            key[key_len++] = exp[i++];
+            continue;
+        }
+
+        while (i < len && isspace((unsigned char)exp[i]))
+            i++;
+
+        if (key_len == 0 || i == len)
+            continue; // leading or trailing
+
+        prev = key[key_len - 1];
+        next = exp[i];
+        if ((!isDelimiterChar(prev) && !isDelimiterChar(next))
+            || prev == 'e' || prev == 'E'
+            || ((prev == '+' || prev == '-') && key_len > 1
+                && (key[key_len - 2] == 'e' || key[key_len - 2] == 'E')))
+            key[key_len++] = ' ';
+    }
+
+    return key_len;
+}
+
+/* hashKey
+ * ...FNV-1a hash of a key, eight bytes at a time with a byte tail
+ * ...Parameters:
+ * ......const char* key -- characters to hash
+ * ......size_t len -- number of characters in key
+ * ...Returns:
+ * ......the 64-bit hash of key
+ */
+static uint64_t hashKey(const char* key, size_t len)
+{
+    uint64_t hash = 0xCBF29CE484222325u;
+    uint64_t word;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        memcpy(&word, key + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001B3u;
+        hash ^= hash >> 29;
+    }
+
+    for (; i < len; i++)
+        hash = (hash ^ (unsigned char)key[i]) * 0x100000001B3u;
+
+    // Spread the high bits into the low bits used by the bucket index
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+/* unlinkEntry
+ * ...Take an entry out of the recency list
+ * ...Parameters:
+ * ......ResultCache* cache -- cache holding the entry
+ * ......CacheEntry* entry -- entry to unlink
+ * ...Returns:
+ * ......Nothing
+ */
+static void unlinkEntry(ResultCache* cache, CacheEntry* entry)
+{
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        cache->newest = entry->older;
+
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        cache->oldest = entry->newer;
+}
+
+/* pushNewest
+ * ...Make an entry the most recently used
+ * ...Parameters:
+ * ......ResultCache* cache -- cache holding the entry
+ * ......CacheEntry* entry -- entry not currently in the recency list
+ * ...Returns:
+ * ......Nothing
+ */
+static void pushNewest(ResultCache* cache, CacheEntry* entry)
+{
+    entry->newer = NULL;
+    entry->older = cache->newest;
+
+    if (cache->newest != NULL)
+        cache->newest->newer = entry;
+    else
+        cache->oldest = entry;
+
+    cache->newest = entry;
+}
+
+/* evictOldest
+ * ...Remove and free the least recently used entry
+ * ...Parameters:
+ * ......ResultCache* cache -- cache with at least one entry
+ * ...Returns:
+ * ......Nothing
+ */
+static void evictOldest(ResultCache* cache)
+{
+    CacheEntry* entry = cache->oldest;
+    CacheEntry** link = &cache->buckets[entry->hash
+                                        & (cache->num_buckets - 1)];
+
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    unlinkEntry(cache, entry);
+    cache->num_entries--;
+    cache->bytes -= sizeof(CacheEntry) + entry->key_len;
+    free(entry);
+}
+
+/* growBuckets
+ * ...Double the bucket array, keeping it within the memory budget by
+ * ...evicting entries first, and rehash every entry
+ * ...Parameters:
+ * ......ResultCache* cache -- cache whose index grows
+ * ...Returns:
+ * ......false if the buckets could not be allocated, true otherwise
+ */
+static bool growBuckets(ResultCache* cache)
+{
+    size_t new_count = cache->num_buckets > 0 ? cache->num_buckets * 2
+                                              : MIN_CACHE_BUCKETS;
+    size_t grow_bytes = (new_count - cache->num_buckets)
+                        * sizeof(CacheEntry*);
+    CacheEntry** new_buckets;
+    CacheEntry* entry;
+    size_t dex;
+
+    if (grow_bytes > cache->max_bytes / 2)
+        return cache->num_buckets > 0; // keep the index it has
+
+    while (cache->bytes + grow_bytes > cache->max_bytes
+           && cache->oldest != NULL)
+        evictOldest(cache);
+
+    new_buckets = (CacheEntry **)calloc(new_count, sizeof(CacheEntry*));
+    if (new_buckets == NULL)
+        return cache->num_buckets > 0;
+
+    for (entry = cache->newest; entry != NULL; entry = entry->older)
+    {
+        dex = entry->hash & (new_count - 1);
+        entry->chain = new_buckets[dex];
+        new_buckets[dex] = entry;
+    }
+
+    free((void *)cache->buckets);
+    cache->buckets = new_buckets;
+    cache->bytes += grow_bytes;
+    cache->num_buckets = new_count;
+
+    return true;
+}
@@ -0,0 +1,525 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Evaluates a mathmatical expression contained within an    *
+ * input string. Reports failures through CalcStatus codes   *
+ * and never writes to stdout or exits                       *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <locale.h>
+
+// Longest number the slow path converts without a heap copy
+#define NUMBER_BUF_SIZE 128
+
+// Largest mantissa a double holds exactly, 2^53
+#define MAX_EXACT_MANTISSA (UINT64_C(1) << 53)
+
+// Powers of ten that are exact doubles; a mantissa up to 2^53 scaled by
+// one of these is correctly rounded by a single multiply or divide
+static const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double slowParseNumber(const char*, const char*, uint64_t, int);
+
+/* initContext
+ * ...Prepare an empty evaluator context
+ * ...Parameters:
+ * ......CalcContext* ctx -- context to initialize
+ * ...Returns:
+ * ......Nothing
+ */
+void initContext(CalcContext* ctx)
+{
+    ctx->stacks.operands = NULL;
+    ctx->stacks.operators = NULL;
+    ctx->stacks.nodes = NULL;
+    ctx->stacks.capacity = 0;
+    ctx->node_blocks = NULL;
+    ctx->node_block = NULL;
+    ctx->node_used = 0;
+    ctx->column_stack = NULL;
+    ctx->column_slots = NULL;
+    ctx->column_depth = 0;
+    ctx->error_token = NULL;
+    ctx->error_len = 0;
+    ctx->carry = NULL;
+    ctx->carry_cap = 0;
+    ctx->cache = NULL;
+    ctx->errors = NULL;
+    ctx->mode = CALC_MODE_DOUBLE;
+    ctx->precise = NULL;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+/* freeContext
+ * ...Release the storage held by ctx and reset it to empty. An attached
+ * ...cache or error sink belongs to the caller and is only detached
+ * ...Parameters:
+ * ......CalcContext* ctx -- context to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeContext(CalcContext* ctx)
+{
+    free(ctx->stacks.operands);
+    free(ctx->stacks.operators);
+    free((void *)ctx->stacks.nodes);
+    freeNodes(ctx);
+    free(ctx->column_stack);
+    free((void *)ctx->column_slots);
+    free(ctx->carry);
+    freePrecise(ctx);
+    initContext(ctx);
+}
+
+/* evalExpression
+ * ...Evaluate mathematical expression
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, its stacks are grown as
+ * ...... needed and reused by later calls
+ * ......const char* exp -- characters of the expression, need not be
+ * ...... NUL-terminated and are never modified
+ * ......size_t len -- number of characters in exp
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ * ...... on invalid operands, operators or parentheses,
+ * ...... ctx->error_token and ctx->error_len identify the offending token
+ * ...... if ctx->cache is set, a result found there is returned without
+ * ...... parsing, and successful results are added to it
+ * ...... outside CALC_MODE_DOUBLE, evalPrecise evaluates the expression
+ * ...... in ctx->mode and ctx->cache is not consulted
+ * ...... if ctx->errors is set, the evaluation is counted there and a
+ * ...... failure is recorded instead of having to be handled at once
+ */
+CalcStatus evalExpression(CalcContext* ctx, const char* exp, size_t len,
+                          double* result)
+{
+    ExprNode* root;
+    CalcStatus status;
+#ifdef CALC_STATS
+    uint64_t start = statClock();
+    size_t capacity = ctx->stacks.capacity;
+#endif
+
+    *result = 0.0;
+
+    if (ctx->mode != CALC_MODE_DOUBLE)
+    {
+        status = evalPrecise(ctx, exp, len, result);
+        if (ctx->errors != NULL)
+            recordError(ctx->errors, ctx, status, exp, len);
+        return status;
+    }
+
+    if (ctx->cache != NULL)
+    {
+        if (lookupCache(ctx->cache, exp, len, result))
+        {
+            ctx->error_token = NULL;
+            ctx->error_len = 0;
+            STAT_ADD(ctx->stats.cache_hits, 1);
+#ifdef CALC_STATS
+            recordEval(&ctx->stats, CALC_OK, len, statClock() - start);
+#endif
+            if (ctx->errors != NULL)
+                recordError(ctx->errors, ctx, CALC_OK, exp, len);
+            return CALC_OK;
+        }
+        STAT_ADD(ctx->stats.cache_misses, 1);
+    }
+
+    status = parseTree(ctx, exp, len, NULL, 0, &root);
+    if (status == CALC_OK)
+    {
+        STAT_START(reduce_start);
+        status = evalTree(ctx, NULL, result);
+        STAT_PHASE(&ctx->stats, CALC_PHASE_REDUCE, reduce_start);
+    }
+
+    if (status == CALC_OK && ctx->cache != NULL)
+        storeCache(ctx->cache, *result);
+
+#ifdef CALC_STATS
+    if (ctx->stacks.capacity != capacity)
+        STAT_ADD(ctx->stats.allocations, 3); // all three stacks reallocated
+    recordEval(&ctx->stats, status, len, statClock() - start);
+#endif
+    if (ctx->errors != NULL)
+        recordError(ctx->errors, ctx, status, exp, len);
+
+    return status;
+}
+
+/* statusMessage
+ * ...Describe a status code
+ * ...Parameters:
+ * ......CalcStatus status -- code returned by the library
+ * ...Returns:
+ * ......static string describing status
+ */
+const char* statusMessage(CalcStatus status)
+{
+    switch (status)
+    {
+        case CALC_OK:
+            return "OK";
+
+        case CALC_INVALID_OPERAND:
+            return "Invalid operand";
+
+        case CALC_INVALID_OPERATOR:
+            return "Invalid operator";
+
+        case CALC_MISSING_OPERAND:
+            return "Missing last operand";
+
+        case CALC_DIVIDE_BY_ZERO:
+            return "Divide by zero error";
+
+        case CALC_NO_MEMORY:
+            return "Memory allocation error";
+
+        case CALC_UNKNOWN_VARIABLE:
+            return "Unknown variable";
+
+        case CALC_UNBALANCED_PAREN:
+            return "Unbalanced parenthesis";
+
+        case CALC_BAD_ARGUMENTS:
+            return "Invalid function arguments";
+
+        case CALC_NOT_EXACT:
+            return "No exact result";
+
+        case CALC_TOO_LARGE:
+            return "Exact value too large";
+    }
+
+    return "Unknown error";
+}
+
+/* parseValue
+ * ...Convert a span holding one number, written as an operand would be,
+ * ...with spaces allowed around it
+ * ...Parameters:
+ * ......const char* str -- characters of the number, need not be
+ * ...... NUL-terminated
+ * ......size_t len -- number of characters in str
+ * ......double* value -- set to the value, 0.0 if str is not a number
+ * ...Returns:
+ * ......true if str holds exactly one number, false otherwise
+ */
+bool parseValue(const char* str, size_t len, double* value)
+{
+    const char* end = str + len;
+    const char* num_end;
+
+    while (str < end && isspace((unsigned char)*str))
+        str++;
+    while (end > str && isspace((unsigned char)end[-1]))
+        end--;
+
+    if (str == end || !parseNumber(str, end, value, &num_end)
+        || num_end != end)
+    {
+        *value = 0.0;
+        return false;
+    }
+
+    return true;
+}
+
+/* reserveStacks
+ * ...Make sure the operand, operator and node stacks hold count
+ * ...entries, doubling their capacity when they need to grow so that
+ * ...a long expression costs only a logarithmic number of reallocations
+ * ...Parameters:
+ * ......ExprStacks* stacks -- stacks to grow
+ * ......size_t count -- number of entries required
+ * ...Returns:
+ * ......false if the stacks could not be grown, true otherwise
+ */
+bool reserveStacks(ExprStacks* stacks, size_t count)
+{
+    size_t max_capacity = SIZE_MAX / sizeof(double);
+    size_t new_capacity = stacks->capacity > 0 ? stacks->capacity : 16;
+    double* new_operands;
+    char* new_operators;
+    ExprNode** new_nodes;
+
+    if (count <= stacks->capacity)
+        return true;
+    if (count > max_capacity)
+        return false;
+
+    while (new_capacity < count)
+        new_capacity = new_capacity <= max_capacity / 2 ? new_capacity * 2
+                                                        : max_capacity;
+
+    new_operands = (double *)realloc(stacks->operands,
+                                     sizeof(double) * new_capacity);
+    if (new_operands == NULL)
+        return false;
+    stacks->operands = new_operands;
+
+    new_operators = (char *)realloc(stacks->operators,
+                                    sizeof(char) * new_capacity);
+    if (new_operators == NULL)
+        return false;
+    stacks->operators = new_operators;
+
+    new_nodes = (ExprNode **)realloc((void *)stacks->nodes,
+                                     sizeof(ExprNode*) * new_capacity);
+    if (new_nodes == NULL)
+        return false;
+    stacks->nodes = new_nodes;
+
+    stacks->capacity = new_capacity;
+
+    return true;
+}
+
+/* nextToken
+ * ...Find the next token without modifying the input. Tokens are
+ * ...separated by any amount of whitespace, and an operator char or a
+ * ...parenthesis is always a token of its own, so 3*(4) splits into
+ * ...3, *, (, 4 and )
+ * ...Parameters:
+ * ......const char** cursor -- scan position, advanced past the token
+ * ......const char* end -- one past the last character to scan
+ * ......const char** token -- set to the first character of the token
+ * ......size_t* token_len -- set to the number of characters in the token
+ * ...Returns:
+ * ......true if a token was found, false at the end of the input
+ */
+bool nextToken(const char** cursor, const char* end,
+               const char** token, size_t* token_len)
+{
+    const char* p = *cursor;
+
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+
+    if (p == end)
+    {
+        *cursor = p;
+        return false;
+    }
+
+    *token = p;
+    if (isDelimiterChar(*p))
+        p++;
+    else
+    {
+        while (p < end && !isspace((unsigned char)*p) && !isDelimiterChar(*p))
+            p++;
+    }
+
+    *token_len = p - *token;
+    *cursor = p;
+
+    return true;
+}
+
+/* nextOperand
+ * ...Scan the next operand, converting it if it is a number
+ * ...Parameters:
+ * ......const char** cursor -- scan position, advanced past the operand
+ * ......const char* end -- one past the last character to scan
+ * ......const char** token -- set to the first character of the operand
+ * ......size_t* token_len -- set to the number of characters in it
+ * ......double* value -- set to the number's value
+ * ......bool* is_number -- set to whether the operand is a valid number;
+ * ...... if not, the token spans up to the next space, operator char
+ * ...... or parenthesis
+ * ...Returns:
+ * ......true if an operand was found, false at the end of the input
+ */
+bool nextOperand(const char** cursor, const char* end, const char** token,
+                 size_t* token_len, double* value, bool* is_number)
+{
+    const char* p = *cursor;
+    const char* num_end;
+
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+
+    if (p == end)
+    {
+        *cursor = p;
+        return false;
+    }
+
+    if (parseNumber(p, end, value, &num_end)
+        && (num_end == end || isspace((unsigned char)*num_end)
+            || isDelimiterChar(*num_end)))
+    {
+        *token = p;
+        *token_len = num_end - p;
+        *cursor = num_end;
+        *is_number = true;
+        return true;
+    }
+
+    *is_number = false;
+    return nextToken(cursor, end, token, token_len);
+}
+
+/* parseNumber
+ * ...Validate and convert a decimal number in one pass, independent of
+ * ...the locale: an optional sign, digits with at most one decimal char,
+ * ...and an optional exponent such as e-5. At least one digit is needed
+ * ...Parameters:
+ * ......const char* str -- first character of the number
+ * ......const char* end -- one past the last character that may be read
+ * ......double* value -- set to the correctly rounded value
+ * ......const char** num_end -- set to one past the last character used
+ * ...Returns:
+ * ......true if str starts with a number, false otherwise
+ */
+bool parseNumber(const char* str, const char* end, double* value,
+                 const char** num_end)
+{
+    const char* p = str;
+    const char* digits;
+    const char* exp_p;
+    uint64_t mantissa = 0;
+    int num_digits = 0; // significant digits held in mantissa, up to 19
+    int exp10 = 0;
+    int exp_val = 0;
+    bool negative = false;
+    bool exp_negative = false;
+    bool any_digit = false;
+    bool truncated = false; // nonzero digits beyond the 19 kept
+    double result;
+
+    if (p < end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+    digits = p;
+
+    for (; p < end && isdigit((unsigned char)*p); p++)
+    {
+        any_digit = true;
+        if (num_digits < 19)
+        {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            num_digits += mantissa != 0; // leading zeros are not significant
+        }
+        else
+        {
+            exp10++;
+            truncated = truncated || *p != '0';
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && isdigit((unsigned char)*p); p++)
+        {
+            any_digit = true;
+            if (num_digits < 19)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                num_digits += mantissa != 0;
+                exp10--;
+            }
+            else
+                truncated = truncated || *p != '0';
+        }
+    }
+
+    if (!any_digit)
+        return false;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {   // only part of the number if digits follow
+        exp_p = p + 1;
+        if (exp_p < end && (*exp_p == '+' || *exp_p == '-'))
+            exp_negative = *exp_p++ == '-';
+
+        if (exp_p < end && isdigit((unsigned char)*exp_p))
+        {
+            for (; exp_p < end && isdigit((unsigned char)*exp_p); exp_p++)
+            {
+                if (exp_val < 100000) // far beyond any double's range
+                    exp_val = exp_val * 10 + (*exp_p - '0');
+            }
+
+            exp10 += exp_negative ? -exp_val : exp_val;
+            p = exp_p;
+        }
+    }
+
+    *num_end = p;
+
+    if (mantissa == 0)
+        result = 0.0;
+    else if (!truncated && mantissa <= MAX_EXACT_MANTISSA
+             && exp10 >= -22 && exp10 <= 22)
+    {   // both factors are exact, so one rounding gives the right answer
+        result = (double)mantissa;
+        result = exp10 < 0 ? result / exact_powers_of_ten[-exp10]
+                           : result * exact_powers_of_ten[exp10];
+    }
+    else
+        result = slowParseNumber(digits, p, mantissa, exp10);
+
+    *value = negative ? -result : result;
+
+    return true;
+}
+
+/* slowParseNumber
+ * ...Correctly round a number the exact fast path cannot handle, using
+ * ...strtod on a NUL-terminated copy with the locale's decimal point
+ * ...Parameters:
+ * ......const char* str -- first character of the unsigned number
+ * ......const char* num_end -- one past its last character
+ * ......uint64_t mantissa -- leading significant digits, used only if
+ * ...... the copy cannot be allocated
+ * ......int exp10 -- decimal exponent applying to mantissa
+ * ...Returns:
+ * ......the value of the number
+ */
+static double slowParseNumber(const char* str, const char* num_end,
+                              uint64_t mantissa, int exp10)
+{
+    char local_buf[NUMBER_BUF_SIZE];
+    char* buf = local_buf;
+    char decimal_point = localeconv()->decimal_point[0];
+    size_t len = num_end - str;
+    double result;
+
+    if (len >= sizeof(local_buf))
+    {
+        buf = (char *)malloc(len + 1);
+        if (buf == NULL)
+            return (double)mantissa * pow(10.0, exp10);
+    }
+
+    for (size_t i = 0; i < len; i++)
+        buf[i] = str[i] == '.' ? decimal_point : str[i];
+    buf[len] = '\0';
+
+    result = strtod(buf, NULL);
+
+    if (buf != local_buf)
+        free(buf);
+
+    return result;
+}
@@ -0,0 +1,334 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Evaluator library interface. All state lives in a         *
+ * caller-owned CalcContext, so separate contexts may be     *
+ * used concurrently from separate threads                   *
+ *************************************************************/
+
+#ifndef CALC_H
+#define CALC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest formatted result is -DBL_MAX at the largest fixed precision:
+// 309 integer digits, the decimal char, 17 decimal places and the sign,
+// plus the \0 char
+#define RESULT_STR_SIZE 330
+
+// Most decimal places formatResultFixed writes
+#define MAX_FIXED_PRECISION 17
+
+typedef enum
+{
+    CALC_OK = 0,
+    CALC_INVALID_OPERAND,
+    CALC_INVALID_OPERATOR,
+    CALC_MISSING_OPERAND,
+    CALC_DIVIDE_BY_ZERO,
+    CALC_NO_MEMORY,
+    CALC_UNKNOWN_VARIABLE,
+    CALC_UNBALANCED_PAREN,
+    CALC_BAD_ARGUMENTS,
+    CALC_NOT_EXACT,
+    CALC_TOO_LARGE
+} CalcStatus;
+
+// Arithmetic evalExpression, CalcStream and evalBinary evaluate with,
+// chosen per evaluation through ctx->mode. Compiled programs always use
+// CALC_MODE_DOUBLE
+typedef enum
+{
+    CALC_MODE_DOUBLE = 0, // one rounding per operation, the fast path
+    CALC_MODE_COMPENSATED, // each value carries its rounding error, so
+                           // long sums and products lose almost nothing
+    CALC_MODE_EXACT        // exact fractions of arbitrary size, rounded
+                           // to a double once at the end; sqrt, log and
+                           // fractional powers are CALC_NOT_EXACT, and
+                           // values beyond RATIONAL_MAX_LIMBS limbs
+                           // CALC_TOO_LARGE
+} CalcMode;
+
+struct ExprNode;
+struct NodeBlock;
+struct PreciseState;
+struct ProgramJit;
+struct IncNode;
+
+// Operand, operator and tree node stacks reused across evaluations; they
+// only grow, so steady-state evaluation never allocates
+typedef struct
+{
+    double* operands;
+    char* operators;
+    struct ExprNode** nodes;
+    size_t capacity;
+} ExprStacks;
+
+// Phases of handling one expression that CalcStats times separately
+typedef enum
+{
+    CALC_PHASE_TOKENIZE, // scanning tokens and converting operands
+    CALC_PHASE_VALIDATE, // checking operators and the operand count
+    CALC_PHASE_REDUCE,   // the order of operations reduction
+    CALC_PHASE_OUTPUT,   // formatting and writing results, by the caller
+    CALC_NUM_PHASES
+} CalcPhase;
+
+// Latency histogram buckets; bucket i counts expressions that took
+// from 2^i up to 2^(i+1) clock ticks
+#define CALC_LATENCY_BUCKETS 40
+
+// Counters kept per context when built with CALC_STATS, all zero
+// otherwise. Times are in ticks of the clock in stats.h
+typedef struct
+{
+    uint64_t expressions;
+    uint64_t failures;
+    uint64_t bytes;       // expression characters evaluated
+    uint64_t allocations; // heap allocations made while evaluating
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t cycles[CALC_NUM_PHASES];
+    uint64_t latency[CALC_LATENCY_BUCKETS];
+} CalcStats;
+
+typedef struct CacheEntry CacheEntry;
+
+// Least-recently-used cache of results, owned by the caller and attached
+// to a context through ctx->cache. Keys are expression texts without
+// insignificant whitespace; only successful results are kept
+typedef struct
+{
+    CacheEntry** buckets;
+    size_t num_buckets;   // a power of two
+    CacheEntry* newest;   // recency list, evicted from the oldest end
+    CacheEntry* oldest;
+    size_t num_entries;
+    size_t bytes;         // held by entries and buckets
+    size_t max_bytes;
+    char* key_buf;        // normalized key of the last lookup
+    size_t key_cap;
+    size_t key_len;
+    uint64_t key_hash;
+} ResultCache;
+
+// Why one expression failed, and where: offset and len locate the
+// offending token from the expression's first character, and are both
+// 0 when there is no token or only a copy of it is known
+typedef struct
+{
+    CalcStatus status;
+    size_t expression; // evaluations counted by the sink before this one
+    size_t offset;
+    size_t len;
+} CalcError;
+
+// Failures gathered while attached to ctx->errors, kept as records so
+// the caller can format them later or discard them unread
+typedef struct
+{
+    CalcError* records;
+    size_t num_records;
+    size_t capacity;
+    size_t num_evaluated; // evaluations counted, failed or not
+    size_t num_dropped;   // failures not recorded for lack of memory
+} CalcErrorSink;
+
+// Evaluator context, one per thread of evaluation
+typedef struct
+{
+    ExprStacks stacks;
+    struct NodeBlock* node_blocks; // arena holding the expression tree,
+    struct NodeBlock* node_block;  // reset for every expression: its
+    size_t node_used;              // blocks, the block in use and the
+                                   // nodes taken from that block
+    double* column_stack;         // runProgramColumns scratch: one block
+    const double** column_slots;  // of rows per value stack slot, and
+    size_t column_depth;          // the number of slots allocated
+    const char* error_token;      // offending token of the last failed
+    size_t error_len;             // call, points into that call's input
+    char* carry;                  // CalcStream scratch holding a token
+    size_t carry_cap;             // split between two pieces
+    ResultCache* cache;           // optional, consulted by evalExpression
+                                  // in CALC_MODE_DOUBLE
+    CalcErrorSink* errors;        // optional, receives a record of each
+                                  // failed evalExpression
+    CalcMode mode;                // arithmetic of the next evaluation
+    struct PreciseState* precise; // operands of the other modes
+    CalcStats stats;
+} CalcContext;
+
+// One step of a compiled expression, in reverse Polish order
+typedef enum
+{
+    INSTR_CONST, // push consts[arg]
+    INSTR_VAR,   // push bindings[arg]
+    INSTR_ADD,
+    INSTR_SUB,
+    INSTR_MUL,
+    INSTR_DIV,
+    INSTR_MOD,
+    INSTR_POW,
+    INSTR_MIN,
+    INSTR_MAX,
+    INSTR_NEG,   // negate the top value
+    INSTR_SQRT,  // replace the top value by its square root
+    INSTR_LOG,   // replace the top value by its natural logarithm
+    INSTR_STORE, // copy the top value to shared slot arg
+    INSTR_LOAD   // push shared slot arg
+} InstrCode;
+
+typedef struct
+{
+    InstrCode code;
+    size_t arg;
+} Instr;
+
+// Expression compiled once by compileExpression and run many times
+// against different variable bindings without parsing. The run and
+// the row functions interpret it at first and switch to native code
+// after JIT_THRESHOLD runs; a program may be run from several threads
+typedef struct
+{
+    Instr* code;
+    size_t num_code;
+    double* consts;
+    size_t num_consts;
+    int num_vars;
+    size_t max_stack; // deepest value stack the program needs
+    size_t num_slots; // shared slots holding repeated subexpressions
+    struct ProgramJit* jit; // promotion to native code once the program
+                            // is hot, NULL where there is no JIT
+} CalcProgram;
+
+// Expression kept evaluated by updateOperand while its numbers change
+// one at a time. The terms of the top-level sum are the leaves of a
+// segment tree of partial sums, so an update costs the operations above
+// the number within its term plus log2 of the number of terms. The sum
+// is grouped differently from evalExpression's, so under cancellation
+// or overflow the two results can differ by any amount
+typedef struct
+{
+    struct IncNode* nodes; // every term's tree, without the top-level sum
+    size_t num_nodes;
+    size_t* operands;      // node of each number, in the order written
+    size_t num_operands;
+    size_t* terms;         // root node of each term, in the order written
+    size_t num_terms;
+    double* sums;          // segment tree: sums[1] is the whole sum, and
+    size_t num_leaves;     // term t is leaf num_leaves + t
+    size_t num_failed;     // terms currently dividing by zero
+} CalcIncremental;
+
+// Longest part of an offending token a CalcStream keeps for its message
+#define STREAM_ERROR_SIZE 64
+
+// Evaluator for one expression fed in pieces by feedStream, for input
+// too long to hold in memory. Operators are applied as soon as
+// precedence allows, so only the pending ones and their operands are
+// kept: memory grows with nesting depth and the longest token, never
+// with the length of the expression
+typedef struct
+{
+    CalcContext* ctx;       // provides the pending stacks
+    size_t num_values;      // pending operands
+    size_t num_ops;         // pending operators
+    bool parse_operand;
+    CalcStatus status;      // first failure, later pieces are ignored
+    size_t carry_len;       // characters of the token cut off at the end
+                            // of the last piece, kept in ctx->carry
+    char last;              // last character fed
+    char error_buf[STREAM_ERROR_SIZE]; // copy of the offending token
+    CalcMode mode;          // ctx->mode at beginStream
+    uint64_t bytes;
+    uint64_t start;         // clock reading at beginStream, CALC_STATS
+} CalcStream;
+
+// Codes of the binary expression format read by evalBinary. Tokens are
+// in the same infix order as text, one code byte each; WIRE_NUMBER is
+// followed by its operand as 8 bytes of little-endian IEEE-754, and
+// WIRE_SUB or WIRE_ADD where an operand is expected is a sign. A
+// function code is followed by WIRE_OPEN, its arguments separated by
+// WIRE_COMMA, and WIRE_CLOSE
+typedef enum
+{
+    WIRE_NUMBER = 0,
+    WIRE_ADD,
+    WIRE_SUB,
+    WIRE_MUL,
+    WIRE_DIV,
+    WIRE_OPEN,
+    WIRE_CLOSE,
+    WIRE_MOD,
+    WIRE_POW,
+    WIRE_COMMA,
+    WIRE_SQRT,
+    WIRE_LOG,
+    WIRE_MIN,
+    WIRE_MAX
+} WireCode;
+
+void initContext(CalcContext* ctx);
+void freeContext(CalcContext* ctx);
+
+void initCache(ResultCache* cache, size_t max_bytes);
+void freeCache(ResultCache* cache);
+
+void initErrorSink(CalcErrorSink* sink);
+void clearErrorSink(CalcErrorSink* sink);
+void freeErrorSink(CalcErrorSink* sink);
+size_t formatCalcError(const CalcError* error, const char* exp, char* buf,
+                       size_t size);
+
+CalcStatus evalExpression(CalcContext* ctx, const char* exp, size_t len,
+                          double* result);
+CalcStatus evalExpressionParallel(CalcContext* const* ctxs, int num_ctx,
+                                  const char* exp, size_t len,
+                                  double* result);
+CalcContext* threadContext(void);
+CalcStatus evalString(const char* exp, double* result);
+
+CalcStatus compileExpression(CalcContext* ctx, const char* exp, size_t len,
+                             const char* const* var_names, int num_vars,
+                             CalcProgram* prog);
+CalcStatus runProgram(CalcContext* ctx, const CalcProgram* prog,
+                      const double* bindings, double* result);
+size_t runProgramRows(CalcContext* ctx, const CalcProgram* prog,
+                      const double* bindings, size_t num_rows,
+                      double* results, CalcStatus* statuses);
+size_t runProgramColumns(CalcContext* ctx, const CalcProgram* prog,
+                         const double* const* columns, size_t num_rows,
+                         double* results, unsigned char* div_zero);
+size_t runProgramColumnsParallel(CalcContext* const* ctxs, int num_ctx,
+                                 const CalcProgram* prog,
+                                 const double* const* columns,
+                                 size_t num_rows, double* results,
+                                 unsigned char* div_zero);
+void freeProgram(CalcProgram* prog);
+
+CalcStatus buildIncremental(CalcContext* ctx, const char* exp, size_t len,
+                            CalcIncremental* inc);
+CalcStatus updateOperand(CalcIncremental* inc, size_t index, double value,
+                         double* result);
+CalcStatus incrementalResult(const CalcIncremental* inc, double* result);
+void freeIncremental(CalcIncremental* inc);
+
+void beginStream(CalcContext* ctx, CalcStream* stream);
+CalcStatus feedStream(CalcStream* stream, const char* piece, size_t len);
+CalcStatus endStream(CalcStream* stream, double* result);
+
+CalcStatus evalBinary(CalcContext* ctx, const unsigned char* exp, size_t len,
+                      double* result);
+
+const char* statusMessage(CalcStatus status);
+bool parseValue(const char* str, size_t len, double* value);
+void mergeStats(CalcStats* total, const CalcStats* stats);
+size_t formatResult(double val, char* buf, size_t size);
+size_t formatResultFixed(double val, int precision, char* buf,
+                         size_t size);
+
+#endif // CALC_H
@@ -0,0 +1,276 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Helpers shared between the library's translation units.   *
+ * Not part of the public interface in calc.h                *
+ *************************************************************/
+
+#ifndef CALC_INTERNAL_H
+#define CALC_INTERNAL_H
+
+#include "calc.h"
+
+#include <float.h>
+
+// Operators, functions and punctuation of the grammar, indexing
+// op_table; operator stacks hold these codes
+typedef enum
+{
+    OP_NONE = 0,
+    OP_ADD,    // arity 2, applied by applyOp
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_POW,
+    OP_MIN,
+    OP_MAX,
+    OP_NEGATE, // arity 1, applied by applyUnary
+    OP_SQRT,
+    OP_LOG,
+    OP_OPEN,   // punctuation
+    OP_CLOSE,
+    OP_COMMA,
+    OP_ARGS,   // operator stack only: the ( of a call past its comma
+    NUM_OPS
+} OpCode;
+
+// Registry entry describing one OpCode
+typedef struct
+{
+    const char* name;         // spelling in expressions
+    unsigned char arity;      // operands taken, 0 for punctuation
+    unsigned char precedence; // binding strength of prefix and infix
+                              // operators, higher binds tighter
+    bool right_assoc;         // a ^ b ^ c is a ^ (b ^ c)
+    bool function;            // written name(arguments)
+    InstrCode instr;          // compiled form
+} OpInfo;
+
+extern const OpInfo op_table[NUM_OPS];
+
+typedef enum
+{
+    NODE_NUMBER, // value
+    NODE_VAR,    // bindings[var]
+    NODE_UNARY,  // op left
+    NODE_BINARY  // left op right
+} NodeKind;
+
+// Nodes per arena block
+#define NODE_BLOCK_SIZE 1024
+
+// Smallest piece of an expression evalExpressionParallel gives a thread
+// of its own. The fuzz build lowers it so that short inputs are split
+#ifndef SPLIT_MIN_SIZE
+#define SPLIT_MIN_SIZE (256 * 1024)
+#endif
+
+// ExprNode.slot of a node the compiler has not emitted yet
+#define NO_SLOT SIZE_MAX
+
+// Expression tree node, allocated from the context's arena
+typedef struct ExprNode
+{
+    NodeKind kind;
+    OpCode op;    // NODE_UNARY, NODE_BINARY: operation of that arity
+    int var;      // NODE_VAR: index into the bindings
+    double value; // NODE_NUMBER: the number, otherwise the evaluated value
+    struct ExprNode* left;
+    struct ExprNode* right;
+    struct ExprNode* canon; // optimizeTree: the shared node equal to this
+    size_t refs;            // optimizeTree: references from the tree
+    size_t slot;            // compiler: shared slot, or constant index of
+                            // a number, NO_SLOT until emitted
+    bool expanded;          // compiler: operands already scheduled
+} ExprNode;
+
+// Fixed-size block of the node arena; blocks are chained and reused
+struct NodeBlock
+{
+    struct NodeBlock* next;
+    ExprNode nodes[NODE_BLOCK_SIZE];
+};
+
+// Node of a CalcIncremental; operands come before the nodes using them
+struct IncNode
+{
+    OpCode op;     // OP_NONE for a number
+    bool failed;   // divides by zero here or below
+    bool negated;  // term root: subtracted from the top-level sum
+    size_t left;
+    size_t right;
+    size_t parent; // NO_SLOT for the root of a term
+    size_t term;   // index of the term rooted here, NO_SLOT elsewhere
+    double value;
+};
+
+typedef struct IncNode IncNode;
+
+// Compiled programs are translated to native code on x86-64 with the
+// System V calling convention, unless built with make JIT=0
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32) \
+    && !defined(CALC_NO_JIT)
+#define CALC_JIT
+#endif
+
+// Native translation of a program. It returns 0 after storing the
+// result, or 1 on a division by zero. stack has room for max_stack
+// values followed by the shared slots, as in execProgram
+typedef int (*JitFn)(const double* consts, const double* bindings,
+                     double* stack, double* result);
+
+typedef struct
+{
+    JitFn fn;
+    void* code;  // executable mapping holding fn
+    size_t size;
+} JitCode;
+
+// States of a program's promotion to native code
+typedef enum
+{
+    JIT_COLD = 0, // interpreted, counting runs
+    JIT_BUSY,     // being translated by one thread, interpreted by others
+    JIT_READY,    // code.fn runs it
+    JIT_FAILED    // could not be translated, interpreted from now on
+} JitState;
+
+// Promotion state held by a CalcProgram. Programs may be run from
+// several threads at once, so runs and state change atomically
+struct ProgramJit
+{
+    uint64_t runs;
+    int state;     // a JitState
+    JitCode code;  // set before state becomes JIT_READY
+};
+
+// Largest number of 32-bit limbs in one integer of CALC_MODE_EXACT,
+// about 630000 decimal digits. The fuzz build lowers it so that powers
+// fail quickly rather than multiplying out to the limit
+#ifndef RATIONAL_MAX_LIMBS
+#define RATIONAL_MAX_LIMBS (1 << 16)
+#endif
+
+// Temporaries in a RationalScratch
+#define RATIONAL_TEMPS 7
+
+// compareRational result when a product was too large or memory ran out
+#define COMPARE_FAILED 2
+
+// Nonnegative integer, least significant limb first, without leading
+// zero limbs; zero has no limbs
+typedef struct
+{
+    uint32_t* limbs;
+    size_t len;
+    size_t cap;
+} BigNat;
+
+// Exact fraction in lowest terms; den is positive and zero is 0/1
+typedef struct
+{
+    bool negative;
+    BigNat num;
+    BigNat den;
+} Rational;
+
+// Temporaries reused by the rational operations
+typedef struct
+{
+    BigNat t[RATIONAL_TEMPS];
+} RationalScratch;
+
+// Pending operands of CALC_MODE_COMPENSATED and CALC_MODE_EXACT, kept
+// alongside ctx->stacks.operands and indexed the same way. The stream
+// evaluator is the only one that uses them
+struct PreciseState
+{
+    double* lo;         // compensated: error term of each operand, whose
+                        // high part is in ctx->stacks.operands
+    Rational* values;   // exact: each operand
+    size_t capacity;
+    RationalScratch scratch;
+    CalcStream stream;  // evalExpression's stream, so that
+                        // ctx->error_token outlives the call
+};
+
+CalcStatus parseTree(CalcContext* ctx, const char* exp, size_t len,
+                     const char* const* var_names, int num_vars,
+                     ExprNode** root);
+CalcStatus evalTree(CalcContext* ctx, const double* bindings,
+                    double* result);
+CalcStatus optimizeTree(CalcContext* ctx, ExprNode** root);
+void resetNodes(CalcContext* ctx);
+void freeNodes(CalcContext* ctx);
+
+bool nextToken(const char** cursor, const char* end,
+               const char** token, size_t* token_len);
+bool nextOperand(const char** cursor, const char* end, const char** token,
+                 size_t* token_len, double* value, bool* is_number);
+bool parseNumber(const char* str, const char* end, double* value,
+                 const char** num_end);
+bool isDelimiterChar(char c);
+OpCode lookupOp(const char* token, size_t len);
+bool validOperator(OpCode op);
+bool bindsFirst(OpCode pending, OpCode op);
+CalcStatus closeGroup(char* ops, size_t* num_ops, OpCode op);
+double applyOp(double a, double b, OpCode op);
+double applyUnary(double x, OpCode op);
+bool reserveStacks(ExprStacks* stacks, size_t count);
+void streamOperand(CalcStream* stream, double value, const char* token,
+                   size_t len);
+void streamSymbol(CalcStream* stream, OpCode op, const char* token,
+                  size_t len);
+CalcStatus evalPrecise(CalcContext* ctx, const char* exp, size_t len,
+                       double* result);
+bool reservePrecise(CalcContext* ctx, size_t count);
+CalcStatus pushPrecise(CalcContext* ctx, CalcMode mode, size_t index,
+                       double value, const char* token, size_t len);
+CalcStatus applyPrecise(CalcContext* ctx, CalcMode mode, size_t top,
+                        OpCode op);
+CalcStatus resultPrecise(CalcContext* ctx, CalcMode mode, double* result);
+void freePrecise(CalcContext* ctx);
+void initRational(Rational* x);
+void freeRational(Rational* x);
+void initScratch(RationalScratch* s);
+void freeScratch(RationalScratch* s);
+CalcStatus parseRational(Rational* x, const char* token, size_t len,
+                         RationalScratch* s);
+CalcStatus doubleToRational(Rational* x, double value);
+CalcStatus applyRational(Rational* a, const Rational* b, OpCode op,
+                         RationalScratch* s);
+CalcStatus applyRationalUnary(Rational* x, OpCode op);
+int compareRational(const Rational* a, const Rational* b,
+                    RationalScratch* s);
+CalcStatus rationalToDouble(const Rational* x, RationalScratch* s,
+                            double* value);
+bool jitCompile(const CalcProgram* prog, JitCode* jit);
+void jitFree(JitCode* jit);
+bool lookupCache(ResultCache* cache, const char* exp, size_t len,
+                 double* result);
+void storeCache(ResultCache* cache, double value);
+void recordEval(CalcStats* stats, CalcStatus status, size_t len,
+                uint64_t ticks);
+void recordError(CalcErrorSink* sink, const CalcContext* ctx,
+                 CalcStatus status, const char* exp, size_t len);
+
+/* dividesByZero
+ * ...Tell whether applying a binary operation divides by zero: / and %
+ * ...by a divisor closer to zero than DBL_EPSILON, the test the compiled
+ * ...interpreters and vector kernels make. Callers test the divisor
+ * ...rather than the result, since DBL_MAX is also a result
+ * ...Parameters:
+ * ......double b -- the second operand
+ * ......OpCode op -- the operation, one with arity 2
+ * ...Returns:
+ * ......true if op divides by zero, false otherwise
+ */
+static inline bool dividesByZero(double b, OpCode op)
+{
+    return (op == OP_DIV || op == OP_MOD)
+           && b < DBL_EPSILON && b > -DBL_EPSILON;
+}
+
+#endif // CALC_INTERNAL_H
@@ -0,0 +1,122 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Options shared by the command line program's input modes  *
+ *************************************************************/
+
+#ifndef CLI_H
+#define CLI_H
+
+#include "calc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Binary mode framing: each expression is a 4-byte little-endian length
+// followed by that many bytes of WireCode tokens, and each reply is the
+// CalcStatus as one byte followed by the result as 8 bytes of
+// little-endian IEEE-754 (0 on failure)
+#define WIRE_HEADER_SIZE 4
+#define WIRE_REPLY_SIZE 9
+
+// Room for the longest status message and its separator in an error
+// line, beyond the offending token itself
+#define ERROR_MESSAGE_SIZE 64
+
+typedef enum
+{
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON
+} StatsFormat;
+
+typedef struct
+{
+    int num_threads;   // batch worker threads, 1 evaluates serially
+    int precision;     // fixed decimal places, negative for shortest
+    StatsFormat stats; // report printed to stderr at exit
+    size_t cache_size; // bytes of result cache, shared out among the
+                       // threads; 0 for no cache
+    bool binary;       // framed WireCode input and binary replies
+    CalcMode mode;     // arithmetic of every evaluation context
+} CliOptions;
+
+/* formatValue
+ * ...Format a result the way the options ask for
+ * ...Parameters:
+ * ......const CliOptions* opts -- command line options
+ * ......double val -- value to format
+ * ......char* buf -- destination, at least RESULT_STR_SIZE chars
+ * ...Returns:
+ * ......the number of characters written, not counting the \0 char
+ */
+static inline size_t formatValue(const CliOptions* opts, double val, char* buf)
+{
+    return opts->precision < 0
+           ? formatResult(val, buf, RESULT_STR_SIZE)
+           : formatResultFixed(val, opts->precision, buf, RESULT_STR_SIZE);
+}
+
+/* formatError
+ * ...Format the message for an expression that failed to evaluate
+ * ...Parameters:
+ * ......const CalcContext* ctx -- context the expression was evaluated in
+ * ......CalcStatus status -- code returned by the evaluator
+ * ......char* buf -- destination, at least ctx->error_len
+ * ...... + ERROR_MESSAGE_SIZE chars
+ * ...Returns:
+ * ......the number of characters written, not counting the \0 char
+ */
+static inline size_t formatError(const CalcContext* ctx, CalcStatus status,
+                                 char* buf)
+{
+    const char* message = statusMessage(status);
+    size_t len = strlen(message);
+
+    memcpy(buf, message, len);
+    if (ctx->error_token != NULL)
+    {
+        memcpy(buf + len, ": ", 2);
+        memcpy(buf + len + 2, ctx->error_token, ctx->error_len);
+        len += 2 + ctx->error_len;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* wireLength
+ * ...Read the length from a binary mode frame header
+ * ...Parameters:
+ * ......const unsigned char* header -- WIRE_HEADER_SIZE bytes
+ * ...Returns:
+ * ......the number of token bytes that follow the header
+ */
+static inline size_t wireLength(const unsigned char* header)
+{
+    return (size_t)header[0] | (size_t)header[1] << 8
+           | (size_t)header[2] << 16 | (size_t)header[3] << 24;
+}
+
+/* formatWireReply
+ * ...Encode the binary mode reply for an evaluated expression
+ * ...Parameters:
+ * ......CalcStatus status -- code returned by evalBinary
+ * ......double result -- value to send, 0.0 unless status is CALC_OK
+ * ......unsigned char* buf -- destination, WIRE_REPLY_SIZE bytes
+ * ...Returns:
+ * ......Nothing
+ */
+static inline void formatWireReply(CalcStatus status, double result,
+                                   unsigned char* buf)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &result, sizeof(bits));
+    buf[0] = (unsigned char)status;
+    for (int i = 1; i < WIRE_REPLY_SIZE; i++, bits >>= 8)
+        buf[i] = (unsigned char)bits;
+}
+
+#endif // CLI_H
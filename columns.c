@@ -0,0 +1,393 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Columnar evaluation of compiled programs. Each program    *
+ * step runs over a block of rows at once with the widest    *
+ * vector unit the build targets (AVX-512, AVX2 or NEON),    *
+ * falling back to plain scalar loops                        *
+ *************************************************************/
+
+#include "calc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Rows evaluated per pass over the program; one block of every stack
+// slot stays in L1/L2 cache
+#define COLUMN_BLOCK 256
+
+/* Vector abstraction: Vec holds VEC_WIDTH doubles, and vecZeroMask sets
+ * bit i when lane i is too close to zero to divide by (|b| < DBL_EPSILON,
+ * the same test applyOp uses). vecMin and vecMax pick b unless a < b or
+ * a > b holds, as the x86 instructions do and as applyOp does */
+#if defined(__AVX512F__)
+
+#define VEC_WIDTH 8
+typedef __m512d Vec;
+static inline Vec vecLoad(const double* p) { return _mm512_loadu_pd(p); }
+static inline void vecStore(double* p, Vec v) { _mm512_storeu_pd(p, v); }
+static inline Vec vecAdd(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+static inline Vec vecSub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+static inline Vec vecMul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+static inline Vec vecDiv(Vec a, Vec b) { return _mm512_div_pd(a, b); }
+static inline Vec vecMin(Vec a, Vec b) { return _mm512_min_pd(a, b); }
+static inline Vec vecMax(Vec a, Vec b) { return _mm512_max_pd(a, b); }
+static inline Vec vecSqrt(Vec a) { return _mm512_sqrt_pd(a); }
+static inline unsigned vecZeroMask(Vec b)
+{
+    return _mm512_cmp_pd_mask(_mm512_abs_pd(b),
+                              _mm512_set1_pd(DBL_EPSILON), _CMP_LT_OQ);
+}
+
+#elif defined(__AVX2__)
+
+#define VEC_WIDTH 4
+typedef __m256d Vec;
+static inline Vec vecLoad(const double* p) { return _mm256_loadu_pd(p); }
+static inline void vecStore(double* p, Vec v) { _mm256_storeu_pd(p, v); }
+static inline Vec vecAdd(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+static inline Vec vecSub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+static inline Vec vecMul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+static inline Vec vecDiv(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+static inline Vec vecMin(Vec a, Vec b) { return _mm256_min_pd(a, b); }
+static inline Vec vecMax(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+static inline Vec vecSqrt(Vec a) { return _mm256_sqrt_pd(a); }
+static inline unsigned vecZeroMask(Vec b)
+{
+    Vec abs_b = _mm256_andnot_pd(_mm256_set1_pd(-0.0), b);
+    return (unsigned)_mm256_movemask_pd(
+        _mm256_cmp_pd(abs_b, _mm256_set1_pd(DBL_EPSILON), _CMP_LT_OQ));
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+#define VEC_WIDTH 2
+typedef float64x2_t Vec;
+static inline Vec vecLoad(const double* p) { return vld1q_f64(p); }
+static inline void vecStore(double* p, Vec v) { vst1q_f64(p, v); }
+static inline Vec vecAdd(Vec a, Vec b) { return vaddq_f64(a, b); }
+static inline Vec vecSub(Vec a, Vec b) { return vsubq_f64(a, b); }
+static inline Vec vecMul(Vec a, Vec b) { return vmulq_f64(a, b); }
+static inline Vec vecDiv(Vec a, Vec b) { return vdivq_f64(a, b); }
+static inline Vec vecMin(Vec a, Vec b)
+{
+    return vbslq_f64(vcltq_f64(a, b), a, b);
+}
+static inline Vec vecMax(Vec a, Vec b)
+{
+    return vbslq_f64(vcgtq_f64(a, b), a, b);
+}
+static inline Vec vecSqrt(Vec a) { return vsqrtq_f64(a); }
+static inline unsigned vecZeroMask(Vec b)
+{
+    uint64x2_t lt = vcaltq_f64(b, vdupq_n_f64(DBL_EPSILON));
+    return (unsigned)(vgetq_lane_u64(lt, 0) & 1)
+           | (unsigned)(vgetq_lane_u64(lt, 1) & 2);
+}
+
+#else
+
+#define VEC_WIDTH 1
+typedef double Vec;
+static inline Vec vecLoad(const double* p) { return *p; }
+static inline void vecStore(double* p, Vec v) { *p = v; }
+static inline Vec vecAdd(Vec a, Vec b) { return a + b; }
+static inline Vec vecSub(Vec a, Vec b) { return a - b; }
+static inline Vec vecMul(Vec a, Vec b) { return a * b; }
+static inline Vec vecDiv(Vec a, Vec b) { return a / b; }
+static inline Vec vecMin(Vec a, Vec b) { return a < b ? a : b; }
+static inline Vec vecMax(Vec a, Vec b) { return a > b ? a : b; }
+static inline Vec vecSqrt(Vec a) { return sqrt(a); }
+static inline unsigned vecZeroMask(Vec b)
+{
+    return (b < DBL_EPSILON && b > -DBL_EPSILON) ? 1u : 0u;
+}
+
+#endif
+
+static bool reserveColumns(CalcContext*, size_t);
+static void columnOp(InstrCode, const double*, const double*, double*,
+                     unsigned char*, size_t);
+static void columnUnary(InstrCode, const double*, double*, size_t);
+
+/* runProgramColumns
+ * ...Evaluate a compiled program over columns of variable values
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, provides scratch blocks
+ * ......const CalcProgram* prog -- program from compileExpression
+ * ......const double* const* columns -- one column of num_rows values
+ * ...... per variable, in the order the variables were compiled
+ * ......size_t num_rows -- number of rows to evaluate
+ * ......double* results -- receives one result per row, 0.0 on failure
+ * ......unsigned char* div_zero -- receives 1 for each row that divided
+ * ...... by zero and 0 for every other row
+ * ...Returns:
+ * ......the number of rows that divided by zero, or num_rows with every
+ * ...... div_zero entry set if scratch space could not be allocated
+ */
+size_t runProgramColumns(CalcContext* ctx, const CalcProgram* prog,
+                         const double* const* columns, size_t num_rows,
+                         double* results, unsigned char* div_zero)
+{
+    const double** slots;
+    double* slot_buf;
+    const Instr* ip;
+    const Instr* end = prog->code + prog->num_code;
+    size_t num_failed = 0;
+    size_t n;
+    size_t top; // index of the top value stack slot, plus one
+
+    if (!reserveColumns(ctx, prog->max_stack + prog->num_slots))
+    {
+        memset(results, 0, num_rows * sizeof(double));
+        memset(div_zero, 1, num_rows);
+        return num_rows;
+    }
+
+    slots = ctx->column_slots;
+
+    for (size_t start = 0; start < num_rows; start += COLUMN_BLOCK)
+    {
+        n = num_rows - start < COLUMN_BLOCK ? num_rows - start : COLUMN_BLOCK;
+        memset(div_zero + start, 0, n);
+        top = 0;
+
+        for (ip = prog->code; ip < end; ip++)
+        {
+            switch (ip->code)
+            {
+                case INSTR_CONST:
+                    slot_buf = ctx->column_stack + top * COLUMN_BLOCK;
+                    for (size_t i = 0; i < n; i++)
+                        slot_buf[i] = prog->consts[ip->arg];
+                    slots[top++] = slot_buf;
+                    break;
+
+                case INSTR_VAR: // read straight from the input column
+                    slots[top++] = columns[ip->arg] + start;
+                    break;
+
+                case INSTR_NEG:
+                case INSTR_SQRT:
+                case INSTR_LOG:
+                    slot_buf = ctx->column_stack + (top - 1) * COLUMN_BLOCK;
+                    columnUnary(ip->code, slots[top - 1], slot_buf, n);
+                    slots[top - 1] = slot_buf;
+                    break;
+
+                case INSTR_STORE: // shared slots follow the stack blocks
+                    memcpy(ctx->column_stack
+                           + (prog->max_stack + ip->arg) * COLUMN_BLOCK,
+                           slots[top - 1], n * sizeof(double));
+                    break;
+
+                case INSTR_LOAD:
+                    slots[top++] = ctx->column_stack
+                                   + (prog->max_stack + ip->arg)
+                                     * COLUMN_BLOCK;
+                    break;
+
+                default:
+                    top--;
+                    slot_buf = ctx->column_stack + (top - 1) * COLUMN_BLOCK;
+                    columnOp(ip->code, slots[top - 1], slots[top], slot_buf,
+                             div_zero + start, n);
+                    slots[top - 1] = slot_buf;
+            }
+        }
+
+        memcpy(results + start, slots[0], n * sizeof(double));
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (div_zero[start + i])
+            {
+                results[start + i] = 0.0;
+                num_failed++;
+            }
+        }
+    }
+
+    return num_failed;
+}
+
+/* columnOp
+ * ...Apply one binary instruction to n lanes
+ * ...Parameters:
+ * ......InstrCode code -- instruction with two operands
+ * ......const double* a -- left operands
+ * ......const double* b -- right operands
+ * ......double* out -- results, may alias a
+ * ......unsigned char* div_zero -- set to 1 for lanes that divide by zero,
+ * ...... for INSTR_DIV and INSTR_MOD
+ * ......size_t n -- number of lanes
+ * ...Returns:
+ * ......Nothing
+ */
+static void columnOp(InstrCode code, const double* a, const double* b,
+                     double* out, unsigned char* div_zero, size_t n)
+{
+    size_t i = 0;
+    unsigned mask;
+    Vec vb;
+
+    switch (code)
+    {
+        case INSTR_ADD:
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+                vecStore(out + i, vecAdd(vecLoad(a + i), vecLoad(b + i)));
+            for (; i < n; i++)
+                out[i] = a[i] + b[i];
+            break;
+
+        case INSTR_SUB:
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+                vecStore(out + i, vecSub(vecLoad(a + i), vecLoad(b + i)));
+            for (; i < n; i++)
+                out[i] = a[i] - b[i];
+            break;
+
+        case INSTR_MUL:
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+                vecStore(out + i, vecMul(vecLoad(a + i), vecLoad(b + i)));
+            for (; i < n; i++)
+                out[i] = a[i] * b[i];
+            break;
+
+        case INSTR_DIV:
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+            {
+                vb = vecLoad(b + i);
+                mask = vecZeroMask(vb);
+                for (int lane = 0; mask != 0; lane++, mask >>= 1)
+                    div_zero[i + lane] |= (unsigned char)(mask & 1);
+                vecStore(out + i, vecDiv(vecLoad(a + i), vb));
+            }
+            for (; i < n; i++)
+            {
+                if (b[i] < DBL_EPSILON && b[i] > -DBL_EPSILON)
+                    div_zero[i] = 1;
+                out[i] = a[i] / b[i];
+            }
+            break;
+
+        case INSTR_MOD: // no vector fmod, so only the zero test is wide
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+            {
+                mask = vecZeroMask(vecLoad(b + i));
+                for (int lane = 0; mask != 0; lane++, mask >>= 1)
+                    div_zero[i + lane] |= (unsigned char)(mask & 1);
+            }
+            for (; i < n; i++)
+            {
+                if (b[i] < DBL_EPSILON && b[i] > -DBL_EPSILON)
+                    div_zero[i] = 1;
+            }
+            for (i = 0; i < n; i++)
+                out[i] = fmod(a[i], b[i]);
+            break;
+
+        case INSTR_POW:
+            for (; i < n; i++)
+                out[i] = pow(a[i], b[i]);
+            break;
+
+        case INSTR_MIN:
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+                vecStore(out + i, vecMin(vecLoad(a + i), vecLoad(b + i)));
+            for (; i < n; i++)
+                out[i] = a[i] < b[i] ? a[i] : b[i];
+            break;
+
+        case INSTR_MAX:
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+                vecStore(out + i, vecMax(vecLoad(a + i), vecLoad(b + i)));
+            for (; i < n; i++)
+                out[i] = a[i] > b[i] ? a[i] : b[i];
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* columnUnary
+ * ...Apply one single-operand instruction to n lanes
+ * ...Parameters:
+ * ......InstrCode code -- INSTR_NEG, INSTR_SQRT or INSTR_LOG
+ * ......const double* a -- operands
+ * ......double* out -- results, may alias a
+ * ......size_t n -- number of lanes
+ * ...Returns:
+ * ......Nothing
+ */
+static void columnUnary(InstrCode code, const double* a, double* out,
+                        size_t n)
+{
+    size_t i = 0;
+
+    switch (code)
+    {
+        case INSTR_NEG:
+            for (; i < n; i++)
+                out[i] = -a[i];
+            break;
+
+        case INSTR_SQRT:
+            for (; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+                vecStore(out + i, vecSqrt(vecLoad(a + i)));
+            for (; i < n; i++)
+                out[i] = sqrt(a[i]);
+            break;
+
+        case INSTR_LOG:
+            for (; i < n; i++)
+                out[i] = log(a[i]);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* reserveColumns
+ * ...Make sure ctx has one scratch block per value stack slot
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context
+ * ......size_t depth -- number of value stack and shared slots required
+ * ...Returns:
+ * ......false if the scratch space could not be grown, true otherwise
+ */
+static bool reserveColumns(CalcContext* ctx, size_t depth)
+{
+    double* new_stack;
+    const double** new_slots;
+
+    if (depth <= ctx->column_depth)
+        return true;
+
+    new_stack = (double *)realloc(ctx->column_stack,
+                                  sizeof(double) * COLUMN_BLOCK * depth);
+    if (new_stack == NULL)
+        return false;
+    ctx->column_stack = new_stack;
+
+    new_slots = (const double **)realloc((void *)ctx->column_slots,
+                                         sizeof(const double*) * depth);
+    if (new_slots == NULL)
+        return false;
+    ctx->column_slots = new_slots;
+
+    ctx->column_depth = depth;
+
+    return true;
+}
@@ -0,0 +1,497 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Compiles the tree of an expression with named variables   *
+ * into a reverse Polish program, then runs that program     *
+ * against variable bindings without parsing it again        *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// Runs after which a program is translated to native code; below this
+// the translation costs more than it saves
+#define JIT_THRESHOLD 1024
+
+static CalcStatus emitProgram(CalcContext*, ExprNode*, CalcProgram*);
+static bool appendInstr(CalcProgram*, size_t*, InstrCode, size_t);
+static bool appendConst(CalcProgram*, size_t*, double);
+static bool execLibm(InstrCode, double**);
+static CalcStatus execProgram(const CalcProgram*, const double*,
+                              double*, double*);
+static JitFn hotCode(const CalcProgram*, size_t);
+
+/* compileExpression
+ * ...Compile an expression into a reverse Polish program. Operands may
+ * ...be numbers or the names of variables bound when the program runs.
+ * ...Constant subexpressions are folded, and a subexpression that
+ * ...appears more than once is computed once and kept in a shared slot
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, provides scratch space
+ * ......const char* exp -- characters of the expression, need not be
+ * ...... NUL-terminated and are never modified
+ * ......size_t len -- number of characters in exp
+ * ......const char* const* var_names -- variable names; the position of
+ * ...... a name is the index of its value in the bindings at run time
+ * ......int num_vars -- number of entries in var_names
+ * ......CalcProgram* prog -- receives the program, release it with
+ * ...... freeProgram
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... on failure prog is left empty and, for a bad token,
+ * ...... ctx->error_token and ctx->error_len identify it
+ */
+CalcStatus compileExpression(CalcContext* ctx, const char* exp, size_t len,
+                             const char* const* var_names, int num_vars,
+                             CalcProgram* prog)
+{
+    ExprNode* root;
+    CalcStatus status;
+
+    memset(prog, 0, sizeof(*prog));
+    prog->num_vars = num_vars;
+
+    status = parseTree(ctx, exp, len, var_names, num_vars, &root);
+    if (status == CALC_OK)
+        status = optimizeTree(ctx, &root);
+    if (status == CALC_OK)
+        status = emitProgram(ctx, root, prog);
+
+    if (status != CALC_OK)
+        freeProgram(prog);
+#ifdef CALC_JIT
+    else // without this state the program is only ever interpreted
+        prog->jit = (struct ProgramJit *)calloc(1, sizeof(*prog->jit));
+#endif
+
+    return status;
+}
+
+/* emitProgram
+ * ...Write the reverse Polish code of an optimized tree without
+ * ...recursing, using the node stack for a post-order walk. A node the
+ * ...tree refers to more than once is computed the first time it is
+ * ...reached and stored in a shared slot, then loaded from that slot
+ * ...Parameters:
+ * ......CalcContext* ctx -- context whose node stack holds the walk
+ * ......ExprNode* root -- root of the tree from optimizeTree
+ * ......CalcProgram* prog -- empty program that receives the code
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_NO_MEMORY otherwise
+ */
+static CalcStatus emitProgram(CalcContext* ctx, ExprNode* root,
+                              CalcProgram* prog)
+{
+    ExprNode** stack = ctx->stacks.nodes; // sized by optimizeTree
+    ExprNode* node;
+    size_t code_cap = 0;
+    size_t const_cap = 0;
+    size_t count = 1; // entries on the walk stack
+    size_t depth = 0;
+    bool ok = true;
+
+    stack[0] = root;
+
+    while (ok && count > 0)
+    {
+        node = stack[count - 1];
+
+        if (node->kind == NODE_NUMBER)
+        {   // equal numbers were merged, so each gets one constant
+            if (node->slot == NO_SLOT)
+            {
+                ok = appendConst(prog, &const_cap, node->value);
+                node->slot = prog->num_consts - 1;
+            }
+            ok = ok && appendInstr(prog, &code_cap, INSTR_CONST, node->slot);
+            depth++;
+            count--;
+        }
+        else if (node->kind == NODE_VAR)
+        {
+            ok = appendInstr(prog, &code_cap, INSTR_VAR, node->var);
+            depth++;
+            count--;
+        }
+        else if (node->slot != NO_SLOT)
+        {   // computed earlier
+            ok = appendInstr(prog, &code_cap, INSTR_LOAD, node->slot);
+            depth++;
+            count--;
+        }
+        else if (!node->expanded)
+        {   // operands first, left on top so it is emitted first
+            node->expanded = true;
+            if (node->right != NULL)
+                stack[count++] = node->right;
+            stack[count++] = node->left;
+            continue;
+        }
+        else
+        {
+            ok = appendInstr(prog, &code_cap, op_table[node->op].instr, 0);
+            if (node->kind == NODE_BINARY)
+                depth--;
+
+            if (ok && node->refs > 1)
+            {
+                node->slot = prog->num_slots++;
+                ok = appendInstr(prog, &code_cap, INSTR_STORE, node->slot);
+            }
+            count--;
+        }
+
+        if (depth > prog->max_stack)
+            prog->max_stack = depth;
+    }
+
+    return ok ? CALC_OK : CALC_NO_MEMORY;
+}
+
+/* runProgram
+ * ...Evaluate a compiled program for one set of variable bindings
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, provides the value stack
+ * ......const CalcProgram* prog -- program from compileExpression
+ * ......const double* bindings -- prog->num_vars variable values
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ */
+CalcStatus runProgram(CalcContext* ctx, const CalcProgram* prog,
+                      const double* bindings, double* result)
+{
+    JitFn fn;
+
+    *result = 0.0;
+
+    if (!reserveStacks(&ctx->stacks, prog->max_stack + prog->num_slots))
+        return CALC_NO_MEMORY;
+
+    if ((fn = hotCode(prog, 1)) != NULL)
+        return fn(prog->consts, bindings, ctx->stacks.operands, result) == 0
+               ? CALC_OK : CALC_DIVIDE_BY_ZERO;
+
+    return execProgram(prog, bindings, ctx->stacks.operands, result);
+}
+
+/* runProgramRows
+ * ...Evaluate a compiled program for many sets of variable bindings
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, provides the value stack
+ * ......const CalcProgram* prog -- program from compileExpression
+ * ......const double* bindings -- num_rows rows of prog->num_vars values
+ * ......size_t num_rows -- number of rows to evaluate
+ * ......double* results -- receives one result per row, 0.0 on failure
+ * ......CalcStatus* statuses -- receives one status per row, may be NULL
+ * ...Returns:
+ * ......the number of rows that failed to evaluate
+ */
+size_t runProgramRows(CalcContext* ctx, const CalcProgram* prog,
+                      const double* bindings, size_t num_rows,
+                      double* results, CalcStatus* statuses)
+{
+    size_t num_failed = 0;
+    CalcStatus status;
+    JitFn fn;
+
+    if (!reserveStacks(&ctx->stacks, prog->max_stack + prog->num_slots))
+    {
+        for (size_t row = 0; row < num_rows; row++)
+        {
+            results[row] = 0.0;
+            if (statuses != NULL)
+                statuses[row] = CALC_NO_MEMORY;
+        }
+        return num_rows;
+    }
+
+    fn = hotCode(prog, num_rows);
+    for (size_t row = 0; row < num_rows; row++)
+    {
+        if (fn == NULL)
+            status = execProgram(prog, bindings + row * prog->num_vars,
+                                 ctx->stacks.operands, &results[row]);
+        else if (fn(prog->consts, bindings + row * prog->num_vars,
+                    ctx->stacks.operands, &results[row]) != 0)
+        {
+            results[row] = 0.0;
+            status = CALC_DIVIDE_BY_ZERO;
+        }
+        else
+            status = CALC_OK;
+        if (statuses != NULL)
+            statuses[row] = status;
+        if (status != CALC_OK)
+            num_failed++;
+    }
+
+    return num_failed;
+}
+
+/* freeProgram
+ * ...Release the storage held by a compiled program
+ * ...Parameters:
+ * ......CalcProgram* prog -- program to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeProgram(CalcProgram* prog)
+{
+#ifdef CALC_JIT
+    if (prog->jit != NULL)
+        jitFree(&prog->jit->code);
+#endif
+    free(prog->jit);
+    free(prog->code);
+    free(prog->consts);
+    memset(prog, 0, sizeof(*prog));
+}
+
+/* execProgram
+ * ...Interpret a compiled program on a preallocated value stack
+ * ...Parameters:
+ * ......const CalcProgram* prog -- program to run
+ * ......const double* bindings -- variable values
+ * ......double* stack -- room for prog->max_stack values followed by
+ * ...... prog->num_slots shared slots
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_DIVIDE_BY_ZERO otherwise
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ */
+static CalcStatus execProgram(const CalcProgram* prog, const double* bindings,
+                              double* stack, double* result)
+{
+    const Instr* ip = prog->code;
+    const Instr* end = prog->code + prog->num_code;
+    double* top = stack - 1;
+    double* slots = stack + prog->max_stack;
+
+    for (; ip < end; ip++)
+    {
+        switch (ip->code)
+        {
+            case INSTR_CONST:
+                *++top = prog->consts[ip->arg];
+                break;
+
+            case INSTR_VAR:
+                *++top = bindings[ip->arg];
+                break;
+
+            case INSTR_ADD:
+                top--;
+                top[0] = top[0] + top[1];
+                break;
+
+            case INSTR_SUB:
+                top--;
+                top[0] = top[0] - top[1];
+                break;
+
+            case INSTR_MUL:
+                top--;
+                top[0] = top[0] * top[1];
+                break;
+
+            case INSTR_MIN:
+                top--;
+                top[0] = top[0] < top[1] ? top[0] : top[1];
+                break;
+
+            case INSTR_MAX:
+                top--;
+                top[0] = top[0] > top[1] ? top[0] : top[1];
+                break;
+
+            case INSTR_NEG:
+                top[0] = -top[0];
+                break;
+
+            case INSTR_STORE:
+                slots[ip->arg] = top[0];
+                break;
+
+            case INSTR_LOAD:
+                *++top = slots[ip->arg];
+                break;
+
+            case INSTR_DIV:
+                top--;
+                if (fabs(top[1]) < DBL_EPSILON)
+                {
+                    *result = 0.0;
+                    return CALC_DIVIDE_BY_ZERO;
+                }
+                top[0] = top[0] / top[1];
+                break;
+
+            default: // calls into libm, kept out of line
+                if (!execLibm(ip->code, &top))
+                {
+                    *result = 0.0;
+                    return CALC_DIVIDE_BY_ZERO;
+                }
+        }
+    }
+
+    *result = stack[0];
+
+    return CALC_OK;
+}
+
+/* hotCode
+ * ...Count runs of a program and translate it to native code once there
+ * ...have been JIT_THRESHOLD of them. One thread translates while any
+ * ...others keep interpreting
+ * ...Parameters:
+ * ......const CalcProgram* prog -- program about to run
+ * ......size_t runs -- number of times it is about to run
+ * ...Returns:
+ * ......the native function, NULL if the program is to be interpreted
+ */
+static JitFn hotCode(const CalcProgram* prog, size_t runs)
+{
+#ifdef CALC_JIT
+    struct ProgramJit* jit = prog->jit;
+    int expected = JIT_COLD;
+    int state;
+
+    if (jit == NULL)
+        return NULL;
+
+    state = __atomic_load_n(&jit->state, __ATOMIC_ACQUIRE);
+    if (state == JIT_READY)
+        return jit->code.fn;
+    if (state != JIT_COLD
+        || __atomic_add_fetch(&jit->runs, runs, __ATOMIC_RELAXED)
+           < JIT_THRESHOLD
+        || !__atomic_compare_exchange_n(&jit->state, &expected, JIT_BUSY,
+                                        false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        return NULL;
+
+    state = jitCompile(prog, &jit->code) ? JIT_READY : JIT_FAILED;
+    __atomic_store_n(&jit->state, state, __ATOMIC_RELEASE);
+
+    return jit->code.fn;
+#else
+    (void)prog;
+    (void)runs;
+    return NULL;
+#endif
+}
+
+/* appendInstr
+ * ...Add an instruction to a program, doubling its code array as needed
+ * ...Parameters:
+ * ......CalcProgram* prog -- program being compiled
+ * ......size_t* cap -- capacity of prog->code, updated on growth
+ * ......InstrCode code -- instruction to add
+ * ......size_t arg -- constant or variable index for the instruction
+ * ...Returns:
+ * ......false if the code array could not be grown, true otherwise
+ */
+static bool appendInstr(CalcProgram* prog, size_t* cap, InstrCode code,
+                        size_t arg)
+{
+    size_t new_cap = *cap > 0 ? *cap * 2 : 16;
+    Instr* new_code;
+
+    if (prog->num_code == *cap)
+    {
+        new_code = (Instr *)realloc(prog->code, sizeof(Instr) * new_cap);
+        if (new_code == NULL)
+            return false;
+        prog->code = new_code;
+        *cap = new_cap;
+    }
+
+    prog->code[prog->num_code].code = code;
+    prog->code[prog->num_code].arg = arg;
+    prog->num_code++;
+
+    return true;
+}
+
+/* appendConst
+ * ...Add a constant to a program, doubling its constant pool as needed
+ * ...Parameters:
+ * ......CalcProgram* prog -- program being compiled
+ * ......size_t* cap -- capacity of prog->consts, updated on growth
+ * ......double value -- constant to add
+ * ...Returns:
+ * ......false if the constant pool could not be grown, true otherwise
+ */
+static bool appendConst(CalcProgram* prog, size_t* cap, double value)
+{
+    size_t new_cap = *cap > 0 ? *cap * 2 : 16;
+    double* new_consts;
+
+    if (prog->num_consts == *cap)
+    {
+        new_consts = (double *)realloc(prog->consts,
+                                       sizeof(double) * new_cap);
+        if (new_consts == NULL)
+            return false;
+        prog->consts = new_consts;
+        *cap = new_cap;
+    }
+
+    prog->consts[prog->num_consts++] = value;
+
+    return true;
+}
+
+/* execLibm
+ * ...Run one of the instructions that call into the math library. They
+ * ...live outside execProgram so that its loop keeps its values in
+ * ...registers for the common instructions
+ * ...Parameters:
+ * ......InstrCode code -- INSTR_MOD, INSTR_POW, INSTR_SQRT or INSTR_LOG
+ * ......double** top -- top of the value stack, updated
+ * ...Returns:
+ * ......false if the instruction divided by zero, true otherwise
+ */
+static bool execLibm(InstrCode code, double** top)
+{
+    double* p = *top;
+
+    switch (code)
+    {
+        case INSTR_MOD:
+            p--;
+            if (fabs(p[1]) < DBL_EPSILON)
+                return false;
+            p[0] = fmod(p[0], p[1]);
+            break;
+
+        case INSTR_POW:
+            p--;
+            p[0] = pow(p[0], p[1]);
+            break;
+
+        case INSTR_SQRT:
+            p[0] = sqrt(p[0]);
+            break;
+
+        case INSTR_LOG:
+            p[0] = log(p[0]);
+            break;
+
+        default:
+            break;
+    }
+
+    *top = p;
+
+    return true;
+}
@@ -0,0 +1,512 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Evaluates one formula over every row of a CSV table. The  *
+ * header names the variables, the formula is compiled once, *
+ * and rows are read into columns a chunk at a time and run  *
+ * through runProgramColumns, so no row becomes a string     *
+ *************************************************************/
+
+#include "csv.h"
+#include "calc.h"
+#include "cli.h"
+#include "readline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Rows per evaluator thread gathered into columns before the program
+// runs over them, enough for runProgramColumnsParallel to split
+#define CSV_CHUNK_ROWS (64 * 1024)
+
+// Input read at a time; grown for a longer line
+#define CSV_READ_SIZE (1024 * 1024)
+
+// Output buffered before it is written
+#define CSV_OUT_SIZE (1 << 16)
+
+typedef struct
+{
+    FILE* in;
+    char* data;
+    size_t cap;
+    size_t len; // characters in data
+    size_t pos; // start of the next line
+    bool at_eof;
+} CsvReader;
+
+typedef struct
+{
+    CalcProgram prog;
+    int num_cols;
+    char** names;            // header fields, in column order
+    bool* used;              // columns the formula reads
+    double** columns;        // one per column, unused ones share zeros
+    double* values;          // storage of the used columns
+    double* zeros;
+    double* results;
+    unsigned char* div_zero;
+    int* bad_column;         // per row, the column that is not a number,
+                             // num_cols for a field past the last one,
+                             // -1 if there is none
+    size_t num_rows;         // rows gathered in the current chunk
+    size_t chunk_rows;       // rows a chunk holds
+    CalcContext** ctxs;      // one per evaluator thread
+    int num_ctx;
+} CsvTable;
+
+static bool nextLine(CsvReader*, const char**, size_t*);
+static bool nextField(const char**, const char*, const char**, size_t*);
+static bool readHeader(CsvTable*, const char*, size_t);
+static void addRow(CsvTable*, const char*, size_t);
+static bool flushRows(CsvTable*, const CliOptions*);
+static void* allocOrExit(size_t);
+
+/* runCsv
+ * ...Evaluate a formula over every row of a CSV table, writing one
+ * ...result line per row. The first line names the columns, which are
+ * ...the formula's variables. Fields may be quoted but not split over
+ * ...lines, and blank lines are skipped. Each chunk of rows is evaluated
+ * ...on opts->num_threads threads when it is large enough
+ * ...Parameters:
+ * ......FILE* in -- the table
+ * ......const char* formula -- expression over the column names
+ * ......CalcContext* ctx -- evaluator context of the first thread
+ * ......const CliOptions* opts -- command line options
+ * ...Returns:
+ * ......EXIT_SUCCESS if every row evaluated, EXIT_FAILURE otherwise
+ */
+int runCsv(FILE* in, const char* formula, CalcContext* ctx,
+           const CliOptions* opts)
+{
+    static char out_buf[CSV_OUT_SIZE];
+    CsvReader reader = {in, NULL, CSV_READ_SIZE, 0, 0, false};
+    CsvTable table;
+    CalcStatus status;
+    const char* line;
+    size_t len;
+    size_t num_used = 0;
+    bool all_ok = true;
+
+    memset(&table, 0, sizeof(table));
+    reader.data = (char *)allocOrExit(reader.cap);
+
+    if (!nextLine(&reader, &line, &len))
+    {   // empty input, reported as an empty header
+        line = "";
+        len = 0;
+    }
+    if (!readHeader(&table, line, len))
+    {
+        for (int c = 0; c < table.num_cols; c++)
+            free(table.names[c]);
+        free(table.names);
+        free(reader.data);
+        return EXIT_FAILURE;
+    }
+
+    status = compileExpression(ctx, formula, strlen(formula),
+                               (const char* const*)table.names,
+                               table.num_cols, &table.prog);
+    if (status != CALC_OK)
+    {
+        fprintf(stderr, "Invalid formula: %s", statusMessage(status));
+        if (ctx->error_token != NULL)
+            fprintf(stderr, ": %.*s", (int)ctx->error_len, ctx->error_token);
+        fputc('\n', stderr);
+        all_ok = false;
+    }
+    else
+    {
+        table.num_ctx = opts->num_threads;
+        table.ctxs = (CalcContext **)allocOrExit(sizeof(CalcContext*)
+                                                 * table.num_ctx);
+        table.ctxs[0] = ctx;
+        for (int i = 1; i < table.num_ctx; i++)
+        {
+            table.ctxs[i] = (CalcContext *)allocOrExit(sizeof(CalcContext));
+            initContext(table.ctxs[i]);
+        }
+        table.chunk_rows = (size_t)CSV_CHUNK_ROWS * table.num_ctx;
+
+        table.used = (bool *)allocOrExit(sizeof(bool) * table.num_cols);
+        memset(table.used, 0, sizeof(bool) * table.num_cols);
+        for (size_t i = 0; i < table.prog.num_code; i++)
+        {
+            if (table.prog.code[i].code == INSTR_VAR)
+                table.used[table.prog.code[i].arg] = true;
+        }
+
+        for (int c = 0; c < table.num_cols; c++)
+            num_used += table.used[c];
+        table.values = (double *)allocOrExit(sizeof(double) * table.chunk_rows
+                                             * (num_used > 0 ? num_used : 1));
+        table.zeros = (double *)allocOrExit(sizeof(double) * table.chunk_rows);
+        memset(table.zeros, 0, sizeof(double) * table.chunk_rows);
+        table.columns = (double **)allocOrExit(sizeof(double*)
+                                               * table.num_cols);
+        num_used = 0;
+        for (int c = 0; c < table.num_cols; c++)
+            table.columns[c] = table.used[c]
+                               ? table.values + table.chunk_rows * num_used++
+                               : table.zeros;
+        table.results = (double *)allocOrExit(sizeof(double)
+                                              * table.chunk_rows);
+        table.div_zero = (unsigned char *)allocOrExit(table.chunk_rows);
+        table.bad_column = (int *)allocOrExit(sizeof(int)
+                                              * table.chunk_rows);
+
+        setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+        while (nextLine(&reader, &line, &len))
+        {
+            if (len > 0 && line[len - 1] == '\r')
+                len--;
+            if (len == 0)
+                continue;
+
+            addRow(&table, line, len);
+            if (table.num_rows == table.chunk_rows)
+                all_ok = flushRows(&table, opts) && all_ok;
+        }
+        all_ok = flushRows(&table, opts) && all_ok;
+        fflush(stdout);
+
+        for (int i = 1; i < table.num_ctx; i++)
+        {
+            mergeStats(&ctx->stats, &table.ctxs[i]->stats);
+            freeContext(table.ctxs[i]);
+            free(table.ctxs[i]);
+        }
+        free(table.ctxs);
+        freeProgram(&table.prog);
+    }
+
+    for (int c = 0; c < table.num_cols; c++)
+        free(table.names[c]);
+    free(table.names);
+    free(table.used);
+    free(table.columns);
+    free(table.values);
+    free(table.zeros);
+    free(table.results);
+    free(table.div_zero);
+    free(table.bad_column);
+    free(reader.data);
+
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* nextLine
+ * ...Find the next line of the input, reading more as needed
+ * ...Parameters:
+ * ......CsvReader* reader -- the input
+ * ......const char** line -- set to the first character of the line,
+ * ...... valid until the next call
+ * ......size_t* len -- set to its length, without the \n
+ * ...Returns:
+ * ......false at the end of the input, true otherwise
+ */
+static bool nextLine(CsvReader* reader, const char** line, size_t* len)
+{
+    char* newline;
+    char* new_data;
+    size_t num_read;
+
+    while (true)
+    {
+        newline = (char *)memchr(reader->data + reader->pos, '\n',
+                                 reader->len - reader->pos);
+        if (newline != NULL)
+        {
+            *line = reader->data + reader->pos;
+            *len = (size_t)(newline - *line);
+            reader->pos += *len + 1;
+            return true;
+        }
+
+        if (reader->at_eof)
+        {   // an unterminated last line
+            *line = reader->data + reader->pos;
+            *len = reader->len - reader->pos;
+            reader->pos = reader->len;
+            return *len > 0;
+        }
+
+        memmove(reader->data, reader->data + reader->pos,
+                reader->len - reader->pos);
+        reader->len -= reader->pos;
+        reader->pos = 0;
+
+        if (reader->len == reader->cap)
+        {   // a single line fills the buffer
+            new_data = (char *)realloc(reader->data, reader->cap * 2);
+            if (new_data == NULL)
+            {
+                printAllocError();
+                exit(EXIT_FAILURE);
+            }
+            reader->data = new_data;
+            reader->cap *= 2;
+        }
+
+        num_read = fread(reader->data + reader->len, 1,
+                         reader->cap - reader->len, reader->in);
+        reader->len += num_read;
+        if (num_read == 0)
+        {
+            if (ferror(reader->in))
+            {
+                fprintf(stderr, "Error reading input!\n");
+                exit(EXIT_FAILURE);
+            }
+            reader->at_eof = true;
+        }
+    }
+}
+
+/* nextField
+ * ...Split the next field off a line. A field in double quotes runs to
+ * ...the closing quote, and may hold commas and doubled quotes
+ * ...Parameters:
+ * ......const char** cursor -- position in the line, advanced past the
+ * ...... field and its comma
+ * ......const char* end -- one past the last character of the line
+ * ......const char** field -- set to the first character of the field,
+ * ...... inside its quotes
+ * ......size_t* field_len -- set to its length
+ * ...Returns:
+ * ......false if the line has no more fields, true otherwise
+ */
+static bool nextField(const char** cursor, const char* end,
+                      const char** field, size_t* field_len)
+{
+    const char* p = *cursor;
+
+    if (p == NULL)
+        return false;
+
+    while (p < end && *p == ' ')
+        p++;
+
+    if (p < end && *p == '"')
+    {
+        *field = ++p;
+        while (p < end && (*p != '"' || (p + 1 < end && p[1] == '"')))
+            p += *p == '"' ? 2 : 1;
+        *field_len = (size_t)(p - *field);
+        while (p < end && *p != ',')
+            p++;
+    }
+    else
+    {
+        *field = p;
+        while (p < end && *p != ',')
+            p++;
+        *field_len = (size_t)(p - *field);
+    }
+
+    // After the last field the cursor is NULL, so a line ending in a
+    // comma still has an empty last field
+    *cursor = p < end ? p + 1 : NULL;
+
+    return true;
+}
+
+/* readHeader
+ * ...Take the column names from the header line, after any byte order
+ * ...mark. A name given twice would leave the formula reading only the
+ * ...first such column, so it is rejected
+ * ...Parameters:
+ * ......CsvTable* table -- receives the names
+ * ......const char* line -- the header line
+ * ......size_t len -- its length, without the \n
+ * ...Returns:
+ * ......false, with the reason printed, if the line names no columns or
+ * ...... names one twice, true otherwise
+ */
+static bool readHeader(CsvTable* table, const char* line, size_t len)
+{
+    const char* cursor;
+    const char* end;
+    const char* field;
+    size_t field_len;
+    int cap = 0;
+
+    if (len > 0 && line[len - 1] == '\r')
+        len--;
+    if (len >= 3 && memcmp(line, "\xEF\xBB\xBF", 3) == 0)
+    {   // the UTF-8 byte order mark spreadsheets save tables with
+        line += 3;
+        len -= 3;
+    }
+    cursor = line;
+    end = line + len;
+    if (len == 0)
+    {
+        fprintf(stderr, "Missing CSV header\n");
+        return false;
+    }
+
+    while (nextField(&cursor, end, &field, &field_len))
+    {
+        while (field_len > 0 && isspace((unsigned char)field[field_len - 1]))
+            field_len--;
+
+        if (table->num_cols == cap)
+        {
+            cap = cap > 0 ? cap * 2 : 16;
+            table->names = (char **)realloc(table->names,
+                                            sizeof(char*) * cap);
+            if (table->names == NULL)
+            {
+                printAllocError();
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        table->names[table->num_cols] = (char *)allocOrExit(field_len + 1);
+        memcpy(table->names[table->num_cols], field, field_len);
+        table->names[table->num_cols][field_len] = '\0';
+
+        for (int c = 0; c < table->num_cols; c++)
+        {
+            if (strcmp(table->names[c], table->names[table->num_cols]) == 0)
+            {
+                fprintf(stderr, "Duplicate CSV column: %s\n",
+                        table->names[c]);
+                free(table->names[table->num_cols]);
+                return false;
+            }
+        }
+        table->num_cols++;
+    }
+
+    return true;
+}
+
+/* addRow
+ * ...Convert the fields of one row that the formula reads into the
+ * ...chunk's columns. A field that is not a number, or is missing, marks
+ * ...the row bad and reads as 0. A field past the last column marks the
+ * ...row bad as well, with bad_column set to num_cols
+ * ...Parameters:
+ * ......CsvTable* table -- table being read
+ * ......const char* line -- the row
+ * ......size_t len -- its length, without line terminators
+ * ...Returns:
+ * ......Nothing
+ */
+static void addRow(CsvTable* table, const char* line, size_t len)
+{
+    size_t row = table->num_rows++;
+    const char* cursor = line;
+    const char* field;
+    size_t field_len;
+    double value;
+    int c = 0;
+
+    table->bad_column[row] = -1;
+
+    for (; c < table->num_cols
+           && nextField(&cursor, line + len, &field, &field_len); c++)
+    {
+        if (!table->used[c])
+            continue;
+
+        if (!parseValue(field, field_len, &value)
+            && table->bad_column[row] < 0)
+            table->bad_column[row] = c;
+        table->columns[c][row] = value;
+    }
+
+    for (; c < table->num_cols; c++)
+    {
+        if (!table->used[c])
+            continue;
+
+        if (table->bad_column[row] < 0)
+            table->bad_column[row] = c;
+        table->columns[c][row] = 0.0;
+    }
+
+    if (table->bad_column[row] < 0
+        && nextField(&cursor, line + len, &field, &field_len))
+        table->bad_column[row] = table->num_cols;
+}
+
+/* flushRows
+ * ...Run the formula over the rows gathered so far and write their
+ * ...results in order, then start a new chunk
+ * ...Parameters:
+ * ......CsvTable* table -- table being read
+ * ......const CliOptions* opts -- command line options
+ * ...Returns:
+ * ......true if every row evaluated, false otherwise
+ */
+static bool flushRows(CsvTable* table, const CliOptions* opts)
+{
+    char result_str[RESULT_STR_SIZE + 1];
+    size_t len;
+    bool all_ok = true;
+
+    if (table->num_rows == 0)
+        return true;
+
+    runProgramColumnsParallel(table->ctxs, table->num_ctx, &table->prog,
+                              (const double* const*)table->columns,
+                              table->num_rows, table->results,
+                              table->div_zero);
+
+    for (size_t row = 0; row < table->num_rows; row++)
+    {
+        if (table->bad_column[row] >= 0)
+        {
+            fputs(statusMessage(CALC_INVALID_OPERAND), stdout);
+            fputs(": ", stdout);
+            fputs(table->bad_column[row] < table->num_cols
+                  ? table->names[table->bad_column[row]] : "extra field",
+                  stdout);
+            putchar('\n');
+            all_ok = false;
+        }
+        else if (table->div_zero[row])
+        {
+            puts(statusMessage(CALC_DIVIDE_BY_ZERO));
+            all_ok = false;
+        }
+        else
+        {
+            len = formatValue(opts, table->results[row], result_str);
+            result_str[len++] = '\n';
+            fwrite(result_str, 1, len, stdout);
+        }
+    }
+
+    table->num_rows = 0;
+
+    return all_ok;
+}
+
+/* allocOrExit
+ * ...Allocate memory, exiting the program if there is none
+ * ...Parameters:
+ * ......size_t size -- bytes to allocate
+ * ...Returns:
+ * ......the memory
+ */
+static void* allocOrExit(size_t size)
+{
+    void* ptr = malloc(size);
+
+    if (ptr == NULL)
+    {
+        printAllocError();
+        exit(EXIT_FAILURE);
+    }
+
+    return ptr;
+}
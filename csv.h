@@ -0,0 +1,19 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Evaluates one formula over every row of a CSV table       *
+ *************************************************************/
+
+#ifndef CSV_H
+#define CSV_H
+
+#include "calc.h"
+#include "cli.h"
+
+#include <stdio.h>
+
+int runCsv(FILE* in, const char* formula, CalcContext* ctx,
+           const CliOptions* opts);
+
+#endif // CSV_H
@@ -0,0 +1,152 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Records of failed evaluations, gathered in a sink so the  *
+ * caller decides later whether and how to show them         *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Records a sink makes room for when it first needs any
+#define ERROR_SINK_MIN_RECORDS 64
+
+/* initErrorSink
+ * ...Set up an empty error sink
+ * ...Parameters:
+ * ......CalcErrorSink* sink -- sink to initialize
+ * ...Returns:
+ * ......Nothing
+ */
+void initErrorSink(CalcErrorSink* sink)
+{
+    sink->records = NULL;
+    sink->num_records = 0;
+    sink->capacity = 0;
+    sink->num_evaluated = 0;
+    sink->num_dropped = 0;
+}
+
+/* clearErrorSink
+ * ...Discard every record and restart the count of evaluations, keeping
+ * ...the storage for the next batch
+ * ...Parameters:
+ * ......CalcErrorSink* sink -- sink to clear
+ * ...Returns:
+ * ......Nothing
+ */
+void clearErrorSink(CalcErrorSink* sink)
+{
+    sink->num_records = 0;
+    sink->num_evaluated = 0;
+    sink->num_dropped = 0;
+}
+
+/* freeErrorSink
+ * ...Release the storage held by a sink and reset it to empty
+ * ...Parameters:
+ * ......CalcErrorSink* sink -- sink to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeErrorSink(CalcErrorSink* sink)
+{
+    free(sink->records);
+    initErrorSink(sink);
+}
+
+/* recordError
+ * ...Count one evaluation in a sink and, if it failed, append its record.
+ * ...The token is located from ctx->error_token when that points into
+ * ...the expression
+ * ...Parameters:
+ * ......CalcErrorSink* sink -- sink attached to ctx
+ * ......const CalcContext* ctx -- context that evaluated the expression
+ * ......CalcStatus status -- outcome of the evaluation
+ * ......const char* exp -- characters of the expression
+ * ......size_t len -- number of characters in exp
+ * ...Returns:
+ * ......Nothing
+ */
+void recordError(CalcErrorSink* sink, const CalcContext* ctx,
+                 CalcStatus status, const char* exp, size_t len)
+{
+    CalcError* record;
+    CalcError* new_records;
+    size_t new_capacity;
+
+    sink->num_evaluated++;
+    if (status == CALC_OK)
+        return;
+
+    if (sink->num_records == sink->capacity)
+    {
+        new_capacity = sink->capacity > 0 ? sink->capacity * 2
+                                          : ERROR_SINK_MIN_RECORDS;
+        new_records = (CalcError *)realloc(sink->records,
+                                           sizeof(CalcError) * new_capacity);
+        if (new_records == NULL)
+        {
+            sink->num_dropped++;
+            return;
+        }
+        sink->records = new_records;
+        sink->capacity = new_capacity;
+    }
+
+    record = &sink->records[sink->num_records++];
+    record->status = status;
+    record->expression = sink->num_evaluated - 1;
+    record->offset = 0;
+    record->len = 0;
+
+    if (ctx->error_token != NULL && ctx->error_token >= exp
+        && ctx->error_token < exp + len)
+    {
+        record->offset = (size_t)(ctx->error_token - exp);
+        record->len = ctx->error_len;
+    }
+}
+
+/* formatCalcError
+ * ...Write the message for a failure record: the status message, then
+ * ...the offending token if the record has one, as in
+ * ..."Invalid operand: 2x". Output that does not fit is cut short
+ * ...Parameters:
+ * ......const CalcError* error -- record to describe
+ * ......const char* exp -- the expression the record is about
+ * ......char* buf -- destination, NUL-terminated
+ * ......size_t size -- number of characters available in buf, at least 1
+ * ...Returns:
+ * ......the number of characters written, not counting the \0 char
+ */
+size_t formatCalcError(const CalcError* error, const char* exp, char* buf,
+                       size_t size)
+{
+    const char* message = statusMessage(error->status);
+    size_t msg_len = strlen(message);
+    size_t out_len = 0;
+
+    if (msg_len > size - 1)
+        msg_len = size - 1;
+    memcpy(buf, message, msg_len);
+    out_len = msg_len;
+
+    if (error->len > 0 && out_len + 2 < size)
+    {
+        memcpy(buf + out_len, ": ", 2);
+        out_len += 2;
+        msg_len = error->len < size - 1 - out_len ? error->len
+                                                  : size - 1 - out_len;
+        memcpy(buf + out_len, exp + error->offset, msg_len);
+        out_len += msg_len;
+    }
+
+    buf[out_len] = '\0';
+
+    return out_len;
+}
@@ -0,0 +1,620 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Result formatting. The default is the shortest decimal    *
+ * string that reads back as the same double, produced with  *
+ * the Grisu3 algorithm straight into the caller's buffer,   *
+ * or by an exact search for the few values it cannot settle *
+ *************************************************************/
+
+#include "calc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Exponents that print in fixed notation, as in ECMAScript's
+// Number-to-String: 1e-7 and 1e21 switch to exponent notation
+#define MIN_FIXED_EXP -6
+#define MAX_FIXED_EXP 21
+
+// Do-it-yourself floating point value, f * 2^e
+typedef struct
+{
+    uint64_t f;
+    int e;
+} DiyFp;
+
+// Normalized 64-bit approximations of 10^-348, 10^-340, ..., 10^340
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76,
+    0xcf42894a5dce35ea, 0x9a6bb0aa55653b2d, 0xe61acf033d1a45df,
+    0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f, 0xbe5691ef416bd60c,
+    0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+    0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57,
+    0xc21094364dfb5637, 0x9096ea6f3848984f, 0xd77485cb25823ac7,
+    0xa086cfcd97bf97f4, 0xef340a98172aace5, 0xb23867fb2a35b28e,
+    0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+    0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126,
+    0xb5b5ada8aaff80b8, 0x87625f056c7c4a8b, 0xc9bcff6034c13053,
+    0x964e858c91ba2655, 0xdff9772470297ebd, 0xa6dfbd9fb8e5b88f,
+    0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+    0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06,
+    0xaa242499697392d3, 0xfd87b5f28300ca0e, 0xbce5086492111aeb,
+    0x8cbccc096f5088cc, 0xd1b71758e219652c, 0x9c40000000000000,
+    0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+    0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068,
+    0x9f4f2726179a2245, 0xed63a231d4c4fb27, 0xb0de65388cc8ada8,
+    0x83c7088e1aab65db, 0xc45d1df942711d9a, 0x924d692ca61be758,
+    0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+    0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d,
+    0x952ab45cfa97a0b3, 0xde469fbd99a05fe3, 0xa59bc234db398c25,
+    0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece, 0x88fcf317f22241e2,
+    0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+    0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410,
+    0x8bab8eefb6409c1a, 0xd01fef10a657842c, 0x9b10a4e5e9913129,
+    0xe7109bfba19c0c9d, 0xac2820d9623bf429, 0x80444b5e7aa7cf85,
+    0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+    0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b
+};
+
+static const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t powers_of_ten[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000, 10000000000, 100000000000, 1000000000000,
+    10000000000000, 100000000000000, 1000000000000000,
+    10000000000000000, 100000000000000000, 1000000000000000000,
+    10000000000000000000u
+};
+
+static int formatSpecial(double, char*);
+static bool grisu3(double, char*, int*, int*);
+static bool digitGen(DiyFp, DiyFp, DiyFp, char*, int*, int*);
+static bool roundWeed(char*, int, uint64_t, uint64_t, uint64_t, uint64_t,
+                      uint64_t);
+static void exactDigits(double, char*, int*, int*);
+static bool readsBack(double, const char*, int, int);
+static DiyFp diyMultiply(DiyFp, DiyFp);
+static DiyFp diyNormalize(DiyFp);
+static DiyFp cachedPower(int, int*);
+static int countDigits(uint32_t);
+static int writeExponent(int, char*);
+
+/* formatResult
+ * ...Format val as the shortest decimal string that reads back as the
+ * ...same double. Values from 1e-7 up to 1e21 use fixed notation, with
+ * ...no decimal char for integers; others use exponent notation (1e+21)
+ * ...Parameters:
+ * ......double val -- value to format
+ * ......char* buf -- destination, at least RESULT_STR_SIZE chars
+ * ......size_t size -- size of buf
+ * ...Returns:
+ * ......the number of characters written, not counting the \0 char
+ */
+size_t formatResult(double val, char* buf, size_t size)
+{
+    char digits[18];
+    char* p = buf;
+    int num_digits;
+    int exp10;
+    int point; // position of the decimal point relative to digits
+
+    (void)size; // RESULT_STR_SIZE covers the longest output
+
+    if (!isfinite(val) || val == 0.0)
+        return formatSpecial(val, buf);
+
+    if (val < 0.0)
+    {
+        *p++ = '-';
+        val = -val;
+    }
+
+    if (!grisu3(val, digits, &num_digits, &exp10))
+        exactDigits(val, digits, &num_digits, &exp10);
+    point = num_digits + exp10;
+
+    if (point > 0 && point <= MAX_FIXED_EXP)
+    {
+        if (exp10 >= 0)
+        {   // integer: digits then trailing zeros
+            memcpy(p, digits, num_digits);
+            p += num_digits;
+            memset(p, '0', exp10);
+            p += exp10;
+        }
+        else
+        {
+            memcpy(p, digits, point);
+            p += point;
+            *p++ = '.';
+            memcpy(p, digits + point, num_digits - point);
+            p += num_digits - point;
+        }
+    }
+    else if (point > MIN_FIXED_EXP && point <= 0)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, digits, num_digits);
+        p += num_digits;
+    }
+    else
+    {
+        *p++ = digits[0];
+        if (num_digits > 1)
+        {
+            *p++ = '.';
+            memcpy(p, digits + 1, num_digits - 1);
+            p += num_digits - 1;
+        }
+        p += writeExponent(point - 1, p);
+    }
+
+    *p = '\0';
+
+    return p - buf;
+}
+
+/* formatResultFixed
+ * ...Format val with a fixed number of decimal places, removing trailing
+ * ...zeros and the decimal char if val is an integer
+ * ...Parameters:
+ * ......double val -- value to format
+ * ......int precision -- decimal places, clamped to 0 through 17
+ * ......char* buf -- destination, at least RESULT_STR_SIZE chars
+ * ......size_t size -- size of buf
+ * ...Returns:
+ * ......the number of characters written, not counting the \0 char
+ */
+size_t formatResultFixed(double val, int precision, char* buf,
+                         size_t size)
+{
+    char* p;
+    int len;
+
+    if (precision < 0)
+        precision = 0;
+    else if (precision > MAX_FIXED_PRECISION)
+        precision = MAX_FIXED_PRECISION;
+
+    len = snprintf(buf, size, "%.*f", precision, val);
+    if (len <= 0)
+        return 0;
+
+    p = buf + len - 1; // pointer to last character in the str
+
+    if (precision > 0 && isfinite(val))
+    {
+        while (*p == '0') // remove trailing zeros
+            *p-- = '\0';
+
+        if (*p == '.' || *p == ',')
+            *p-- = '\0'; // remove decimal if val is an integer
+    }
+
+    return p + 1 - buf;
+}
+
+/* formatSpecial
+ * ...Format zero, infinity or not-a-number
+ * ...Parameters:
+ * ......double val -- value to format
+ * ......char* buf -- destination
+ * ...Returns:
+ * ......the number of characters written, not counting the \0 char
+ */
+static int formatSpecial(double val, char* buf)
+{
+    const char* text;
+
+    if (isnan(val))
+        text = "nan";
+    else if (isinf(val))
+        text = val < 0.0 ? "-inf" : "inf";
+    else
+        text = signbit(val) ? "-0" : "0";
+
+    strcpy(buf, text);
+
+    return (int)strlen(text);
+}
+
+/* writeExponent
+ * ...Write an exponent suffix such as e+21 or e-7
+ * ...Parameters:
+ * ......int exp10 -- decimal exponent
+ * ......char* p -- destination
+ * ...Returns:
+ * ......the number of characters written
+ */
+static int writeExponent(int exp10, char* p)
+{
+    char* start = p;
+
+    *p++ = 'e';
+    *p++ = exp10 < 0 ? '-' : '+';
+    if (exp10 < 0)
+        exp10 = -exp10;
+
+    if (exp10 >= 100)
+        *p++ = (char)('0' + exp10 / 100);
+    if (exp10 >= 10)
+        *p++ = (char)('0' + exp10 / 10 % 10);
+    *p++ = (char)('0' + exp10 % 10);
+
+    return (int)(p - start);
+}
+
+/* grisu3
+ * ...Find the shortest digits that identify a positive finite double,
+ * ...unless the error of the cached power leaves them undecided
+ * ...Parameters:
+ * ......double val -- value to convert
+ * ......char* digits -- receives up to 17 decimal digits, no \0 char
+ * ......int* num_digits -- receives the number of digits
+ * ......int* exp10 -- receives K, where val = digits * 10^K
+ * ...Returns:
+ * ......true if the digits are the shortest and the closest of those to
+ * ...... val, false if the exact search has to find them
+ */
+static bool grisu3(double val, char* digits, int* num_digits, int* exp10)
+{
+    uint64_t bits;
+    uint64_t significand;
+    int biased_exp;
+    DiyFp v;
+    DiyFp plus;
+    DiyFp minus;
+    DiyFp c_mk;
+    DiyFp w;
+    DiyFp w_plus;
+    DiyFp w_minus;
+
+    memcpy(&bits, &val, sizeof(bits));
+    significand = bits & ((UINT64_C(1) << 52) - 1);
+    biased_exp = (int)((bits >> 52) & 0x7FF);
+
+    if (biased_exp != 0)
+    {
+        v.f = significand | (UINT64_C(1) << 52);
+        v.e = biased_exp - 1075;
+    }
+    else
+    {   // subnormal
+        v.f = significand;
+        v.e = -1074;
+    }
+
+    // Boundaries halfway to the neighbouring doubles; the lower gap is
+    // half as wide when the significand is a power of two
+    plus.f = (v.f << 1) + 1;
+    plus.e = v.e - 1;
+    while (!(plus.f & (UINT64_C(1) << 53)))
+    {
+        plus.f <<= 1;
+        plus.e--;
+    }
+    plus.f <<= 10;
+    plus.e -= 10;
+
+    if (v.f == (UINT64_C(1) << 52))
+    {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    }
+    else
+    {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    c_mk = cachedPower(plus.e, exp10);
+
+    w = diyMultiply(diyNormalize(v), c_mk);
+    w_plus = diyMultiply(plus, c_mk);
+    w_minus = diyMultiply(minus, c_mk);
+
+    return digitGen(w, w_minus, w_plus, digits, num_digits, exp10);
+}
+
+/* digitGen
+ * ...Generate digits of the scaled upper boundary until they fall
+ * ...within the scaled rounding interval, then round them towards the
+ * ...scaled value. Each scaled value may be off by one unit, so the
+ * ...digits are generated within the interval widened by that error
+ * ...Parameters:
+ * ......DiyFp w -- scaled value
+ * ......DiyFp low -- scaled lower boundary
+ * ......DiyFp high -- scaled upper boundary
+ * ......char* digits -- receives the digits
+ * ......int* num_digits -- receives the number of digits
+ * ......int* exp10 -- decimal exponent, adjusted by the digits dropped
+ * ...Returns:
+ * ......true if the digits are certain to be the shortest and closest,
+ * ...... false otherwise
+ */
+static bool digitGen(DiyFp w, DiyFp low, DiyFp high, char* digits,
+                     int* num_digits, int* exp10)
+{
+    int shift = -w.e;
+    uint64_t one_f = UINT64_C(1) << shift;
+    uint64_t unit = 1; // error of each scaled value
+    uint64_t too_high = high.f + unit;
+    uint64_t unsafe = too_high - (low.f - unit); // widened interval
+    uint32_t p1 = (uint32_t)(too_high >> shift);
+    uint64_t p2 = too_high & (one_f - 1);
+    int kappa = countDigits(p1);
+    uint32_t d;
+    uint64_t rest;
+
+    *num_digits = 0;
+
+    while (kappa > 0)
+    {
+        d = p1 / (uint32_t)powers_of_ten[kappa - 1];
+        p1 %= (uint32_t)powers_of_ten[kappa - 1];
+
+        if (d != 0 || *num_digits != 0)
+            digits[(*num_digits)++] = (char)('0' + d);
+        kappa--;
+
+        rest = ((uint64_t)p1 << shift) + p2;
+        if (rest < unsafe)
+        {
+            *exp10 += kappa;
+            return roundWeed(digits, *num_digits, too_high - w.f, unsafe,
+                             rest, powers_of_ten[kappa] << shift, unit);
+        }
+    }
+
+    while (true)
+    {
+        p2 *= 10;
+        unit *= 10;
+        unsafe *= 10;
+        d = (uint32_t)(p2 >> shift);
+
+        if (d != 0 || *num_digits != 0)
+            digits[(*num_digits)++] = (char)('0' + d);
+        p2 &= one_f - 1;
+        kappa--;
+
+        if (p2 < unsafe)
+        {
+            *exp10 += kappa;
+            return roundWeed(digits, *num_digits, (too_high - w.f) * unit,
+                             unsafe, p2, one_f, unit);
+        }
+    }
+}
+
+/* roundWeed
+ * ...Move the last digit down while that brings the digits closer to
+ * ...the scaled value without leaving the rounding interval, then check
+ * ...that the error of the scaling cannot change the outcome
+ * ...Parameters:
+ * ......char* digits -- generated digits
+ * ......int len -- number of digits
+ * ......uint64_t too_high_w -- distance of the value below the widened
+ * ...... upper boundary
+ * ......uint64_t unsafe -- width of the widened rounding interval
+ * ......uint64_t rest -- distance of the digits below the widened upper
+ * ...... boundary
+ * ......uint64_t ten_kappa -- weight of the last digit
+ * ......uint64_t unit -- error of each scaled value
+ * ...Returns:
+ * ......true if the digits are certain to be the closest to the value
+ * ...... and within its rounding interval, false otherwise
+ */
+static bool roundWeed(char* digits, int len, uint64_t too_high_w,
+                      uint64_t unsafe, uint64_t rest, uint64_t ten_kappa,
+                      uint64_t unit)
+{
+    uint64_t small_distance = too_high_w - unit; // value at its highest
+    uint64_t big_distance = too_high_w + unit;   // value at its lowest
+
+    while (rest < small_distance && unsafe - rest >= ten_kappa
+           && (rest + ten_kappa < small_distance
+               || small_distance - rest >= rest + ten_kappa - small_distance))
+    {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+
+    // Had the value been at its lowest, one more step down would be
+    // closer, so which digits are closest is undecided
+    if (rest < big_distance && unsafe - rest >= ten_kappa
+        && (rest + ten_kappa < big_distance
+            || big_distance - rest > rest + ten_kappa - big_distance))
+        return false;
+
+    // The digits must also lie inside the interval without its error
+    return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+/* exactDigits
+ * ...Find the shortest digits that identify a positive finite double by
+ * ...trying each length in turn. The C library converts both ways
+ * ...exactly, so this settles the values Grisu3 leaves undecided
+ * ...Parameters:
+ * ......double val -- value to convert
+ * ......char* digits -- receives up to 17 decimal digits, no \0 char
+ * ......int* num_digits -- receives the number of digits
+ * ......int* exp10 -- receives K, where val = digits * 10^K
+ * ...Returns:
+ * ......Nothing
+ */
+static void exactDigits(double val, char* digits, int* num_digits, int* exp10)
+{
+    char text[32];
+    int i;
+
+    for (int len = 1; len <= 17; len++)
+    {
+        // The closest digits of this length, as d.ddde+X
+        snprintf(text, sizeof(text), "%.*e", len - 1, val);
+        digits[0] = text[0];
+        memcpy(digits + 1, text + 2, len - 1);
+        *num_digits = len;
+        *exp10 = atoi(strchr(text, 'e') + 1) - (len - 1);
+
+        if (strtod(text, NULL) == val || len == 17)
+            return;
+
+        // Above a power of two the gap to the next double is twice the
+        // gap below, so when the closest digits are below val and too
+        // far, the next digits up may still be near enough
+        if (strtod(text, NULL) < val)
+        {
+            for (i = len - 1; i >= 0 && digits[i] == '9'; i--)
+                ;
+            if (i < 0)
+            {   // 99..9 rounds up to a power of ten
+                digits[0] = '1';
+                *num_digits = 1;
+                *exp10 += len;
+            }
+            else
+            {   // the zeros the carry leaves behind are dropped
+                digits[i]++;
+                *num_digits = i + 1;
+                *exp10 += len - 1 - i;
+            }
+
+            if (readsBack(val, digits, *num_digits, *exp10))
+                return;
+        }
+    }
+}
+
+/* readsBack
+ * ...Check whether digits * 10^exp10 reads back as a double
+ * ...Parameters:
+ * ......double val -- the double
+ * ......const char* digits -- decimal digits, no \0 char
+ * ......int num_digits -- number of digits
+ * ......int exp10 -- decimal exponent of the last digit
+ * ...Returns:
+ * ......true if the digits read back as val, false otherwise
+ */
+static bool readsBack(double val, const char* digits, int num_digits,
+                      int exp10)
+{
+    char text[32];
+
+    snprintf(text, sizeof(text), "%.*se%d", num_digits, digits, exp10);
+
+    return strtod(text, NULL) == val;
+}
+
+/* diyMultiply
+ * ...Multiply two DiyFp values, keeping the rounded upper 64 bits
+ * ...Parameters:
+ * ......DiyFp x -- first factor
+ * ......DiyFp y -- second factor
+ * ...Returns:
+ * ......the product
+ */
+static DiyFp diyMultiply(DiyFp x, DiyFp y)
+{
+    const uint64_t mask_32 = 0xFFFFFFFF;
+    uint64_t a = x.f >> 32;
+    uint64_t b = x.f & mask_32;
+    uint64_t c = y.f >> 32;
+    uint64_t d = y.f & mask_32;
+    uint64_t ac = a * c;
+    uint64_t bc = b * c;
+    uint64_t ad = a * d;
+    uint64_t bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & mask_32) + (bc & mask_32);
+    DiyFp product;
+
+    tmp += UINT64_C(1) << 31; // round
+    product.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    product.e = x.e + y.e + 64;
+
+    return product;
+}
+
+/* diyNormalize
+ * ...Shift a DiyFp left until its top bit is set
+ * ...Parameters:
+ * ......DiyFp x -- nonzero value to normalize
+ * ...Returns:
+ * ......the normalized value
+ */
+static DiyFp diyNormalize(DiyFp x)
+{
+    while (!(x.f & (UINT64_C(1) << 63)))
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+
+    return x;
+}
+
+/* cachedPower
+ * ...Pick the cached power of ten that scales a DiyFp with binary
+ * ...exponent e into the range digit generation expects
+ * ...Parameters:
+ * ......int e -- binary exponent of the upper boundary
+ * ......int* exp10 -- receives K, the negated decimal exponent of the
+ * ...... power
+ * ...Returns:
+ * ......the cached power
+ */
+static DiyFp cachedPower(int e, int* exp10)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347; // log10(2)
+    int k = (int)dk;
+    int index;
+    DiyFp power;
+
+    if (dk - k > 0.0)
+        k++;
+
+    index = (k >> 3) + 1;
+    *exp10 = -(-348 + index * 8);
+
+    power.f = cached_powers_f[index];
+    power.e = cached_powers_e[index];
+
+    return power;
+}
+
+/* countDigits
+ * ...Count the decimal digits of n
+ * ...Parameters:
+ * ......uint32_t n -- number to measure
+ * ...Returns:
+ * ......the number of decimal digits, 1 for zero
+ */
+static int countDigits(uint32_t n)
+{
+    int count = 1;
+
+    while (count < 10 && n >= powers_of_ten[count])
+        count++;
+
+    return count;
+}
@@ -0,0 +1,775 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Differential fuzz target for the evaluator. Each input is *
+ * evaluated by evalExpression, the reference, and by every  *
+ * other path that must agree with it: the stream evaluator  *
+ * fed in uneven pieces, evalBinary, the result cache, the   *
+ * compiled program in the interpreter and the JIT, the      *
+ * column kernels, evalExpressionParallel, the incremental   *
+ * evaluator and the precise modes. Any disagreement aborts  *
+ * with the input printed.                                   *
+ * Built with -DFUZZ_LIBFUZZER it is a libFuzzer target;     *
+ * otherwise main() runs files, stdin (as AFL does) or       *
+ * generated expressions                                     *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// Runs of a compiled program that make sure the JIT has taken over
+#define FUZZ_JIT_RUNS 1100
+
+// Longest expression main() generates
+#define FUZZ_MAX_GEN 512
+
+// Largest input read from a file or stdin
+#define FUZZ_MAX_INPUT (1 << 20)
+
+// Most contexts evalExpressionParallel is given
+#define FUZZ_MAX_THREADS 4
+
+// Byte of the binary format that is no WireCode
+#define WIRE_UNKNOWN 0xFF
+
+// Code of each symbol lookupOp finds, for encodeWire
+static const unsigned char wire_codes[NUM_OPS] = {
+    [OP_NONE] = WIRE_UNKNOWN,
+    [OP_ADD] = WIRE_ADD,
+    [OP_SUB] = WIRE_SUB,
+    [OP_MUL] = WIRE_MUL,
+    [OP_DIV] = WIRE_DIV,
+    [OP_MOD] = WIRE_MOD,
+    [OP_POW] = WIRE_POW,
+    [OP_MIN] = WIRE_MIN,
+    [OP_MAX] = WIRE_MAX,
+    [OP_NEGATE] = WIRE_UNKNOWN,
+    [OP_SQRT] = WIRE_SQRT,
+    [OP_LOG] = WIRE_LOG,
+    [OP_OPEN] = WIRE_OPEN,
+    [OP_CLOSE] = WIRE_CLOSE,
+    [OP_COMMA] = WIRE_COMMA,
+    [OP_ARGS] = WIRE_UNKNOWN
+};
+
+// Values an incremental update gives a number; positive, so no sign
+// has to be written before them
+static const double update_values[] = {0.0, 1.0, 0.5, 3.0, 1e300,
+                                       2.5e-310, 9007199254740993.0};
+
+static CalcContext ref_ctx;
+static CalcContext alt_ctx;
+static CalcContext par_ctx[FUZZ_MAX_THREADS];
+static ResultCache cache;
+static bool initialized = false;
+static uint64_t rng_state = 0x2545F4914F6CDD1Du;
+
+// The input in the binary format, and where its numbers are in the text
+static unsigned char* wire;
+static size_t wire_len;
+static size_t* number_offsets;
+static size_t* number_lens;
+static size_t num_numbers;
+static size_t wire_room; // characters of input the buffers can encode
+
+// Scratch text for the padded and edited inputs
+static char* text;
+static size_t text_room;
+
+int LLVMFuzzerTestOneInput(const uint8_t*, size_t);
+CalcStatus checkStream(const char*, size_t, CalcStatus, double, double*);
+void checkBinary(const char*, size_t, CalcStatus, double);
+void checkCache(const char*, size_t, CalcStatus, double);
+void checkProgram(const char*, size_t, CalcStatus, double);
+void checkParallel(const char*, size_t);
+void checkIncremental(const char*, size_t, CalcStatus, double);
+void checkPrecise(const char*, size_t, CalcStatus);
+void encodeWire(const char*, size_t);
+char* reserveText(size_t);
+bool isSyntaxError(CalcStatus);
+void expectSame(const char*, const char*, const char*, size_t, CalcStatus,
+                double, CalcStatus, double);
+void runFile(FILE*);
+size_t generateExpression(char*, size_t);
+void appendTerm(char*, size_t*, size_t, int);
+void appendNumber(char*, size_t*, size_t);
+uint64_t nextRandom();
+
+/* LLVMFuzzerTestOneInput
+ * ...Evaluate one input along every path and compare with the reference
+ * ...Parameters:
+ * ......const uint8_t* data -- the input, taken as expression text
+ * ......size_t size -- number of bytes in data
+ * ...Returns:
+ * ......0, having aborted on any disagreement
+ */
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    const char* exp = (const char *)data;
+    CalcStatus status;
+    CalcStatus stream_status;
+    double result;
+    double stream_result;
+
+    if (!initialized)
+    {
+        initContext(&ref_ctx);
+        initContext(&alt_ctx);
+        for (int i = 0; i < FUZZ_MAX_THREADS; i++)
+            initContext(&par_ctx[i]);
+        initCache(&cache, 1 << 20);
+        initialized = true;
+    }
+
+    status = evalExpression(&ref_ctx, exp, size, &result);
+    encodeWire(exp, size);
+
+    stream_status = checkStream(exp, size, status, result, &stream_result);
+    checkBinary(exp, size, stream_status, stream_result);
+    checkCache(exp, size, status, result);
+    checkProgram(exp, size, status, result);
+    checkParallel(exp, size);
+    checkIncremental(exp, size, status, result);
+    checkPrecise(exp, size, status);
+
+    return 0;
+}
+
+/* checkStream
+ * ...Feed an input to the stream evaluator in pieces of 1 to 7 bytes,
+ * ...so tokens are cut at every position
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ......CalcStatus status -- what the reference returned
+ * ......double result -- the reference result
+ * ......double* alt_result -- receives the stream's result
+ * ...Returns:
+ * ......the stream's status
+ */
+CalcStatus checkStream(const char* exp, size_t len, CalcStatus status,
+                       double result, double* alt_result)
+{
+    CalcStream stream;
+    CalcStatus alt_status = CALC_OK;
+    size_t piece;
+
+    beginStream(&alt_ctx, &stream);
+    for (size_t pos = 0; pos < len; pos += piece)
+    {
+        piece = 1 + (pos * 7 + len) % 7;
+        if (piece > len - pos)
+            piece = len - pos;
+        if (alt_status == CALC_OK)
+            alt_status = feedStream(&stream, exp + pos, piece);
+    }
+    alt_status = endStream(&stream, alt_result);
+
+    // With several errors in one input the stream reports the first it
+    // reaches, so only success and failure must agree
+    if ((status == CALC_OK) != (alt_status == CALC_OK))
+        expectSame("stream", "evalExpression", exp, len, status, result,
+                   alt_status, *alt_result);
+    if (status == CALC_OK)
+        expectSame("stream", "evalExpression", exp, len, status, result,
+                   alt_status, *alt_result);
+
+    return alt_status;
+}
+
+/* checkBinary
+ * ...Evaluate the input's binary form with evalBinary, which shares the
+ * ...stream evaluator and must agree with it on status as well
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ......CalcStatus status -- what the stream evaluator returned
+ * ......double result -- the stream evaluator's result
+ * ...Returns:
+ * ......Nothing
+ */
+void checkBinary(const char* exp, size_t len, CalcStatus status,
+                 double result)
+{
+    CalcStatus alt_status;
+    double alt_result;
+
+    alt_status = evalBinary(&alt_ctx, wire, wire_len, &alt_result);
+    expectSame("evalBinary", "the stream", exp, len, status, result,
+               alt_status, alt_result);
+}
+
+/* checkCache
+ * ...Evaluate an input twice with the result cache attached, once to
+ * ...fill it and once to be answered from it
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ......CalcStatus status -- what the reference returned
+ * ......double result -- the reference result
+ * ...Returns:
+ * ......Nothing
+ */
+void checkCache(const char* exp, size_t len, CalcStatus status,
+                double result)
+{
+    CalcStatus alt_status;
+    double alt_result;
+
+    alt_ctx.cache = &cache;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        alt_status = evalExpression(&alt_ctx, exp, len, &alt_result);
+        expectSame(pass == 0 ? "cache miss" : "cache hit",
+                   "evalExpression", exp, len, status, result, alt_status,
+                   alt_result);
+    }
+    alt_ctx.cache = NULL;
+}
+
+/* checkProgram
+ * ...Compile an input without variables, run it in the interpreter and
+ * ...again once the JIT has translated it, and run it over a column
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ......CalcStatus status -- what the reference returned
+ * ......double result -- the reference result
+ * ...Returns:
+ * ......Nothing
+ */
+void checkProgram(const char* exp, size_t len, CalcStatus status,
+                  double result)
+{
+    CalcProgram prog;
+    CalcStatus alt_status;
+    double alt_result;
+    unsigned char div_zero;
+
+    alt_status = compileExpression(&alt_ctx, exp, len, NULL, 0, &prog);
+    if (alt_status != CALC_OK)
+    {   // parse failures are reported as the reference reports them
+        if (status == CALC_OK || status == CALC_DIVIDE_BY_ZERO)
+            expectSame("compile", "evalExpression", exp, len, status,
+                       result, alt_status, 0.0);
+        return;
+    }
+
+    alt_status = runProgram(&alt_ctx, &prog, NULL, &alt_result);
+    expectSame("interpreter", "evalExpression", exp, len, status, result,
+               alt_status, alt_result);
+
+    for (int i = 0; i < FUZZ_JIT_RUNS; i++)
+        alt_status = runProgram(&alt_ctx, &prog, NULL, &alt_result);
+    expectSame("jit", "evalExpression", exp, len, status, result,
+               alt_status, alt_result);
+
+    runProgramColumns(&alt_ctx, &prog, NULL, 1, &alt_result, &div_zero);
+    expectSame("columns", "evalExpression", exp, len, status, result,
+               div_zero ? CALC_DIVIDE_BY_ZERO : CALC_OK, alt_result);
+
+    freeProgram(&prog);
+}
+
+/* checkParallel
+ * ...Repeat an input as the terms of a sum long enough to be split
+ * ...between 2 to 4 threads, and check evalExpressionParallel against
+ * ...evalExpression on the same sum, to the last bit
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ...Returns:
+ * ......Nothing
+ */
+void checkParallel(const char* exp, size_t len)
+{
+    CalcContext* ctxs[FUZZ_MAX_THREADS];
+    CalcStatus status;
+    CalcStatus alt_status;
+    double result;
+    double alt_result;
+    int num_ctx = 2 + (int)(len % (FUZZ_MAX_THREADS - 1));
+    size_t min_len = (size_t)num_ctx * SPLIT_MIN_SIZE;
+    size_t sum_len = 0;
+    char* sum = reserveText(len > min_len ? len : min_len + len + 3);
+
+    if (len == 0)
+        return;
+
+    do
+    {
+        if (sum_len > 0)
+        {
+            memcpy(sum + sum_len, " + ", 3);
+            sum_len += 3;
+        }
+        memcpy(sum + sum_len, exp, len);
+        sum_len += len;
+    } while (sum_len < min_len);
+
+    for (int i = 0; i < num_ctx; i++)
+        ctxs[i] = &par_ctx[i];
+
+    status = evalExpression(&ref_ctx, sum, sum_len, &result);
+    alt_status = evalExpressionParallel(ctxs, num_ctx, sum, sum_len,
+                                        &alt_result);
+    expectSame("evalExpressionParallel", "evalExpression", sum, sum_len,
+               status, result, alt_status, alt_result);
+}
+
+/* checkIncremental
+ * ...Build an incremental expression from an input and compare it with
+ * ...the reference, then change one of its numbers and compare the
+ * ...update with evaluating the edited text afresh. The top-level sum
+ * ...is added pairwise, so its bits are compared only for up to two
+ * ...terms, where the order is the same; a fresh incremental build of
+ * ...the edited text must match the update to the last bit
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ......CalcStatus status -- what the reference returned
+ * ......double result -- the reference result
+ * ...Returns:
+ * ......Nothing
+ */
+void checkIncremental(const char* exp, size_t len, CalcStatus status,
+                      double result)
+{
+    CalcIncremental inc;
+    CalcIncremental fresh;
+    CalcStatus alt_status;
+    double alt_result;
+    double value;
+    size_t index;
+    size_t offset;
+    size_t edit_len;
+    char* edit;
+    char num[32];
+    int num_len;
+
+    alt_status = buildIncremental(&alt_ctx, exp, len, &inc);
+    if (alt_status != CALC_OK)
+    {   // parse failures are reported as the reference reports them
+        expectSame("buildIncremental", "evalExpression", exp, len, status,
+                   result, alt_status, 0.0);
+        return;
+    }
+
+    alt_status = incrementalResult(&inc, &alt_result);
+    if (alt_status != status || inc.num_terms <= 2)
+        expectSame("incrementalResult", "evalExpression", exp, len, status,
+                   result, alt_status, alt_result);
+
+    if (inc.num_operands != num_numbers)
+    {
+        fprintf(stderr, "buildIncremental found %zu numbers in \"%.*s\", "
+                "the tokenizer %zu\n", inc.num_operands, (int)len, exp,
+                num_numbers);
+        abort();
+    }
+    if (num_numbers == 0)
+    {
+        freeIncremental(&inc);
+        return;
+    }
+
+    // Write the new value in place of the number, spaced off so that it
+    // stays a token of its own
+    index = len % num_numbers;
+    value = update_values[len % (sizeof(update_values) / sizeof(double))];
+    offset = number_offsets[index];
+    num_len = snprintf(num, sizeof(num), " %.17g ", value);
+    edit_len = len - number_lens[index] + (size_t)num_len;
+    edit = reserveText(edit_len);
+    memcpy(edit, exp, offset);
+    memcpy(edit + offset, num, num_len);
+    memcpy(edit + offset + num_len, exp + offset + number_lens[index],
+           len - offset - number_lens[index]);
+
+    status = evalExpression(&ref_ctx, edit, edit_len, &result);
+    alt_status = updateOperand(&inc, index, value, &alt_result);
+    if (alt_status != status || inc.num_terms <= 2)
+        expectSame("updateOperand", "evalExpression", edit, edit_len,
+                   status, result, alt_status, alt_result);
+
+    status = buildIncremental(&alt_ctx, edit, edit_len, &fresh);
+    if (status == CALC_OK)
+        status = incrementalResult(&fresh, &result);
+    expectSame("updateOperand", "a fresh buildIncremental", edit, edit_len,
+               status, result, alt_status, alt_result);
+
+    freeIncremental(&fresh);
+    freeIncremental(&inc);
+}
+
+/* checkPrecise
+ * ...Evaluate an input in the compensated and exact modes. Their values
+ * ...differ from the reference by design, and only a different kind of
+ * ...failure is wrong: a syntax error in both or in neither
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ......CalcStatus status -- what the reference returned
+ * ...Returns:
+ * ......Nothing
+ */
+void checkPrecise(const char* exp, size_t len, CalcStatus status)
+{
+    static const CalcMode modes[] = {CALC_MODE_COMPENSATED, CALC_MODE_EXACT};
+    static const char* names[] = {"compensated mode", "exact mode"};
+    CalcStatus alt_status;
+    double alt_result;
+
+    for (int m = 0; m < 2; m++)
+    {
+        alt_ctx.mode = modes[m];
+        alt_status = evalExpression(&alt_ctx, exp, len, &alt_result);
+        alt_ctx.mode = CALC_MODE_DOUBLE;
+
+        // A syntax error must fail, though it may report another first
+        if (isSyntaxError(status) ? alt_status == CALC_OK
+                                  : isSyntaxError(alt_status))
+            expectSame(names[m], "evalExpression", exp, len, status, 0.0,
+                       alt_status, alt_result);
+    }
+}
+
+/* encodeWire
+ * ...Convert an input to the binary format token by token, as the
+ * ...stream evaluator splits it, so that evalBinary sees the symbols and
+ * ...values feedStream would. A token that is no symbol becomes a code
+ * ...that is none either. Sets wire, wire_len and the number positions
+ * ...Parameters:
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ...Returns:
+ * ......Nothing
+ */
+void encodeWire(const char* exp, size_t len)
+{
+    const char* cursor = exp;
+    const char* end = exp + len;
+    const char* token;
+    size_t token_len;
+    double value;
+    uint64_t bits;
+    bool parse_operand = true;
+    bool is_number = false;
+    OpCode op;
+
+    // Every token takes at least one character and 9 bytes at most
+    if (len + 1 > wire_room)
+    {
+        wire_room = 2 * len + 1;
+        wire = (unsigned char *)realloc(wire, 9 * wire_room);
+        number_offsets = (size_t *)realloc(number_offsets,
+                                           sizeof(size_t) * wire_room);
+        number_lens = (size_t *)realloc(number_lens,
+                                        sizeof(size_t) * wire_room);
+        if (wire == NULL || number_offsets == NULL || number_lens == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            abort();
+        }
+    }
+
+    wire_len = 0;
+    num_numbers = 0;
+
+    while (parse_operand ? nextOperand(&cursor, end, &token, &token_len,
+                                       &value, &is_number)
+                         : nextToken(&cursor, end, &token, &token_len))
+    {
+        if (parse_operand && is_number)
+        {
+            number_offsets[num_numbers] = (size_t)(token - exp);
+            number_lens[num_numbers++] = token_len;
+
+            memcpy(&bits, &value, sizeof(bits));
+            wire[wire_len++] = WIRE_NUMBER;
+            for (int b = 0; b < 8; b++, bits >>= 8)
+                wire[wire_len++] = (unsigned char)bits;
+            parse_operand = false;
+            continue;
+        }
+
+        // After a failure neither evaluator reads further, so only what
+        // follows valid tokens has to be tracked
+        op = lookupOp(token, token_len);
+        wire[wire_len++] = wire_codes[op];
+        if (!parse_operand)
+            parse_operand = op != OP_CLOSE;
+    }
+}
+
+/* reserveText
+ * ...Make room in the scratch text
+ * ...Parameters:
+ * ......size_t len -- characters needed
+ * ...Returns:
+ * ......the scratch text
+ */
+char* reserveText(size_t len)
+{
+    if (len > text_room)
+    {
+        text_room = 2 * len;
+        text = (char *)realloc(text, text_room);
+        if (text == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            abort();
+        }
+    }
+
+    return text;
+}
+
+/* isSyntaxError
+ * ...Check whether a status means the input is not a valid expression,
+ * ...whatever its values
+ * ...Parameters:
+ * ......CalcStatus status -- status to check
+ * ...Returns:
+ * ......true for a syntax error, false for success or a failure that
+ * ...... depends on the values or the mode
+ */
+bool isSyntaxError(CalcStatus status)
+{
+    return status != CALC_OK && status != CALC_DIVIDE_BY_ZERO
+           && status != CALC_NO_MEMORY && status != CALC_NOT_EXACT
+           && status != CALC_TOO_LARGE;
+}
+
+/* expectSame
+ * ...Abort unless a path returned what the reference did: the same
+ * ...status and a result with the same bits, or NaN for NaN
+ * ...Parameters:
+ * ......const char* path -- name of the path checked
+ * ......const char* ref -- name of the path it is checked against
+ * ......const char* exp -- the input
+ * ......size_t len -- number of characters in exp
+ * ......CalcStatus status -- what the reference returned
+ * ......double result -- the reference result
+ * ......CalcStatus alt_status -- what the path returned
+ * ......double alt_result -- the path's result
+ * ...Returns:
+ * ......Nothing
+ */
+void expectSame(const char* path, const char* ref, const char* exp,
+                size_t len, CalcStatus status, double result,
+                CalcStatus alt_status, double alt_result)
+{
+    if (status == alt_status
+        && (status != CALC_OK
+            || memcmp(&result, &alt_result, sizeof(double)) == 0
+            || (isnan(result) && isnan(alt_result))))
+        return;
+
+    fprintf(stderr, "%s disagrees with %s on \"%.*s\"\n", path, ref,
+            (int)len, exp);
+    fprintf(stderr, "    expected %s, %.17g\n", statusMessage(status),
+            result);
+    fprintf(stderr, "    got      %s, %.17g\n", statusMessage(alt_status),
+            alt_result);
+    abort();
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+/* main
+ * ...Check the files named on the command line, stdin if there are
+ * ...none, or with -n COUNT that many generated expressions
+ */
+int main(int argc, char* argv[])
+{
+    char exp[FUZZ_MAX_GEN + 1];
+    size_t len;
+    long count;
+    FILE* in;
+
+    if (argc == 3 && strcmp(argv[1], "-n") == 0)
+    {
+        count = atol(argv[2]);
+        for (long i = 0; i < count; i++)
+        {
+            len = generateExpression(exp, sizeof(exp));
+            LLVMFuzzerTestOneInput((const uint8_t *)exp, len);
+        }
+        printf("%ld generated expressions agree\n", count);
+        return 0;
+    }
+
+    if (argc == 1)
+        runFile(stdin);
+
+    for (int i = 1; i < argc; i++)
+    {
+        in = fopen(argv[i], "rb");
+        if (in == NULL)
+        {
+            fprintf(stderr, "Cannot read %s\n", argv[i]);
+            return 1;
+        }
+        runFile(in);
+        fclose(in);
+    }
+
+    return 0;
+}
+
+/* runFile
+ * ...Check the whole contents of a file as one input
+ * ...Parameters:
+ * ......FILE* in -- file to read
+ * ...Returns:
+ * ......Nothing
+ */
+void runFile(FILE* in)
+{
+    static char data[FUZZ_MAX_INPUT];
+    size_t len = fread(data, 1, sizeof(data), in);
+
+    LLVMFuzzerTestOneInput((const uint8_t *)data, len);
+}
+
+/* generateExpression
+ * ...Write a random expression: mostly well formed, with numbers near
+ * ...the edges of the double range, every operator and function, signs,
+ * ...and now and then a stray character, space or parenthesis
+ * ...Parameters:
+ * ......char* buf -- destination
+ * ......size_t size -- room in buf, including the \0 char
+ * ...Returns:
+ * ......the length of the expression
+ */
+size_t generateExpression(char* buf, size_t size)
+{
+    size_t len = 0;
+
+    appendTerm(buf, &len, size - 1, 4);
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* appendTerm
+ * ...Append a random operand or subexpression
+ * ...Parameters:
+ * ......char* buf -- destination
+ * ......size_t* len -- characters in buf, advanced
+ * ......size_t cap -- most characters buf may hold
+ * ......int depth -- nesting still allowed
+ * ...Returns:
+ * ......Nothing
+ */
+void appendTerm(char* buf, size_t* len, size_t cap, int depth)
+{
+    static const char* ops[] = {"+", "-", "*", "/", "%", "^", " + ", " - ",
+                                " * ", " / ", "--", "+-", "*-", "/-"};
+    static const char* unary[] = {"sqrt(", "log(", "-(", "+(", "("};
+    static const char* binary[] = {"min(", "max("};
+    static const char junk[] = "()+-,.eE x$  ";
+    int terms = 1 + (int)(nextRandom() % 4);
+
+    for (int t = 0; t < terms && *len + 64 < cap; t++)
+    {
+        if (t > 0)
+        {
+            const char* op = ops[nextRandom() % 14];
+            memcpy(buf + *len, op, strlen(op));
+            *len += strlen(op);
+        }
+
+        switch (depth > 0 ? nextRandom() % 8 : 0)
+        {
+            case 1:
+            {
+                const char* fn = unary[nextRandom() % 5];
+                memcpy(buf + *len, fn, strlen(fn));
+                *len += strlen(fn);
+                appendTerm(buf, len, cap, depth - 1);
+                buf[(*len)++] = ')';
+                break;
+            }
+
+            case 2:
+            {
+                const char* fn = binary[nextRandom() % 2];
+                memcpy(buf + *len, fn, strlen(fn));
+                *len += strlen(fn);
+                appendTerm(buf, len, cap, depth - 1);
+                buf[(*len)++] = ',';
+                appendTerm(buf, len, cap, depth - 1);
+                buf[(*len)++] = ')';
+                break;
+            }
+
+            default:
+                appendNumber(buf, len, cap);
+                break;
+        }
+
+        if (nextRandom() % 32 == 0)
+            buf[(*len)++] = junk[nextRandom() % (sizeof(junk) - 1)];
+    }
+}
+
+/* appendNumber
+ * ...Append a random number, sometimes at the edge of the double range
+ * ...Parameters:
+ * ......char* buf -- destination
+ * ......size_t* len -- characters in buf, advanced
+ * ......size_t cap -- most characters buf may hold
+ * ...Returns:
+ * ......Nothing
+ */
+void appendNumber(char* buf, size_t* len, size_t cap)
+{
+    static const char* edges[] = {"0", "0.0", "1", "2", "1e308",
+                                  "1.7976931348623157e308", "4.9e-324",
+                                  "2.220446049250313e-16", "1e-400",
+                                  "9007199254740993", ".5", "5.", "1e+2"};
+    char num[32];
+    int num_len;
+
+    if (nextRandom() % 4 == 0)
+        num_len = snprintf(num, sizeof(num), "%s", edges[nextRandom() % 13]);
+    else if (nextRandom() % 2 == 0)
+        num_len = snprintf(num, sizeof(num), "%d",
+                           (int)(nextRandom() % 1000));
+    else
+        num_len = snprintf(num, sizeof(num), "%d.%de%d",
+                           (int)(nextRandom() % 100),
+                           (int)(nextRandom() % 1000),
+                           (int)(nextRandom() % 40) - 20);
+
+    if (*len + (size_t)num_len < cap)
+    {
+        memcpy(buf + *len, num, num_len);
+        *len += num_len;
+    }
+}
+
+/* nextRandom
+ * ...xorshift64 generator, so every run checks the same expressions
+ * ...Returns:
+ * ......the next pseudo-random number
+ */
+uint64_t nextRandom()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return rng_state;
+}
+
+#endif // FUZZ_LIBFUZZER
@@ -0,0 +1,338 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Keeps an expression evaluated while its numbers change    *
+ * one at a time: an update recomputes the term holding the  *
+ * number and a logarithmic path of the top-level sum        *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t copyTree(CalcContext*, ExprNode*, CalcIncremental*);
+static void evalIncNode(IncNode*, size_t);
+static void setTerm(CalcIncremental*, size_t);
+
+/* buildIncremental
+ * ...Parse an expression and evaluate it, keeping what an update needs.
+ * ...The terms of the top-level sum become the leaves of a segment
+ * ...tree of partial sums, and every term keeps its own tree
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, provides scratch space
+ * ......const char* exp -- characters of the expression, need not be
+ * ...... NUL-terminated and are never modified
+ * ......size_t len -- number of characters in exp
+ * ......CalcIncremental* inc -- receives the expression, release it with
+ * ...... freeIncremental
+ * ...Returns:
+ * ......CALC_OK if the expression is valid, the reason otherwise; a
+ * ...... division by zero is not a failure here but the status of
+ * ...... incrementalResult until an update removes it
+ * ...... on failure inc is left empty and, for a bad token,
+ * ...... ctx->error_token and ctx->error_len identify it
+ */
+CalcStatus buildIncremental(CalcContext* ctx, const char* exp, size_t len,
+                            CalcIncremental* inc)
+{
+    ExprNode* root;
+    ExprNode* node;
+    ExprNode** terms;
+    CalcStatus status;
+    size_t num_nodes;
+    size_t t;
+
+    memset(inc, 0, sizeof(*inc));
+
+    if ((status = parseTree(ctx, exp, len, NULL, 0, &root)) != CALC_OK)
+        return status;
+
+    // The sum a + b - c ... parses to ((a + b) - c) ..., so its terms
+    // are the right operands down the left spine, and the node the
+    // spine ends at
+    inc->num_terms = 1;
+    for (node = root; node->kind == NODE_BINARY
+                      && (node->op == OP_ADD || node->op == OP_SUB);
+         node = node->left)
+        inc->num_terms++;
+
+    inc->num_leaves = 1;
+    while (inc->num_leaves < inc->num_terms)
+        inc->num_leaves *= 2;
+
+    num_nodes = copyTree(ctx, root, inc);
+    inc->terms = (size_t *)malloc(sizeof(size_t) * inc->num_terms);
+    inc->sums = (double *)malloc(sizeof(double) * 2 * inc->num_leaves);
+    if (num_nodes == 0 || inc->terms == NULL || inc->sums == NULL
+        || !reserveStacks(&ctx->stacks, inc->num_terms))
+    {
+        freeIncremental(inc);
+        return CALC_NO_MEMORY;
+    }
+
+    // Spine nodes were left out of the copy, so term roots have no parent
+    terms = ctx->stacks.nodes;
+    t = inc->num_terms - 1;
+    for (node = root; node->kind == NODE_BINARY
+                      && (node->op == OP_ADD || node->op == OP_SUB);
+         node = node->left)
+    {
+        terms[t] = node->right;
+        inc->nodes[node->right->slot].negated = node->op == OP_SUB;
+        t--;
+    }
+    terms[0] = node;
+
+    for (t = 0; t < inc->num_terms; t++)
+    {
+        inc->terms[t] = terms[t]->slot;
+        inc->nodes[inc->terms[t]].term = t;
+    }
+
+    for (size_t i = 0; i < inc->num_nodes; i++)
+        evalIncNode(inc->nodes, i);
+
+    // Padding leaves hold -0.0, which leaves every sum unchanged
+    for (size_t leaf = inc->num_terms; leaf < inc->num_leaves; leaf++)
+        inc->sums[inc->num_leaves + leaf] = -0.0;
+    for (t = 0; t < inc->num_terms; t++)
+    {
+        inc->num_failed += inc->nodes[inc->terms[t]].failed;
+        setTerm(inc, t);
+    }
+    for (size_t i = inc->num_leaves - 1; i > 0; i--)
+        inc->sums[i] = inc->sums[2 * i] + inc->sums[2 * i + 1];
+
+    return CALC_OK;
+}
+
+/* updateOperand
+ * ...Change one number of an expression and evaluate it again. Only the
+ * ...operations above that number within its term are applied, then
+ * ...the partial sums on the path from the term to the total
+ * ...Parameters:
+ * ......CalcIncremental* inc -- expression from buildIncremental
+ * ......size_t index -- position of the number among the numbers of the
+ * ...... expression as written, below inc->num_operands; a sign the
+ * ...... number was written with, as in 2 * -3, is part of it
+ * ......double value -- the new value of the number
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_BAD_ARGUMENTS if index is not below
+ * ...... inc->num_operands, CALC_DIVIDE_BY_ZERO if any term divides
+ * ...... by zero
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ */
+CalcStatus updateOperand(CalcIncremental* inc, size_t index, double value,
+                         double* result)
+{
+    IncNode* nodes = inc->nodes;
+    bool was_failed = false;
+    size_t node;
+    size_t sum;
+
+    if (index >= inc->num_operands)
+    {
+        *result = 0.0;
+        return CALC_BAD_ARGUMENTS;
+    }
+
+    node = inc->operands[index];
+    nodes[node].value = value;
+    while (nodes[node].parent != NO_SLOT)
+    {
+        node = nodes[node].parent;
+        was_failed = nodes[node].failed;
+        evalIncNode(nodes, node);
+    }
+
+    if (nodes[node].failed != was_failed)
+        inc->num_failed = was_failed ? inc->num_failed - 1
+                                     : inc->num_failed + 1;
+    setTerm(inc, nodes[node].term);
+
+    for (sum = (inc->num_leaves + nodes[node].term) / 2; sum > 0; sum /= 2)
+        inc->sums[sum] = inc->sums[2 * sum] + inc->sums[2 * sum + 1];
+
+    return incrementalResult(inc, result);
+}
+
+/* incrementalResult
+ * ...Read the current value of an expression
+ * ...Parameters:
+ * ......const CalcIncremental* inc -- expression from buildIncremental
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_DIVIDE_BY_ZERO if any term divides
+ * ...... by zero
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ */
+CalcStatus incrementalResult(const CalcIncremental* inc, double* result)
+{
+    if (inc->num_failed > 0)
+    {
+        *result = 0.0;
+        return CALC_DIVIDE_BY_ZERO;
+    }
+
+    // With one term, sums[1] is that term's leaf
+    *result = inc->sums[1];
+
+    return CALC_OK;
+}
+
+/* freeIncremental
+ * ...Release the storage held by an incremental expression
+ * ...Parameters:
+ * ......CalcIncremental* inc -- expression to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeIncremental(CalcIncremental* inc)
+{
+    free(inc->nodes);
+    free(inc->operands);
+    free(inc->terms);
+    free(inc->sums);
+    memset(inc, 0, sizeof(*inc));
+}
+
+/* copyTree
+ * ...Copy the tree of the last parseTree call out of the arena, leaving
+ * ...out the spine of the top-level sum. The arena holds every node
+ * ...after its operands, and numbers in the order they were written, so
+ * ...copying it in allocation order keeps both properties. Each copied
+ * ...node's slot is set to its index in the copy
+ * ...Parameters:
+ * ......CalcContext* ctx -- context holding the tree
+ * ......ExprNode* root -- root of the tree
+ * ......CalcIncremental* inc -- receives the nodes and operands;
+ * ...... inc->num_terms - 1 spine nodes are left out
+ * ...Returns:
+ * ......the number of nodes copied, 0 if allocation failed
+ */
+static size_t copyTree(CalcContext* ctx, ExprNode* root,
+                       CalcIncremental* inc)
+{
+    struct NodeBlock* block;
+    ExprNode* node;
+    ExprNode* last;
+    IncNode* copy;
+    size_t num_arena = 0;
+    size_t num_numbers = 0;
+
+    for (block = ctx->node_blocks; block != NULL; block = block->next)
+    {
+        last = block->nodes + (block == ctx->node_block ? ctx->node_used
+                                                          : NODE_BLOCK_SIZE);
+        for (node = block->nodes; node < last; node++)
+        {
+            node->slot = 0;
+            num_arena++;
+            num_numbers += node->kind == NODE_NUMBER;
+        }
+        if (block == ctx->node_block)
+            break;
+    }
+
+    for (node = root; node->kind == NODE_BINARY
+                          && (node->op == OP_ADD || node->op == OP_SUB);
+         node = node->left)
+        node->slot = NO_SLOT;
+
+    inc->nodes = (IncNode *)malloc(sizeof(IncNode)
+                                   * (num_arena - (inc->num_terms - 1)));
+    inc->operands = (size_t *)malloc(sizeof(size_t) * num_numbers);
+    if (inc->nodes == NULL || inc->operands == NULL)
+        return 0;
+
+    for (block = ctx->node_blocks; block != NULL; block = block->next)
+    {
+        last = block->nodes + (block == ctx->node_block ? ctx->node_used
+                                                          : NODE_BLOCK_SIZE);
+        for (node = block->nodes; node < last; node++)
+        {
+            if (node->slot == NO_SLOT)
+                continue;
+
+            node->slot = inc->num_nodes;
+            copy = &inc->nodes[inc->num_nodes++];
+            copy->op = node->kind == NODE_NUMBER ? OP_NONE : node->op;
+            copy->failed = false;
+            copy->negated = false;
+            copy->parent = NO_SLOT;
+            copy->term = NO_SLOT;
+            copy->value = node->value;
+
+            if (node->kind == NODE_NUMBER)
+                inc->operands[inc->num_operands++] = node->slot;
+            else
+            {
+                copy->left = node->left->slot;
+                inc->nodes[copy->left].parent = node->slot;
+            }
+            if (node->kind == NODE_BINARY)
+            {
+                copy->right = node->right->slot;
+                inc->nodes[copy->right].parent = node->slot;
+            }
+        }
+        if (block == ctx->node_block)
+            break;
+    }
+
+    return inc->num_nodes;
+}
+
+/* evalIncNode
+ * ...Evaluate one node from its operands, which are up to date. A node
+ * ...fails when an operand failed or, as in evalTree, it divides by zero
+ * ...Parameters:
+ * ......IncNode* nodes -- nodes of the expression
+ * ......size_t i -- node to evaluate
+ * ...Returns:
+ * ......Nothing
+ */
+static void evalIncNode(IncNode* nodes, size_t i)
+{
+    IncNode* node = &nodes[i];
+    const IncNode* left;
+    const IncNode* right;
+
+    if (node->op == OP_NONE)
+        return;
+
+    left = &nodes[node->left];
+    if (op_table[node->op].arity == 1)
+    {
+        node->value = applyUnary(left->value, node->op);
+        node->failed = left->failed;
+        return;
+    }
+
+    right = &nodes[node->right];
+    node->value = applyOp(left->value, right->value, node->op);
+    node->failed = left->failed || right->failed
+                   || dividesByZero(right->value, node->op);
+}
+
+/* setTerm
+ * ...Store a term's contribution to the sum in its segment tree leaf:
+ * ...its value, negated if it is subtracted, or -0.0 while it fails
+ * ...Parameters:
+ * ......CalcIncremental* inc -- expression being evaluated
+ * ......size_t t -- index of the term
+ * ...Returns:
+ * ......Nothing
+ */
+static void setTerm(CalcIncremental* inc, size_t t)
+{
+    const IncNode* root = &inc->nodes[inc->terms[t]];
+
+    inc->sums[inc->num_leaves + t] = root->failed ? -0.0
+                                     : root->negated ? -root->value
+                                                     : root->value;
+}
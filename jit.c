@@ -0,0 +1,537 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Translates a compiled program into straight-line x86-64   *
+ * machine code, keeping each value stack entry in an SSE    *
+ * register, for programs that run often enough to repay it  *
+ *************************************************************/
+
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#ifdef CALC_JIT
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// Value stack entries held in xmm0 to xmm15; deeper programs are
+// left to the interpreter
+#define JIT_MAX_STACK 16
+
+// General purpose registers, numbered as in the instruction encoding
+#define REG_AX 0
+#define REG_CX 1
+#define REG_BX 3  // consts
+#define REG_BP 5  // bindings
+#define REG_R12 12 // stack: spill area, then the shared slots
+#define REG_R13 13 // result
+
+// Opcodes of the scalar double instructions, after F2 0F
+#define SSE_SQRT 0x51
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5C
+#define SSE_MIN 0x5D
+#define SSE_DIV 0x5E
+#define SSE_MAX 0x5F
+#define SSE_LOAD 0x10
+#define SSE_STORE 0x11
+
+// Machine code under construction
+typedef struct
+{
+    unsigned char* bytes;
+    size_t len;
+    size_t cap;
+    bool failed;        // out of memory, the program is not translated
+    size_t* div_jumps;  // offsets of the rel32 fields of the jumps taken
+    size_t num_jumps;   // on a division by zero
+    size_t jumps_cap;
+} CodeBuffer;
+
+static bool emitInstr(CodeBuffer*, const Instr*, size_t*, size_t);
+static void emitLibmCall(CodeBuffer*, InstrCode, size_t);
+static void emitZeroCheck(CodeBuffer*, int);
+static void emitEpilogue(CodeBuffer*);
+static void emitSse(CodeBuffer*, unsigned, int, int);
+static void emitSseMem(CodeBuffer*, unsigned, int, int, size_t);
+static void emitMovapd(CodeBuffer*, int, int);
+static void emitImm64(CodeBuffer*, int, uint64_t);
+static void emitBytes(CodeBuffer*, const unsigned char*, size_t);
+static void emitU32(CodeBuffer*, uint32_t);
+
+/* jitCompile
+ * ...Translate a compiled program into a native function. Stack entry i
+ * ...lives in xmm i, constants, bindings and shared slots are read in
+ * ...place, and only the libm calls spill the entries below their
+ * ...operands to the stack memory. Division by zero follows the same
+ * ...rule as execProgram
+ * ...Parameters:
+ * ......const CalcProgram* prog -- program from compileExpression
+ * ......JitCode* jit -- receives the function and its mapping
+ * ...Returns:
+ * ......false if the program is too deep or too large, or executable
+ * ...... memory could not be had, true otherwise
+ */
+bool jitCompile(const CalcProgram* prog, JitCode* jit)
+{
+    static const unsigned char prologue[] = {
+        0x53,                   // push rbx
+        0x55,                   // push rbp
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x48, 0x83, 0xEC, 0x08, // sub rsp, 8: align calls to 16 bytes
+        0x48, 0x89, 0xFB,       // mov rbx, rdi
+        0x48, 0x89, 0xF5,       // mov rbp, rsi
+        0x49, 0x89, 0xD4,       // mov r12, rdx
+        0x49, 0x89, 0xCD        // mov r13, rcx
+    };
+    static const unsigned char set_ok[] = {0x31, 0xC0};  // xor eax, eax
+    static const unsigned char set_div_zero[] = {0xB8, 1, 0, 0, 0};
+    CodeBuffer buf = {NULL, 0, 0, false, NULL, 0, 0};
+    size_t depth = 0;
+    int32_t rel;
+    void* code;
+
+    if (prog->max_stack > JIT_MAX_STACK
+        || prog->max_stack + prog->num_slots > INT32_MAX / sizeof(double)
+        || prog->num_consts > INT32_MAX / sizeof(double)
+        || (size_t)prog->num_vars > INT32_MAX / sizeof(double))
+        return false;
+
+    emitBytes(&buf, prologue, sizeof(prologue));
+    for (size_t i = 0; i < prog->num_code; i++)
+    {
+        if (!emitInstr(&buf, &prog->code[i], &depth, prog->max_stack))
+            buf.failed = true;
+    }
+
+    // movsd [r13], xmm0, then return 0
+    emitSseMem(&buf, SSE_STORE, 0, REG_R13, 0);
+    emitBytes(&buf, set_ok, sizeof(set_ok));
+    emitEpilogue(&buf);
+
+    // Every division by zero lands here and returns 1
+    for (size_t i = 0; i < buf.num_jumps && !buf.failed; i++)
+    {
+        rel = (int32_t)(buf.len - (buf.div_jumps[i] + 4));
+        memcpy(buf.bytes + buf.div_jumps[i], &rel, sizeof(rel));
+    }
+    emitBytes(&buf, set_div_zero, sizeof(set_div_zero));
+    emitEpilogue(&buf);
+
+    free(buf.div_jumps);
+    if (buf.failed || buf.len > INT32_MAX)
+    {
+        free(buf.bytes);
+        return false;
+    }
+
+    // Written while writable, then made executable and read-only
+    code = mmap(NULL, buf.len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        free(buf.bytes);
+        return false;
+    }
+    memcpy(code, buf.bytes, buf.len);
+    free(buf.bytes);
+
+    if (mprotect(code, buf.len, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, buf.len);
+        return false;
+    }
+
+    jit->fn = (JitFn)code;
+    jit->code = code;
+    jit->size = buf.len;
+
+    return true;
+}
+
+/* jitFree
+ * ...Release the native function of a program
+ * ...Parameters:
+ * ......JitCode* jit -- translation from jitCompile
+ * ...Returns:
+ * ......Nothing
+ */
+void jitFree(JitCode* jit)
+{
+    if (jit->code != NULL)
+        munmap(jit->code, jit->size);
+
+    jit->fn = NULL;
+    jit->code = NULL;
+    jit->size = 0;
+}
+
+/* emitInstr
+ * ...Emit the machine code of one program instruction
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......const Instr* instr -- instruction to translate
+ * ......size_t* depth -- values on the stack, updated
+ * ......size_t max_stack -- start of the shared slots in stack memory
+ * ...Returns:
+ * ......false if the instruction cannot be translated, true otherwise
+ */
+static bool emitInstr(CodeBuffer* buf, const Instr* instr, size_t* depth,
+                      size_t max_stack)
+{
+    static const unsigned char flip_sign[] = {
+        0x48, 0x0F, 0xBA, 0xF8, 0x3F // btc rax, 63
+    };
+    static const unsigned char sse_ops[] = {
+        [INSTR_ADD] = SSE_ADD,
+        [INSTR_SUB] = SSE_SUB,
+        [INSTR_MUL] = SSE_MUL,
+        [INSTR_DIV] = SSE_DIV,
+        [INSTR_MIN] = SSE_MIN, // minsd keeps the first operand unless the
+        [INSTR_MAX] = SSE_MAX  // second is smaller, as a < b ? a : b does
+    };
+    int top = (int)*depth - 1;
+
+    switch (instr->code)
+    {
+        case INSTR_CONST:
+            emitSseMem(buf, SSE_LOAD, top + 1, REG_BX, instr->arg);
+            ++*depth;
+            break;
+
+        case INSTR_VAR:
+            emitSseMem(buf, SSE_LOAD, top + 1, REG_BP, instr->arg);
+            ++*depth;
+            break;
+
+        case INSTR_LOAD:
+            emitSseMem(buf, SSE_LOAD, top + 1, REG_R12,
+                       max_stack + instr->arg);
+            ++*depth;
+            break;
+
+        case INSTR_STORE:
+            emitSseMem(buf, SSE_STORE, top, REG_R12, max_stack + instr->arg);
+            break;
+
+        case INSTR_DIV:
+            emitZeroCheck(buf, top);
+            // fall through
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+        case INSTR_MIN:
+        case INSTR_MAX:
+            emitSse(buf, sse_ops[instr->code], top - 1, top);
+            --*depth;
+            break;
+
+        case INSTR_NEG:
+            // movq rax, xmm; btc rax, 63; movq xmm, rax
+            emitSse(buf, 0x660F7E, top, REG_AX);
+            emitBytes(buf, flip_sign, sizeof(flip_sign));
+            emitSse(buf, 0x660F6E, top, REG_AX);
+            break;
+
+        case INSTR_SQRT:
+            emitSse(buf, SSE_SQRT, top, top);
+            break;
+
+        case INSTR_MOD:
+            emitZeroCheck(buf, top);
+            // fall through
+        case INSTR_POW:
+            emitLibmCall(buf, instr->code, (size_t)top - 1);
+            --*depth;
+            break;
+
+        case INSTR_LOG:
+            emitLibmCall(buf, instr->code, (size_t)top);
+            break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+/* emitLibmCall
+ * ...Emit a call of fmod, pow or log on the top stack entries. Calls
+ * ...may change every SSE register, so the entries below the operands
+ * ...are stored to stack memory around the call
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......InstrCode code -- INSTR_MOD, INSTR_POW or INSTR_LOG
+ * ......size_t first -- stack entry of the first operand, which
+ * ...... receives the result
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitLibmCall(CodeBuffer* buf, InstrCode code, size_t first)
+{
+    static const unsigned char call_rax[] = {0xFF, 0xD0};
+    double (*binary)(double, double) = code == INSTR_MOD ? fmod : pow;
+    double (*unary)(double) = log;
+    uint64_t target = code == INSTR_LOG ? (uint64_t)(uintptr_t)unary
+                                        : (uint64_t)(uintptr_t)binary;
+
+    for (size_t i = 0; i < first; i++)
+        emitSseMem(buf, SSE_STORE, (int)i, REG_R12, i);
+
+    if (first > 0)
+    {
+        emitMovapd(buf, 0, (int)first);
+        if (code != INSTR_LOG)
+            emitMovapd(buf, 1, (int)first + 1);
+    }
+
+    emitImm64(buf, REG_AX, target);
+    emitBytes(buf, call_rax, sizeof(call_rax));
+
+    if (first > 0)
+        emitMovapd(buf, (int)first, 0);
+    for (size_t i = 0; i < first; i++)
+        emitSseMem(buf, SSE_LOAD, (int)i, REG_R12, i);
+}
+
+/* emitZeroCheck
+ * ...Emit a jump to the division by zero exit when |xmm| < DBL_EPSILON.
+ * ...With the sign shifted out, the bits of nonnegative doubles other
+ * ...than nan order as the values do, so one integer compare suffices
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......int xmm -- register holding the divisor
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitZeroCheck(CodeBuffer* buf, int xmm)
+{
+    static const unsigned char compare[] = {
+        0x48, 0xD1, 0xE0, // shl rax, 1
+        0x48, 0x39, 0xC8, // cmp rax, rcx
+        0x0F, 0x82        // jb rel32
+    };
+    double epsilon = DBL_EPSILON;
+    uint64_t bits;
+    size_t* new_jumps;
+    size_t new_cap;
+
+    memcpy(&bits, &epsilon, sizeof(bits));
+
+    emitSse(buf, 0x660F7E, xmm, REG_AX); // movq rax, xmm
+    emitImm64(buf, REG_CX, bits << 1);
+    emitBytes(buf, compare, sizeof(compare));
+
+    if (buf->num_jumps == buf->jumps_cap)
+    {
+        new_cap = buf->jumps_cap > 0 ? buf->jumps_cap * 2 : 8;
+        new_jumps = (size_t *)realloc(buf->div_jumps,
+                                      sizeof(size_t) * new_cap);
+        if (new_jumps == NULL)
+        {
+            buf->failed = true;
+            return;
+        }
+        buf->div_jumps = new_jumps;
+        buf->jumps_cap = new_cap;
+    }
+    buf->div_jumps[buf->num_jumps++] = buf->len;
+    emitU32(buf, 0); // patched once the exit is placed
+}
+
+/* emitEpilogue
+ * ...Emit the return sequence matching the prologue
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitEpilogue(CodeBuffer* buf)
+{
+    static const unsigned char epilogue[] = {
+        0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5D,                   // pop rbp
+        0x5B,                   // pop rbx
+        0xC3                    // ret
+    };
+
+    emitBytes(buf, epilogue, sizeof(epilogue));
+}
+
+/* emitSse
+ * ...Emit an SSE instruction between two registers
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......unsigned op -- the opcode byte of a scalar double instruction
+ * ...... after F2 0F, or 660F7E / 660F6E for a movq between xmm and a
+ * ...... 64-bit general purpose register
+ * ......int reg -- destination xmm, or the xmm of a movq
+ * ......int rm -- source xmm, or the general purpose register of a movq
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitSse(CodeBuffer* buf, unsigned op, int reg, int rm)
+{
+    bool movq = op > 0xFF;
+    unsigned char bytes[5];
+    size_t n = 0;
+    unsigned rex = (movq ? 0x48 : 0x40) | (reg >= 8 ? 4 : 0)
+                   | (rm >= 8 ? 1 : 0);
+
+    bytes[n++] = movq ? 0x66 : 0xF2;
+    if (rex != 0x40)
+        bytes[n++] = (unsigned char)rex;
+    bytes[n++] = 0x0F;
+    bytes[n++] = (unsigned char)op;
+    bytes[n++] = (unsigned char)(0xC0 | (reg & 7) << 3 | (rm & 7));
+
+    emitBytes(buf, bytes, n);
+}
+
+/* emitSseMem
+ * ...Emit a movsd between a register and a double in memory
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......unsigned op -- SSE_LOAD or SSE_STORE
+ * ......int xmm -- register loaded or stored
+ * ......int base -- general purpose register holding the array
+ * ......size_t index -- entry of the array, its offset fits in 32 bits
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitSseMem(CodeBuffer* buf, unsigned op, int xmm, int base,
+                       size_t index)
+{
+    unsigned char bytes[6];
+    size_t n = 0;
+    unsigned rex = 0x40 | (xmm >= 8 ? 4 : 0) | (base >= 8 ? 1 : 0);
+
+    bytes[n++] = 0xF2;
+    if (rex != 0x40)
+        bytes[n++] = (unsigned char)rex;
+    bytes[n++] = 0x0F;
+    bytes[n++] = (unsigned char)op;
+    // [base + disp32], through a SIB byte so that any base works
+    bytes[n++] = (unsigned char)(0x84 | (xmm & 7) << 3);
+    bytes[n++] = (unsigned char)(0x20 | (base & 7));
+
+    emitBytes(buf, bytes, n);
+    emitU32(buf, (uint32_t)(index * sizeof(double)));
+}
+
+/* emitMovapd
+ * ...Emit a copy between two SSE registers
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......int dst -- destination xmm
+ * ......int src -- source xmm
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitMovapd(CodeBuffer* buf, int dst, int src)
+{
+    unsigned char bytes[5];
+    size_t n = 0;
+    unsigned rex = 0x40 | (dst >= 8 ? 4 : 0) | (src >= 8 ? 1 : 0);
+
+    bytes[n++] = 0x66;
+    if (rex != 0x40)
+        bytes[n++] = (unsigned char)rex;
+    bytes[n++] = 0x0F;
+    bytes[n++] = 0x28;
+    bytes[n++] = (unsigned char)(0xC0 | (dst & 7) << 3 | (src & 7));
+
+    emitBytes(buf, bytes, n);
+}
+
+/* emitImm64
+ * ...Emit a move of a 64-bit constant into rax or rcx
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......int reg -- REG_AX or REG_CX
+ * ......uint64_t value -- constant to load
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitImm64(CodeBuffer* buf, int reg, uint64_t value)
+{
+    unsigned char bytes[10];
+
+    bytes[0] = 0x48;
+    bytes[1] = (unsigned char)(0xB8 + reg);
+    for (int i = 0; i < 8; i++)
+        bytes[2 + i] = (unsigned char)(value >> (8 * i));
+
+    emitBytes(buf, bytes, sizeof(bytes));
+}
+
+/* emitBytes
+ * ...Append machine code, doubling the buffer as needed
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......const unsigned char* bytes -- code to append
+ * ......size_t n -- number of bytes
+ * ...Returns:
+ * ......Nothing, buf->failed is set if the buffer could not be grown
+ */
+static void emitBytes(CodeBuffer* buf, const unsigned char* bytes, size_t n)
+{
+    size_t new_cap = buf->cap > 0 ? buf->cap : 256;
+    unsigned char* new_bytes;
+
+    if (buf->failed)
+        return;
+
+    if (buf->len + n > buf->cap)
+    {
+        while (new_cap < buf->len + n)
+            new_cap *= 2;
+        new_bytes = (unsigned char *)realloc(buf->bytes, new_cap);
+        if (new_bytes == NULL)
+        {
+            buf->failed = true;
+            return;
+        }
+        buf->bytes = new_bytes;
+        buf->cap = new_cap;
+    }
+
+    memcpy(buf->bytes + buf->len, bytes, n);
+    buf->len += n;
+}
+
+/* emitU32
+ * ...Append a little-endian 32-bit value
+ * ...Parameters:
+ * ......CodeBuffer* buf -- code under construction
+ * ......uint32_t value -- value to append
+ * ...Returns:
+ * ......Nothing
+ */
+static void emitU32(CodeBuffer* buf, uint32_t value)
+{
+    unsigned char bytes[4];
+
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (unsigned char)(value >> (8 * i));
+
+    emitBytes(buf, bytes, sizeof(bytes));
+}
+
+#endif // CALC_JIT
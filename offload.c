@@ -0,0 +1,149 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Spreads a columnar evaluation of many rows over several   *
+ * threads, each running the program over its own range of   *
+ * rows with the vector kernels of runProgramColumns         *
+ *************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+// Fewest rows worth a thread of their own
+#define OFFLOAD_MIN_ROWS (64 * 1024)
+
+// Ranges start on a multiple of this many rows, so no two threads write
+// the same cache line of results or div_zero
+#define OFFLOAD_ROW_ALIGN 256
+
+typedef struct
+{
+    CalcContext* ctx;
+    const CalcProgram* prog;
+    const double** columns; // the range's rows of every column
+    size_t num_rows;
+    double* results;
+    unsigned char* div_zero;
+    size_t num_failed;
+    pthread_t thread;
+} RowRange;
+
+static void* runRange(void*);
+
+/* runProgramColumnsParallel
+ * ...Evaluate a compiled program over columns of variable values on
+ * ...several threads, each taking a contiguous range of rows. Every row
+ * ...gets exactly the result runProgramColumns gives it. Fewer rows than
+ * ...are worth splitting run on the calling thread with ctxs[0]
+ * ...Parameters:
+ * ......CalcContext* const* ctxs -- evaluator contexts, one per thread,
+ * ...... none used by another thread during the call
+ * ......int num_ctx -- number of entries in ctxs, at least 1
+ * ......const CalcProgram* prog -- program from compileExpression
+ * ......const double* const* columns -- one column of num_rows values
+ * ...... per variable, in the order the variables were compiled
+ * ......size_t num_rows -- number of rows to evaluate
+ * ......double* results -- receives one result per row, 0.0 on failure
+ * ......unsigned char* div_zero -- receives 1 for each row that divided
+ * ...... by zero and 0 for every other row
+ * ...Returns:
+ * ......the number of rows that divided by zero, counting as such every
+ * ...... row of a range whose scratch space could not be allocated
+ */
+size_t runProgramColumnsParallel(CalcContext* const* ctxs, int num_ctx,
+                                 const CalcProgram* prog,
+                                 const double* const* columns,
+                                 size_t num_rows, double* results,
+                                 unsigned char* div_zero)
+{
+    RowRange* ranges;
+    const double** range_columns;
+    bool* started;
+    size_t per_range;
+    size_t begin = 0;
+    size_t num_failed = 0;
+    int num_ranges = num_rows / OFFLOAD_MIN_ROWS < (size_t)num_ctx
+                     ? (int)(num_rows / OFFLOAD_MIN_ROWS) : num_ctx;
+
+    if (num_ranges < 2)
+        return runProgramColumns(ctxs[0], prog, columns, num_rows, results,
+                                 div_zero);
+
+    ranges = (RowRange *)calloc(num_ranges, sizeof(RowRange));
+    range_columns = (const double **)malloc(sizeof(double*) * num_ranges
+                                            * (prog->num_vars > 0
+                                               ? prog->num_vars : 1));
+    started = (bool *)calloc(num_ranges, sizeof(bool));
+    if (ranges == NULL || range_columns == NULL || started == NULL)
+    {
+        free(ranges);
+        free((void *)range_columns);
+        free(started);
+        return runProgramColumns(ctxs[0], prog, columns, num_rows, results,
+                                 div_zero);
+    }
+
+    per_range = (num_rows / num_ranges + OFFLOAD_ROW_ALIGN - 1)
+                / OFFLOAD_ROW_ALIGN * OFFLOAD_ROW_ALIGN;
+
+    for (int i = 0; i < num_ranges; i++)
+    {
+        ranges[i].ctx = ctxs[i];
+        ranges[i].prog = prog;
+        ranges[i].columns = range_columns + i * prog->num_vars;
+        ranges[i].num_rows = num_rows - begin;
+        if (i < num_ranges - 1 && ranges[i].num_rows > per_range)
+            ranges[i].num_rows = per_range;
+        ranges[i].results = results + begin;
+        ranges[i].div_zero = div_zero + begin;
+        for (int v = 0; v < prog->num_vars; v++)
+            ranges[i].columns[v] = columns[v] + begin;
+        begin += ranges[i].num_rows;
+    }
+
+    for (int i = 1; i < num_ranges; i++)
+        started[i] = pthread_create(&ranges[i].thread, NULL, runRange,
+                                    &ranges[i]) == 0;
+
+    for (int i = 0; i < num_ranges; i++)
+    {
+        if (!started[i])
+            runRange(&ranges[i]);
+    }
+
+    for (int i = 0; i < num_ranges; i++)
+    {
+        if (started[i])
+            pthread_join(ranges[i].thread, NULL);
+        num_failed += ranges[i].num_failed;
+    }
+
+    free(ranges);
+    free((void *)range_columns);
+    free(started);
+
+    return num_failed;
+}
+
+/* runRange
+ * ...Evaluate the program over one range of rows
+ * ...Parameters:
+ * ......void* arg -- the RowRange to evaluate
+ * ...Returns:
+ * ......NULL
+ */
+static void* runRange(void* arg)
+{
+    RowRange* range = (RowRange *)arg;
+
+    range->num_failed = runProgramColumns(range->ctx, range->prog,
+                                          range->columns, range->num_rows,
+                                          range->results, range->div_zero);
+
+    return NULL;
+}
@@ -0,0 +1,263 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Registry of the operators, functions and punctuation of   *
+ * the expression grammar: one static table describes each  *
+ * symbol, and every evaluator dispatches on its index       *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <float.h>
+
+// Everything the evaluators need to know about each symbol. A leading -
+// binds tighter than ^, just as the sign of a number such as -2 does, so
+// -2^2 and -x^2 are both squares of a negative
+const OpInfo op_table[NUM_OPS] = {
+    [OP_ADD]    = {"+",    2, 1, false, false, INSTR_ADD},
+    [OP_SUB]    = {"-",    2, 1, false, false, INSTR_SUB},
+    [OP_MUL]    = {"*",    2, 2, false, false, INSTR_MUL},
+    [OP_DIV]    = {"/",    2, 2, false, false, INSTR_DIV},
+    [OP_MOD]    = {"%",    2, 2, false, false, INSTR_MOD},
+    [OP_POW]    = {"^",    2, 3, true,  false, INSTR_POW},
+    [OP_MIN]    = {"min",  2, 0, false, true,  INSTR_MIN},
+    [OP_MAX]    = {"max",  2, 0, false, true,  INSTR_MAX},
+    [OP_NEGATE] = {"-",    1, 4, false, false, INSTR_NEG},
+    [OP_SQRT]   = {"sqrt", 1, 0, false, true,  INSTR_SQRT},
+    [OP_LOG]    = {"log",  1, 0, false, true,  INSTR_LOG},
+    [OP_OPEN]   = {"(",    0, 0, false, false, INSTR_CONST},
+    [OP_CLOSE]  = {")",    0, 0, false, false, INSTR_CONST},
+    [OP_COMMA]  = {",",    0, 0, false, false, INSTR_CONST},
+    [OP_ARGS]   = {"(",    0, 0, false, false, INSTR_CONST}
+};
+
+// Symbol spelled by each single character, OP_NONE for operand chars.
+// A - is OP_SUB here; where an operand is expected it negates instead
+static const unsigned char op_chars[UCHAR_MAX + 1] = {
+    ['+'] = OP_ADD,
+    ['-'] = OP_SUB,
+    ['*'] = OP_MUL,
+    ['/'] = OP_DIV,
+    ['%'] = OP_MOD,
+    ['^'] = OP_POW,
+    ['('] = OP_OPEN,
+    [')'] = OP_CLOSE,
+    [','] = OP_COMMA
+};
+
+/* isDelimiterChar
+ * ...Check if c ends a token and is a token by itself: an operator char,
+ * ...a parenthesis or a comma
+ * ...Parameters:
+ * ......char c -- character to check
+ * ...Returns:
+ * ......true if c is a delimiter char, false otherwise
+ */
+bool isDelimiterChar(char c)
+{
+    return op_chars[(unsigned char)c] != OP_NONE;
+}
+
+/* lookupOp
+ * ...Find the symbol a token spells
+ * ...Parameters:
+ * ......const char* token -- token to look up, not NUL-terminated
+ * ......size_t len -- number of characters in token
+ * ...Returns:
+ * ......the OpCode of the operator, punctuation or function name,
+ * ...... OP_NONE if token is none of those
+ */
+OpCode lookupOp(const char* token, size_t len)
+{
+    if (len == 1)
+        return (OpCode)op_chars[(unsigned char)token[0]];
+
+    for (int op = OP_NONE + 1; op < NUM_OPS; op++)
+    {
+        if (op_table[op].function
+            && strncmp(op_table[op].name, token, len) == 0
+            && op_table[op].name[len] == '\0')
+            return (OpCode)op;
+    }
+
+    return OP_NONE;
+}
+
+/* validOperator
+ * ...Check if a symbol may follow an operand
+ * ...Parameters:
+ * ......OpCode op -- symbol to check
+ * ...Returns:
+ * ......true if op is a binary operator, a closing parenthesis or a
+ * ...... comma, false otherwise
+ */
+bool validOperator(OpCode op)
+{
+    return (op_table[op].arity == 2 && !op_table[op].function)
+           || op == OP_CLOSE || op == OP_COMMA;
+}
+
+/* bindsFirst
+ * ...Check if a pending operator has to be applied before op is handled:
+ * ...it binds more tightly, or as tightly and op is left-associative.
+ * ...A closing parenthesis or comma applies everything back to its (
+ * ...Parameters:
+ * ......OpCode pending -- top of the operator stack
+ * ......OpCode op -- operator, closing parenthesis or comma just read
+ * ...Returns:
+ * ......true if pending is applied first, false otherwise
+ */
+bool bindsFirst(OpCode pending, OpCode op)
+{
+    if (pending == OP_OPEN || pending == OP_ARGS)
+        return false;
+
+    if (op == OP_CLOSE || op == OP_COMMA)
+        return true;
+
+    return op_table[pending].precedence > op_table[op].precedence
+           || (op_table[pending].precedence == op_table[op].precedence
+               && !op_table[op].right_assoc);
+}
+
+/* closeGroup
+ * ...Handle a closing parenthesis or comma once bindsFirst has applied
+ * ...everything after the matching (. A comma starts the second argument
+ * ...of a binary function; a closing parenthesis drops its (, leaving a
+ * ...function being called on top of the stack for the caller to apply
+ * ...Parameters:
+ * ......char* ops -- operator stack
+ * ......size_t* num_ops -- entries on ops, updated
+ * ......OpCode op -- OP_CLOSE or OP_COMMA
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_UNBALANCED_PAREN for a ) without a
+ * ...... (, CALC_BAD_ARGUMENTS for a comma outside a call or a call
+ * ...... with the wrong number of arguments
+ */
+CalcStatus closeGroup(char* ops, size_t* num_ops, OpCode op)
+{
+    OpCode paren;
+    OpCode callee;
+
+    if (*num_ops == 0)
+        return op == OP_CLOSE ? CALC_UNBALANCED_PAREN : CALC_BAD_ARGUMENTS;
+
+    paren = (OpCode)ops[*num_ops - 1];
+    callee = *num_ops > 1 ? (OpCode)ops[*num_ops - 2] : OP_NONE;
+
+    if (op == OP_COMMA)
+    {
+        if (paren != OP_OPEN || !op_table[callee].function
+            || op_table[callee].arity != 2)
+            return CALC_BAD_ARGUMENTS;
+
+        ops[*num_ops - 1] = OP_ARGS;
+        return CALC_OK;
+    }
+
+    // A function's arguments need exactly arity - 1 commas
+    if (op_table[callee].function
+        && (paren == OP_ARGS) != (op_table[callee].arity == 2))
+        return CALC_BAD_ARGUMENTS;
+
+    --*num_ops;
+
+    return CALC_OK;
+}
+
+/* applyOp
+ * ...Apply binary operation op on a and b
+ * ...Parameters:
+ * ......double a -- the first number to operate on
+ * ......double b -- the second number to operate on
+ * ......OpCode op -- the operation to perform, one with arity 2
+ * ...Returns:
+ * ......the result of the operation, DBL_MAX if dividesByZero(b, op)
+ */
+double applyOp(double a, double b, OpCode op)
+{
+    double result = 0.0;
+    switch (op)
+    {
+        case OP_ADD:
+            result = a + b;
+            break;
+
+        case OP_SUB:
+            result = a - b;
+            break;
+
+        case OP_MUL:
+            result = a * b;
+            break;
+
+        case OP_DIV:
+            if (fabs(b) < DBL_EPSILON)
+                result = DBL_MAX; // divide by zero
+            else
+                result = a / b;
+            break;
+
+        case OP_MOD:
+            if (fabs(b) < DBL_EPSILON)
+                result = DBL_MAX; // divide by zero
+            else
+                result = fmod(a, b);
+            break;
+
+        case OP_POW:
+            result = pow(a, b);
+            break;
+
+        case OP_MIN: // same lane rule as the vector min instructions
+            result = a < b ? a : b;
+            break;
+
+        case OP_MAX:
+            result = a > b ? a : b;
+            break;
+
+        default:
+            break;
+    }
+
+    return result;
+}
+
+/* applyUnary
+ * ...Apply unary operation op on x
+ * ...Parameters:
+ * ......double x -- the number to operate on
+ * ......OpCode op -- the operation to perform, one with arity 1
+ * ...Returns:
+ * ......the result of the operation; out of their domains, sqrt and
+ * ...... log give nan or -inf as the C library does
+ */
+double applyUnary(double x, OpCode op)
+{
+    double result = 0.0;
+    switch (op)
+    {
+        case OP_NEGATE:
+            result = -x;
+            break;
+
+        case OP_SQRT:
+            result = sqrt(x);
+            break;
+
+        case OP_LOG:
+            result = log(x);
+            break;
+
+        default:
+            break;
+    }
+
+    return result;
+}
@@ -0,0 +1,235 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Optimizes the tree of an expression before it is compiled *
+ * by folding constant subtrees and merging identical        *
+ * subtrees, so each distinct subexpression runs only once   *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static void foldNode(ExprNode*);
+static bool sameNode(const ExprNode*, const ExprNode*);
+static uint64_t hashNode(const ExprNode*);
+static uint64_t valueBits(double);
+
+/* optimizeTree
+ * ...Fold constant subtrees and merge identical subtrees of the tree
+ * ...built by the last parseTree call, then count how often the
+ * ...optimized tree refers to each node. Folding applies applyOp and
+ * ...applyUnary to the same operands in the same order evaluation
+ * ...would, so results are unchanged; a division by zero is left for
+ * ...run time to report.
+ * ...Operations are never reordered, so (x + 1) + 2 stays as written
+ * ...Parameters:
+ * ......CalcContext* ctx -- context holding the tree
+ * ......ExprNode** root -- root of the tree, replaced by the root of
+ * ...... the optimized tree
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_NO_MEMORY otherwise
+ */
+CalcStatus optimizeTree(CalcContext* ctx, ExprNode** root)
+{
+    struct NodeBlock* block;
+    ExprNode* node;
+    ExprNode* last;
+    ExprNode** table;
+    ExprNode** stack;
+    size_t num_nodes = 0;
+    size_t mask = 15;
+    size_t dex;
+    size_t count;
+
+    for (block = ctx->node_blocks; block != NULL; block = block->next)
+    {
+        num_nodes += block == ctx->node_block ? ctx->node_used
+                                               : NODE_BLOCK_SIZE;
+        if (block == ctx->node_block)
+            break;
+    }
+
+    while (mask + 1 < num_nodes * 2) // keep the table at most half full
+        mask = mask * 2 + 1;
+
+    table = (ExprNode **)calloc(mask + 1, sizeof(ExprNode*));
+    if (table == NULL)
+        return CALC_NO_MEMORY;
+
+    // Operands come before their parents in the arena, so by the time a
+    // node is reached its operands are already folded and merged
+    for (block = ctx->node_blocks; block != NULL; block = block->next)
+    {
+        last = block->nodes + (block == ctx->node_block ? ctx->node_used
+                                                          : NODE_BLOCK_SIZE);
+
+        for (node = block->nodes; node < last; node++)
+        {
+            if (node->left != NULL)
+                node->left = node->left->canon;
+            if (node->right != NULL)
+                node->right = node->right->canon;
+
+            foldNode(node);
+            node->refs = 0;
+            node->slot = NO_SLOT;
+            node->expanded = false;
+
+            dex = (size_t)hashNode(node) & mask;
+            while (table[dex] != NULL && !sameNode(table[dex], node))
+                dex = (dex + 1) & mask;
+
+            if (table[dex] == NULL)
+                table[dex] = node;
+            node->canon = table[dex];
+        }
+
+        if (block == ctx->node_block)
+            break;
+    }
+
+    free((void *)table);
+    *root = (*root)->canon;
+
+    // Count references from the optimized tree only; nodes it no longer
+    // reaches keep a count of zero
+    if (!reserveStacks(&ctx->stacks, 2 * num_nodes + 1))
+        return CALC_NO_MEMORY;
+
+    stack = ctx->stacks.nodes;
+    stack[0] = *root;
+    count = 1;
+
+    while (count > 0)
+    {
+        node = stack[--count];
+
+        if (node->refs++ > 0)
+            continue; // operands already counted through another parent
+
+        if (node->left != NULL)
+            stack[count++] = node->left;
+        if (node->right != NULL)
+            stack[count++] = node->right;
+    }
+
+    return CALC_OK;
+}
+
+/* foldNode
+ * ...Replace a node whose operands are all numbers by its value
+ * ...Parameters:
+ * ......ExprNode* node -- node with folded operands
+ * ...Returns:
+ * ......Nothing
+ */
+static void foldNode(ExprNode* node)
+{
+    double value;
+
+    if (node->kind == NODE_UNARY && node->left->kind == NODE_NUMBER)
+        value = applyUnary(node->left->value, node->op);
+    else if (node->kind == NODE_BINARY && node->left->kind == NODE_NUMBER
+             && node->right->kind == NODE_NUMBER)
+    {
+        if (dividesByZero(node->right->value, node->op))
+            return; // reported when the program runs
+        value = applyOp(node->left->value, node->right->value, node->op);
+    }
+    else
+        return;
+
+    node->kind = NODE_NUMBER;
+    node->value = value;
+    node->left = NULL;
+    node->right = NULL;
+}
+
+/* sameNode
+ * ...Check if two nodes compute the same value; their operands have
+ * ...already been merged, so comparing operand pointers is enough
+ * ...Parameters:
+ * ......const ExprNode* a -- first node
+ * ......const ExprNode* b -- second node
+ * ...Returns:
+ * ......true if a and b are interchangeable, false otherwise
+ */
+static bool sameNode(const ExprNode* a, const ExprNode* b)
+{
+    if (a->kind != b->kind)
+        return false;
+
+    switch (a->kind)
+    {
+        case NODE_NUMBER: // bitwise, so 0 and -0 stay distinct
+            return valueBits(a->value) == valueBits(b->value);
+
+        case NODE_VAR:
+            return a->var == b->var;
+
+        case NODE_UNARY:
+        case NODE_BINARY:
+            return a->op == b->op && a->left == b->left
+                   && a->right == b->right;
+    }
+
+    return false;
+}
+
+/* hashNode
+ * ...Hash the fields sameNode compares
+ * ...Parameters:
+ * ......const ExprNode* node -- node to hash
+ * ...Returns:
+ * ......the hash of node
+ */
+static uint64_t hashNode(const ExprNode* node)
+{
+    uint64_t hash = (uint64_t)node->kind;
+
+    switch (node->kind)
+    {
+        case NODE_NUMBER:
+            hash ^= valueBits(node->value);
+            break;
+
+        case NODE_VAR:
+            hash ^= (uint64_t)node->var << 8;
+            break;
+
+        case NODE_UNARY:
+        case NODE_BINARY:
+            hash ^= (uint64_t)node->op << 8;
+            hash ^= (uint64_t)(uintptr_t)node->left * 0x9E3779B97F4A7C15u;
+            hash ^= (uint64_t)(uintptr_t)node->right * 0xC2B2AE3D27D4EB4Fu;
+            break;
+    }
+
+    // Final mix so that the low bits used as the index are well spread
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDu;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/* valueBits
+ * ...Get the bit pattern of a double
+ * ...Parameters:
+ * ......double value -- value to reinterpret
+ * ...Returns:
+ * ......the 64 bits of value
+ */
+static uint64_t valueBits(double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    return bits;
+}
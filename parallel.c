@@ -0,0 +1,391 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Splits a block of input lines into chunks that worker     *
+ * threads claim one at a time, so fast workers keep taking  *
+ * work from slow ones. Each chunk collects its own output,  *
+ * which is written in chunk order once the block is done.   *
+ * A very long line is a chunk of its own, evaluated by all  *
+ * the workers together once the others are done             *
+ *************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+#include "calc.h"
+#include "readline.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Chunks per worker in one block; more chunks even out uneven lines
+#define CHUNKS_PER_THREAD 8
+
+// Smallest chunk worth handing to a worker
+#define MIN_CHUNK_SIZE (64 * 1024)
+
+// Input processed per block, bounding the memory held by chunk output
+#define MAX_BLOCK_SIZE (256 * 1024 * 1024)
+
+// Shortest line split between all the workers
+#define SPLIT_LINE_SIZE (1024 * 1024)
+
+typedef struct
+{
+    LineChunk* chunks;
+    int num_chunks;
+    int next_chunk;
+    pthread_mutex_t lock;
+    const CliOptions* opts;
+} ChunkQueue;
+
+typedef struct
+{
+    ChunkQueue* queue;
+    CalcContext ctx;
+    ResultCache cache;
+    pthread_t thread;
+} Worker;
+
+static void* workerMain(void*);
+static void appendResult(LineChunk*, CalcContext*, const CliOptions*,
+                         CalcStatus, double);
+static void reserveOutput(LineChunk*, size_t);
+static int splitBlock(const char*, const char*, size_t*, LineChunk*, int);
+
+/* evalLinesParallel
+ * ...Evaluate newline-separated expressions on several threads, writing
+ * ...one result line per input line to stdout in input order
+ * ...Parameters:
+ * ......const char* data -- input lines, each terminated by \n
+ * ......size_t size -- number of characters in data
+ * ......const CliOptions* opts -- command line options, including the
+ * ...... number of worker threads to use
+ * ......CalcStats* stats -- receives the counters of every worker
+ * ......bool* quit -- set to true if a quit line ended the input
+ * ...Returns:
+ * ......true if every line evaluated, false otherwise
+ */
+bool evalLinesParallel(const char* data, size_t size, const CliOptions* opts,
+                       CalcStats* stats, bool* quit)
+{
+    int num_threads = opts->num_threads;
+    int max_chunks = num_threads * CHUNKS_PER_THREAD;
+    LineChunk* chunks = (LineChunk *)calloc(max_chunks, sizeof(LineChunk));
+    Worker* workers = (Worker *)calloc(num_threads, sizeof(Worker));
+    CalcContext** ctxs = (CalcContext **)calloc(num_threads,
+                                                sizeof(CalcContext*));
+    ChunkQueue queue;
+    const char* block = data;
+    const char* end = data + size;
+    const char* block_end;
+    size_t block_size;
+    bool all_ok = true;
+    int num_workers;
+    double result;
+    CalcStatus status;
+
+    if (chunks == NULL || workers == NULL || ctxs == NULL)
+    {
+        printAllocError();
+        exit(EXIT_FAILURE);
+    }
+
+    *quit = false;
+    queue.chunks = chunks;
+    queue.opts = opts;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        workers[i].queue = &queue;
+        initContext(&workers[i].ctx);
+        workers[i].ctx.mode = opts->mode;
+        initCache(&workers[i].cache, opts->cache_size / num_threads);
+        if (opts->cache_size > 0)
+            workers[i].ctx.cache = &workers[i].cache;
+        ctxs[i] = &workers[i].ctx;
+    }
+
+    while (block < end && !*quit)
+    {
+        block_size = (size_t)(end - block);
+        if (block_size > MAX_BLOCK_SIZE)
+        {   // cut the block after the last complete line that fits
+            block_end = block + MAX_BLOCK_SIZE;
+            while (block_end < end && block_end[-1] != '\n')
+                block_end++;
+            block_size = (size_t)(block_end - block);
+        }
+
+        // A block with more long lines than chunks is only partly
+        // consumed; block_size is cut to the part that was
+        queue.num_chunks = splitBlock(block, end, &block_size,
+                                      chunks, max_chunks);
+        queue.next_chunk = 0;
+
+        num_workers = queue.num_chunks < num_threads ? queue.num_chunks
+                                                     : num_threads;
+        for (int i = 0; i < num_workers; i++)
+        {
+            if (pthread_create(&workers[i].thread, NULL,
+                               workerMain, &workers[i]) != 0)
+            {
+                fprintf(stderr, "Cannot start worker thread\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        for (int i = 0; i < num_workers; i++)
+            pthread_join(workers[i].thread, NULL);
+
+        for (int i = 0; i < queue.num_chunks; i++)
+        {
+            if (!chunks[i].split)
+                continue;
+
+            status = evalExpressionParallel(ctxs, num_threads,
+                                            chunks[i].begin,
+                                            chunks[i].end - chunks[i].begin
+                                            - 1, &result);
+            appendResult(&chunks[i], ctxs[0], opts, status, result);
+        }
+
+        // Write chunk output in input order, stopping at a quit line
+        for (int i = 0; i < queue.num_chunks; i++)
+        {
+            fwrite(chunks[i].out, 1, chunks[i].out_len, stdout);
+            all_ok = all_ok && chunks[i].all_ok;
+
+            if (chunks[i].quit)
+            {
+                *quit = true;
+                break;
+            }
+        }
+
+        block += block_size;
+    }
+
+    for (int i = 0; i < max_chunks; i++)
+        free(chunks[i].out);
+    for (int i = 0; i < num_threads; i++)
+    {
+        mergeStats(stats, &workers[i].ctx.stats);
+        freeContext(&workers[i].ctx);
+        freeCache(&workers[i].cache);
+    }
+
+    pthread_mutex_destroy(&queue.lock);
+    free(chunks);
+    free(workers);
+    free(ctxs);
+
+    return all_ok;
+}
+
+/* splitBlock
+ * ...Divide a block of lines into chunks of roughly equal size,
+ * ...each ending on a line boundary. A line of SPLIT_LINE_SIZE or more
+ * ...characters is put in a chunk by itself and marked split. When the
+ * ...chunks run out before the block does, the rest is left for the
+ * ...next block
+ * ...Parameters:
+ * ......const char* block -- first character of the block
+ * ......const char* end -- end of all input, bounds the line search
+ * ......size_t* block_size -- number of characters in the block, set
+ * ...... to the number put in chunks
+ * ......LineChunk* chunks -- chunk array to fill, output buffers are kept
+ * ......int max_chunks -- number of entries in chunks
+ * ...Returns:
+ * ......the number of chunks filled
+ */
+static int splitBlock(const char* block, const char* end, size_t* block_size,
+                      LineChunk* chunks, int max_chunks)
+{
+    size_t chunk_size = *block_size / max_chunks;
+    const char* block_end = block + *block_size;
+    const char* chunk = block;
+    const char* chunk_end;
+    const char* line;
+    bool split;
+    int num_chunks = 0;
+
+    if (chunk_size < MIN_CHUNK_SIZE)
+        chunk_size = MIN_CHUNK_SIZE;
+
+    while (chunk < block_end && num_chunks < max_chunks)
+    {
+        line = (const char *)memchr(chunk, '\n', block_end - chunk);
+        split = line - chunk >= SPLIT_LINE_SIZE;
+
+        if (split)
+            chunk_end = line + 1;
+        else if (num_chunks == max_chunks - 1
+                 || (size_t)(block_end - chunk) <= chunk_size)
+            chunk_end = block_end;
+        else
+        {
+            chunk_end = (const char *)memchr(chunk + chunk_size, '\n',
+                                             end - (chunk + chunk_size));
+            chunk_end = chunk_end != NULL && chunk_end < block_end
+                        ? chunk_end + 1 : block_end;
+        }
+
+        if (!split && num_chunks < max_chunks - 1)
+        {   // end the chunk before a long last line, the next one is it
+            for (line = chunk_end - 1; line > chunk && line[-1] != '\n';
+                 line--)
+                ;
+            if (line > chunk && chunk_end - 1 - line >= SPLIT_LINE_SIZE)
+                chunk_end = line;
+        }
+
+        chunks[num_chunks].begin = chunk;
+        chunks[num_chunks].end = chunk_end;
+        chunks[num_chunks].out_len = 0;
+        chunks[num_chunks].all_ok = true;
+        chunks[num_chunks].quit = false;
+        chunks[num_chunks].split = split;
+        num_chunks++;
+
+        chunk = chunk_end;
+    }
+
+    *block_size = (size_t)(chunk - block);
+
+    return num_chunks;
+}
+
+/* workerMain
+ * ...Worker thread body: claim and evaluate chunks until none are left,
+ * ...passing over split chunks
+ * ...Parameters:
+ * ......void* arg -- the Worker running on this thread
+ * ...Returns:
+ * ......NULL
+ */
+static void* workerMain(void* arg)
+{
+    Worker* worker = (Worker *)arg;
+    ChunkQueue* queue = worker->queue;
+    int chunk_dex;
+
+    while (true)
+    {
+        pthread_mutex_lock(&queue->lock);
+        chunk_dex = queue->next_chunk < queue->num_chunks
+                    ? queue->next_chunk++ : -1;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (chunk_dex == -1)
+            break;
+
+        if (!queue->chunks[chunk_dex].split)
+            evalChunk(&queue->chunks[chunk_dex], &worker->ctx, queue->opts);
+    }
+
+    return NULL;
+}
+
+/* evalChunk
+ * ...Evaluate every line in a chunk, collecting the result lines
+ * ...Parameters:
+ * ......LineChunk* chunk -- chunk to evaluate
+ * ......CalcContext* ctx -- evaluator context owned by this worker
+ * ......const CliOptions* opts -- command line options
+ * ...Returns:
+ * ......Nothing
+ */
+void evalChunk(LineChunk* chunk, CalcContext* ctx, const CliOptions* opts)
+{
+    const char* line;
+    const char* line_end;
+    size_t line_len;
+    double result;
+    CalcStatus status;
+
+    for (line = chunk->begin; line < chunk->end; line = line_end + 1)
+    {
+        line_end = (const char *)memchr(line, '\n', chunk->end - line);
+        line_len = line_end - line;
+
+        if (line_len == 4 && memcmp(line, "quit", 4) == 0)
+        {
+            chunk->quit = true;
+            break;
+        }
+
+        status = evalExpression(ctx, line, line_len, &result);
+        appendResult(chunk, ctx, opts, status, result);
+    }
+}
+
+/* appendResult
+ * ...Add the result line of one expression to a chunk's output
+ * ...Parameters:
+ * ......LineChunk* chunk -- chunk the expression came from
+ * ......CalcContext* ctx -- context that evaluated it
+ * ......const CliOptions* opts -- command line options
+ * ......CalcStatus status -- status of the evaluation
+ * ......double result -- value of the expression if status is CALC_OK
+ * ...Returns:
+ * ......Nothing
+ */
+static void appendResult(LineChunk* chunk, CalcContext* ctx,
+                         const CliOptions* opts, CalcStatus status,
+                         double result)
+{
+    STAT_START(output_start);
+
+    if (status == CALC_OK)
+    {
+        reserveOutput(chunk, RESULT_STR_SIZE + 1);
+        chunk->out_len += formatValue(opts, result,
+                                      chunk->out + chunk->out_len);
+    }
+    else
+    {
+        reserveOutput(chunk, ctx->error_len + ERROR_MESSAGE_SIZE + 1);
+        chunk->all_ok = false;
+        chunk->out_len += formatError(ctx, status,
+                                      chunk->out + chunk->out_len);
+    }
+
+    chunk->out[chunk->out_len++] = '\n';
+    STAT_PHASE(&ctx->stats, CALC_PHASE_OUTPUT, output_start);
+}
+
+/* reserveOutput
+ * ...Make room for more characters in a chunk's output buffer
+ * ...Parameters:
+ * ......LineChunk* chunk -- chunk whose output grows
+ * ......size_t extra -- number of characters about to be appended
+ * ...Returns:
+ * ......Nothing
+ */
+static void reserveOutput(LineChunk* chunk, size_t extra)
+{
+    size_t new_cap = chunk->out_cap > 0 ? chunk->out_cap : 4096;
+    char* new_out;
+
+    if (chunk->out_len + extra <= chunk->out_cap)
+        return;
+
+    while (new_cap < chunk->out_len + extra)
+        new_cap *= 2;
+
+    new_out = (char *)realloc(chunk->out, new_cap);
+    if (new_out == NULL)
+    {
+        printAllocError();
+        exit(EXIT_FAILURE);
+    }
+
+    chunk->out = new_out;
+    chunk->out_cap = new_cap;
+}
@@ -0,0 +1,34 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Multi-threaded batch evaluation of newline-separated      *
+ * expressions with output kept in input order               *
+ *************************************************************/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "cli.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A run of complete lines and the result lines collected for them
+typedef struct
+{
+    const char* begin;
+    const char* end;
+    char* out;
+    size_t out_len;
+    size_t out_cap;
+    bool all_ok;
+    bool quit;  // a quit line ended this chunk early
+    bool split; // one long line, left to evalExpressionParallel
+} LineChunk;
+
+void evalChunk(LineChunk* chunk, CalcContext* ctx, const CliOptions* opts);
+bool evalLinesParallel(const char* data, size_t size, const CliOptions* opts,
+                       CalcStats* stats, bool* quit);
+
+#endif // PARALLEL_H
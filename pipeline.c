@@ -0,0 +1,487 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Runs batch mode as three stages on their own threads: a   *
+ * reader filling blocks of lines, evaluators turning them   *
+ * into result lines and a writer emitting them in order.    *
+ * Stages pass blocks through lock-free single-producer      *
+ * single-consumer rings, and a fixed pool of blocks stalls  *
+ * the reader when the later stages fall behind              *
+ *************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "pipeline.h"
+#include "parallel.h"
+#include "calc.h"
+#include "readline.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Input buffer of a block at first; a longer line grows it
+#define PIPE_BLOCK_SIZE (1024 * 1024)
+
+// Blocks in the pool per evaluator, bounding the input waiting to be
+// evaluated and the output waiting to be written
+#define PIPE_BLOCKS_PER_EVALUATOR 4
+
+// A stage waiting on a ring yields this many times, then sleeps for
+// doubling times up to PIPE_MAX_SLEEP_NS
+#define PIPE_YIELDS 64
+#define PIPE_MIN_SLEEP_NS 1000L
+#define PIPE_MAX_SLEEP_NS 1000000L
+
+// Keeps the two ends of a ring on separate cache lines
+#define CACHE_LINE_SIZE 64
+
+typedef struct
+{
+    LineChunk chunk; // the lines held in in, and their result lines
+    char* in;
+    size_t in_cap;
+} PipeBlock;
+
+// Ring of blocks with one producer and one consumer. Only the producer
+// writes tail and only the consumer writes head, so neither side locks
+typedef struct
+{
+    PipeBlock** slots;
+    size_t mask; // capacity - 1, a power of two
+    size_t tail; // blocks pushed
+    char pad[CACHE_LINE_SIZE - sizeof(size_t)];
+    size_t head; // blocks popped
+} BlockRing;
+
+typedef struct
+{
+    int fd;
+    int num_evaluators;
+    BlockRing free_ring; // writer to reader: empty blocks
+    BlockRing* in_rings; // reader to each evaluator: blocks of lines
+    BlockRing* out_rings; // each evaluator to writer: evaluated blocks
+    int stop; // set once a quit line has been written
+    const CliOptions* opts;
+} Pipeline;
+
+typedef struct
+{
+    Pipeline* pipeline;
+    BlockRing* in;
+    BlockRing* out;
+    CalcContext ctx;
+    ResultCache cache;
+    pthread_t thread;
+} Evaluator;
+
+// Pushed after the last block to tell a stage its input has ended
+static PipeBlock end_block;
+
+static void* readerMain(void*);
+static void* evaluatorMain(void*);
+static void sendBlock(Pipeline*, PipeBlock*, size_t, size_t);
+static void reserveInput(PipeBlock*, size_t);
+static bool initRing(BlockRing*, size_t);
+static void pushBlock(BlockRing*, PipeBlock*);
+static PipeBlock* popBlock(BlockRing*, const int*);
+static void backoff(unsigned*);
+
+/* runPipeline
+ * ...Evaluate expressions read from a file descriptor, one per line, with
+ * ...reading, evaluation and writing overlapped. Blocks of lines are
+ * ...handed to the evaluator threads in turn and their results are
+ * ...written to stdout in input order from the calling thread
+ * ...Parameters:
+ * ......int fd -- input with one expression per line
+ * ......CalcStats* stats -- receives the counters of every evaluator
+ * ......const CliOptions* opts -- command line options, num_threads is
+ * ...... the number of evaluator threads
+ * ...Returns:
+ * ......EXIT_SUCCESS if every line evaluated, EXIT_FAILURE otherwise
+ */
+int runPipeline(int fd, CalcStats* stats, const CliOptions* opts)
+{
+    static char out_buf[1 << 16];
+    int num_evaluators = opts->num_threads;
+    size_t num_blocks = PIPE_BLOCKS_PER_EVALUATOR * num_evaluators + 2;
+    PipeBlock* blocks = (PipeBlock *)calloc(num_blocks, sizeof(PipeBlock));
+    Evaluator* evaluators = (Evaluator *)calloc(num_evaluators,
+                                                sizeof(Evaluator));
+    Pipeline pipeline;
+    PipeBlock* block;
+    pthread_t reader;
+    bool all_ok = true;
+    bool quit = false;
+    bool rings_ok;
+
+    pipeline.fd = fd;
+    pipeline.num_evaluators = num_evaluators;
+    pipeline.stop = 0;
+    pipeline.opts = opts;
+    pipeline.in_rings = (BlockRing *)calloc(num_evaluators,
+                                            sizeof(BlockRing));
+    pipeline.out_rings = (BlockRing *)calloc(num_evaluators,
+                                             sizeof(BlockRing));
+
+    // Rings have room for every block and the end markers, so only the
+    // free ring ever makes a stage wait
+    rings_ok = initRing(&pipeline.free_ring, num_blocks);
+    for (int i = 0; rings_ok && i < num_evaluators; i++)
+    {
+        rings_ok = initRing(&pipeline.in_rings[i], num_blocks + 2)
+                   && initRing(&pipeline.out_rings[i], num_blocks + 1);
+    }
+
+    if (blocks == NULL || evaluators == NULL || pipeline.in_rings == NULL
+        || pipeline.out_rings == NULL || !rings_ok)
+    {
+        printAllocError();
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+        reserveInput(&blocks[i], PIPE_BLOCK_SIZE);
+        pushBlock(&pipeline.free_ring, &blocks[i]);
+    }
+
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    for (int i = 0; i < num_evaluators; i++)
+    {
+        evaluators[i].pipeline = &pipeline;
+        evaluators[i].in = &pipeline.in_rings[i];
+        evaluators[i].out = &pipeline.out_rings[i];
+        initContext(&evaluators[i].ctx);
+        evaluators[i].ctx.mode = opts->mode;
+        initCache(&evaluators[i].cache, opts->cache_size / num_evaluators);
+        if (opts->cache_size > 0)
+            evaluators[i].ctx.cache = &evaluators[i].cache;
+
+        if (pthread_create(&evaluators[i].thread, NULL, evaluatorMain,
+                           &evaluators[i]) != 0)
+        {
+            fprintf(stderr, "Cannot start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (pthread_create(&reader, NULL, readerMain, &pipeline) != 0)
+    {
+        fprintf(stderr, "Cannot start worker thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Blocks were handed out in turn, so take them back in the same turn
+    for (size_t seq = 0; !quit; seq++)
+    {
+        block = popBlock(&pipeline.out_rings[seq % num_evaluators], NULL);
+        if (block == &end_block)
+            break;
+
+        fwrite(block->chunk.out, 1, block->chunk.out_len, stdout);
+        all_ok = all_ok && block->chunk.all_ok;
+        if (block->chunk.quit)
+        {
+            quit = true;
+            __atomic_store_n(&pipeline.stop, 1, __ATOMIC_RELEASE);
+        }
+
+        pushBlock(&pipeline.free_ring, block);
+    }
+    fflush(stdout);
+
+    // After a quit line the reader may be blocked reading input that
+    // never comes; once it is gone the evaluators are told to finish
+    if (quit)
+        pthread_cancel(reader);
+    pthread_join(reader, NULL);
+    for (int i = 0; i < num_evaluators; i++)
+        pushBlock(&pipeline.in_rings[i], &end_block);
+
+    for (int i = 0; i < num_evaluators; i++)
+    {
+        pthread_join(evaluators[i].thread, NULL);
+        mergeStats(stats, &evaluators[i].ctx.stats);
+        freeContext(&evaluators[i].ctx);
+        freeCache(&evaluators[i].cache);
+        free(pipeline.in_rings[i].slots);
+        free(pipeline.out_rings[i].slots);
+    }
+
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+        free(blocks[i].in);
+        free(blocks[i].chunk.out);
+    }
+
+    free(pipeline.free_ring.slots);
+    free(pipeline.in_rings);
+    free(pipeline.out_rings);
+    free(evaluators);
+    free(blocks);
+
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* readerMain
+ * ...Reader thread body: fill blocks from the input and send each one
+ * ...on as soon as it holds a complete line. The unfinished line at
+ * ...the end of a read moves to the next block. Stops at the end of the
+ * ...input, or when the writer has seen a quit line
+ * ...Parameters:
+ * ......void* arg -- the Pipeline
+ * ...Returns:
+ * ......NULL
+ */
+static void* readerMain(void* arg)
+{
+    Pipeline* pipeline = (Pipeline *)arg;
+    PipeBlock* block = popBlock(&pipeline->free_ring, &pipeline->stop);
+    PipeBlock* next;
+    size_t len = 0; // characters in block->in
+    size_t line_end;
+    size_t seq = 0;
+    ssize_t num_read;
+
+    while (block != NULL
+           && !__atomic_load_n(&pipeline->stop, __ATOMIC_ACQUIRE))
+    {
+        if (len == block->in_cap)
+            reserveInput(block, len + 1); // a line longer than the block
+
+        num_read = read(pipeline->fd, block->in + len, block->in_cap - len);
+        if (num_read < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error reading input!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (num_read == 0)
+        {
+            if (len > 0 && block->in[len - 1] != '\n')
+            {   // terminate the last line
+                reserveInput(block, len + 1);
+                block->in[len++] = '\n';
+            }
+            if (len > 0)
+                sendBlock(pipeline, block, len, seq++);
+            break;
+        }
+
+        for (line_end = len + num_read; line_end > len; line_end--)
+        {
+            if (block->in[line_end - 1] == '\n')
+                break;
+        }
+        len += num_read;
+        if (line_end == 0 || block->in[line_end - 1] != '\n')
+            continue; // no complete line yet
+
+        next = popBlock(&pipeline->free_ring, &pipeline->stop);
+        if (next == NULL)
+            break;
+
+        reserveInput(next, len - line_end);
+        memcpy(next->in, block->in + line_end, len - line_end);
+        sendBlock(pipeline, block, line_end, seq++);
+        block = next;
+        len -= line_end;
+    }
+
+    for (int i = 0; i < pipeline->num_evaluators; i++)
+        pushBlock(&pipeline->in_rings[i], &end_block);
+
+    return NULL;
+}
+
+/* evaluatorMain
+ * ...Evaluator thread body: evaluate every block from the reader and pass
+ * ...it to the writer, until the end marker arrives. Once a quit line
+ * ...has been written, blocks are passed on without being evaluated
+ * ...Parameters:
+ * ......void* arg -- the Evaluator running on this thread
+ * ...Returns:
+ * ......NULL
+ */
+static void* evaluatorMain(void* arg)
+{
+    Evaluator* ev = (Evaluator *)arg;
+    PipeBlock* block;
+
+    while ((block = popBlock(ev->in, NULL)) != &end_block)
+    {
+        if (!__atomic_load_n(&ev->pipeline->stop, __ATOMIC_ACQUIRE))
+            evalChunk(&block->chunk, &ev->ctx, ev->pipeline->opts);
+        pushBlock(ev->out, block);
+    }
+
+    pushBlock(ev->out, &end_block);
+
+    return NULL;
+}
+
+/* sendBlock
+ * ...Hand a block of complete lines to the evaluator whose turn it is
+ * ...Parameters:
+ * ......Pipeline* pipeline -- the pipeline
+ * ......PipeBlock* block -- block to send
+ * ......size_t len -- characters of lines in block->in, the last one \n
+ * ......size_t seq -- number of blocks sent before this one
+ * ...Returns:
+ * ......Nothing
+ */
+static void sendBlock(Pipeline* pipeline, PipeBlock* block, size_t len,
+                      size_t seq)
+{
+    block->chunk.begin = block->in;
+    block->chunk.end = block->in + len;
+    block->chunk.out_len = 0;
+    block->chunk.all_ok = true;
+    block->chunk.quit = false;
+    block->chunk.split = false;
+
+    pushBlock(&pipeline->in_rings[seq % pipeline->num_evaluators], block);
+}
+
+/* reserveInput
+ * ...Make room for at least size characters in a block's input buffer
+ * ...Parameters:
+ * ......PipeBlock* block -- block whose input grows
+ * ......size_t size -- characters needed
+ * ...Returns:
+ * ......Nothing
+ */
+static void reserveInput(PipeBlock* block, size_t size)
+{
+    size_t new_cap = block->in_cap > 0 ? block->in_cap : PIPE_BLOCK_SIZE;
+    char* new_in;
+
+    if (size <= block->in_cap)
+        return;
+
+    while (new_cap < size)
+        new_cap *= 2;
+
+    new_in = (char *)realloc(block->in, new_cap);
+    if (new_in == NULL)
+    {
+        printAllocError();
+        exit(EXIT_FAILURE);
+    }
+
+    block->in = new_in;
+    block->in_cap = new_cap;
+}
+
+/* initRing
+ * ...Create an empty ring
+ * ...Parameters:
+ * ......BlockRing* ring -- ring to set up
+ * ......size_t count -- blocks it must hold at once
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+static bool initRing(BlockRing* ring, size_t count)
+{
+    size_t capacity = 1;
+
+    while (capacity < count)
+        capacity *= 2;
+
+    ring->slots = (PipeBlock **)malloc(sizeof(PipeBlock*) * capacity);
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return ring->slots != NULL;
+}
+
+/* pushBlock
+ * ...Add a block to a ring, waiting while it is full. Called only by the
+ * ...ring's producer
+ * ...Parameters:
+ * ......BlockRing* ring -- ring to add to
+ * ......PipeBlock* block -- block to add
+ * ...Returns:
+ * ......Nothing
+ */
+static void pushBlock(BlockRing* ring, PipeBlock* block)
+{
+    size_t tail = ring->tail;
+    unsigned spins = 0;
+
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask)
+        backoff(&spins);
+
+    ring->slots[tail & ring->mask] = block;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* popBlock
+ * ...Take the oldest block from a ring, waiting while it is empty. Called
+ * ...only by the ring's consumer
+ * ...Parameters:
+ * ......BlockRing* ring -- ring to take from
+ * ......const int* stop -- flag that ends the wait when set, NULL to
+ * ...... wait for a block however long it takes
+ * ...Returns:
+ * ......the block, NULL if stop was set while the ring was empty
+ */
+static PipeBlock* popBlock(BlockRing* ring, const int* stop)
+{
+    size_t head = ring->head;
+    unsigned spins = 0;
+    PipeBlock* block;
+
+    while (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+    {
+        if (stop != NULL && __atomic_load_n(stop, __ATOMIC_ACQUIRE))
+            return NULL;
+        backoff(&spins);
+    }
+
+    block = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return block;
+}
+
+/* backoff
+ * ...Wait a little before looking at a ring again: first by yielding the
+ * ...processor, then by sleeping, so a stage waiting on slow input does
+ * ...not keep a core busy
+ * ...Parameters:
+ * ......unsigned* spins -- times this wait has already backed off
+ * ...Returns:
+ * ......Nothing
+ */
+static void backoff(unsigned* spins)
+{
+    struct timespec pause = {0, PIPE_MIN_SLEEP_NS};
+
+    if (*spins < PIPE_YIELDS)
+        sched_yield();
+    else
+    {
+        for (unsigned i = PIPE_YIELDS; i < *spins
+                                       && pause.tv_nsec < PIPE_MAX_SLEEP_NS;
+             i++)
+            pause.tv_nsec *= 2;
+        if (pause.tv_nsec > PIPE_MAX_SLEEP_NS)
+            pause.tv_nsec = PIPE_MAX_SLEEP_NS;
+        nanosleep(&pause, NULL);
+    }
+
+    (*spins)++;
+}
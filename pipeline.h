@@ -0,0 +1,16 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Batch evaluation as a pipeline of reader, evaluator and   *
+ * writer threads, so input and output overlap evaluation    *
+ *************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "cli.h"
+
+int runPipeline(int fd, CalcStats* stats, const CliOptions* opts);
+
+#endif // PIPELINE_H
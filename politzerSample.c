@@ -6,159 +6,286 @@
  * input string and outputs the result                       *
  *************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc.h"
+#include "cli.h"
+#include "csv.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "readline.h"
+#include "report.h"
+#include "server.h"
+#include "stats.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <math.h>
+#include <stdint.h>
 #include <ctype.h>
-#include <float.h>
-
-char* readline();
-bool validOperand(const char*);
-bool validOperator(const char* str);
-int indexOfOp(const char*, char, int);
-double applyOp(double, double, char);
-void printResult(double);
-void printAllocError();
-
-/* evalExpression
- * ...Evaluate mathematical expression
- * ...Parameters:
- * ......char* exp -- string containing expression
- * ......double* result -- memory location to store result
- * ...Returns:
- * ......boolean true if sucessful, false otherwise
- * ...... answer is written to result if sucessful, 0.0 otherwise
- */
-bool evalExpression(char* exp, double* result)
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Output buffer for batch mode, flushed only when full or at exit
+#define BATCH_OUT_SIZE (1 << 16)
+
+// Initial stdin read size for multi-threaded batch mode
+#define PARALLEL_READ_SIZE (16 * 1024 * 1024)
+
+// Input read per piece in stream mode; memory use does not depend on
+// the length of a line
+#define STREAM_READ_SIZE (1 << 16)
+
+void printResult(double, const CliOptions*);
+void printError(const CalcContext*, CalcStatus);
+void emitResult(CalcContext*, CalcStatus, double, const CliOptions*);
+int runOneShot(const char*, CalcContext*, const CliOptions*);
+int runBatch(CalcContext*, const CliOptions*);
+int runBatchParallel(CalcContext*, const CliOptions*);
+int runMappedFile(const char*, CalcContext*, const CliOptions*);
+int runStream(FILE*, CalcContext*, const CliOptions*);
+int runBinary(FILE*, CalcContext*);
+void reportStats(CalcContext*, const CliOptions*, const struct timespec*);
+bool parseSize(const char*, size_t*);
+bool parseMode(const char*, CalcMode*);
+bool parsePrecision(const char*, int*);
+
+int main(int argc, char* argv[])
 {
-    double* operands = NULL;
-    char* operators = NULL;
-    bool* evaluated = NULL;
-
-    int num_operands = 0;
-    int num_operators = 0;
-
-    bool parse_operand = true;
-    bool error_occurred = false;
-
-    char order_of_ops[] = {'*', '/', '+', '-'};
-    char op_curr;
-    int op_dex;
-    double temp_val;
-
-    char* token = strtok(exp, " ");
-
-    // First, parse the string for the expression to be evaluated
-    while(token != NULL)
+    char* input_str;
+    double result;
+    bool batch = !isatty(fileno(stdin)); // piped input defaults to batch
+    bool stream = false;
+    bool pipelined = false;
+    int pipeline_fd;
+    const char* file_path = NULL;
+    const char* csv_formula = NULL;
+    const char* one_shot = NULL;
+    const char* serve_addrs[MAX_LISTENERS];
+    int num_serve = 0;
+    FILE* stream_in;
+    CalcContext ctx;
+    ResultCache cache;
+    CalcStatus status;
+    int exit_status;
+    CliOptions opts = {1, -1, STATS_NONE, 0, false, CALC_MODE_DOUBLE};
+    struct timespec start_time;
+
+    for (int i = 1; i < argc; i++)
     {
-        if (parse_operand)
+        if (strcmp(argv[i], "--batch") == 0)
+            batch = true;
+        else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+            file_path = argv[++i];
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+            one_shot = argv[++i];
+        else if (strcmp(argv[i], "--interactive") == 0)
+            batch = false;
+        else if (strcmp(argv[i], "--stream") == 0)
+            stream = true;
+        else if (strcmp(argv[i], "--pipeline") == 0)
+            pipelined = true;
+        else if (strcmp(argv[i], "--binary") == 0)
+            opts.binary = true;
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+            csv_formula = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
         {
-            if (!validOperand(token))
+            if (num_serve == MAX_LISTENERS)
             {
-                printf("Invalid operand: %s\n", token);
-                error_occurred = true;
-                break;
+                fprintf(stderr, "At most %d --serve addresses\n",
+                        MAX_LISTENERS);
+                return EXIT_FAILURE;
             }
-            operands = (double * )realloc(operands,
-                                          sizeof(double) * ++num_operands);
-            if (operands == NULL)
+            serve_addrs[num_serve++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            opts.num_threads = atoi(argv[++i]);
+            if (opts.num_threads < 1)
             {
-                printAllocError();
-                exit(EXIT_FAILURE);
+                fprintf(stderr, "Invalid thread count: %s\n", argv[i]);
+                return EXIT_FAILURE;
             }
-
-            operands[num_operands - 1] = atof(token);
         }
-        else // parsing operator
+        else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc)
         {
-            if (!validOperator(token))
+            if (!parsePrecision(argv[++i], &opts.precision))
             {
-                printf("Invalid operator: %s\n", token);
-                error_occurred = true;
-                break;
+                fprintf(stderr, "Invalid precision: %s\n", argv[i]);
+                return EXIT_FAILURE;
             }
-            operators = (char *)realloc(operators,
-                                        sizeof(char) * ++num_operators);
-            if (operators == NULL)
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            if (!parseSize(argv[++i], &opts.cache_size))
             {
-                printAllocError();
-                exit(EXIT_FAILURE);
+                fprintf(stderr, "Invalid cache size: %s\n", argv[i]);
+                return EXIT_FAILURE;
             }
-
-            operators[num_operators - 1] = (char)token[0];
         }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            if (!parseMode(argv[++i], &opts.mode))
+            {
+                fprintf(stderr, "Invalid mode: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+            opts.stats = STATS_TEXT;
+        else if (strcmp(argv[i], "--stats-json") == 0)
+            opts.stats = STATS_JSON;
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            fprintf(stderr, "Usage: %s [-e EXPR | --batch | "
+                            "--interactive | --file PATH | --serve ADDR] "
+                            "[--stream | --binary | --pipeline | "
+                            "--csv FORMULA] "
+                            "[-j N] [--precision N] [--cache SIZE] "
+                            "[--mode double|compensated|exact] "
+                            "[--stats | --stats-json]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-        token = strtok(NULL, " ");
-        parse_operand = !parse_operand;
+#ifndef CALC_STATS
+    if (opts.stats != STATS_NONE)
+    {
+        fprintf(stderr, "Statistics are not built in, "
+                        "rebuild with make STATS=1\n");
+        return EXIT_FAILURE;
     }
+#endif
 
-    // If parse was successful, check for extra operator
-    if (!error_occurred && num_operands - num_operators != 1)
+    if (stream && opts.binary)
     {
-        printf("Missing last operand\n");
-        error_occurred = true;
+        fprintf(stderr, "--stream reads text, it cannot be combined "
+                        "with --binary\n");
+        return EXIT_FAILURE;
     }
 
-    evaluated = (bool *)calloc(num_operands, sizeof(bool));
-    if (evaluated == NULL)
+    if (pipelined && (stream || opts.binary))
     {
-        printAllocError();
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "--pipeline cannot be combined with --stream "
+                        "or --binary\n");
+        return EXIT_FAILURE;
     }
 
-    if (!error_occurred)
-    {   // Everything is good, proceed to evaluate the expression
-        for (int i = 0; i < 4; i++)
-        {
-            op_curr = order_of_ops[i]; // evaluate according to order of ops
-            while((op_dex = indexOfOp(operators, op_curr, num_operators)) != -1)
-            {
-                temp_val = applyOp(operands[op_dex],
-                                   operands[op_dex + 1], op_curr);
-
-                if (temp_val == DBL_MAX)
-                {
-                    printf("Divide by zero error\n");
-                    error_occurred = true;
-                    break;
-                }
-
-                evaluated[op_dex] = true;
-                evaluated[op_dex + 1] = true;
-
-                for (int j = 0; j < num_operands; j++)
-                {
-                    if (evaluated[j])
-                        operands[j] = temp_val;
-                }
-
-                operators[op_dex] = 0; // operation completed, prevent repeats
-            }
-            if (error_occurred)
-                break;
-        }
+    if (csv_formula != NULL && (stream || opts.binary || pipelined))
+    {
+        fprintf(stderr, "--csv cannot be combined with --stream, "
+                        "--binary or --pipeline\n");
+        return EXIT_FAILURE;
+    }
 
-        *result = error_occurred ? 0.0 : operands[0];
+    if (one_shot != NULL && (file_path != NULL || num_serve > 0 || stream
+                             || opts.binary || pipelined
+                             || csv_formula != NULL))
+    {
+        fprintf(stderr, "-e evaluates its argument, it cannot be combined "
+                        "with another input mode\n");
+        return EXIT_FAILURE;
     }
 
-    free(operands);
-    free(operators);
-    free(evaluated);
+    if (csv_formula != NULL && opts.mode != CALC_MODE_DOUBLE)
+    {
+        fprintf(stderr, "--csv evaluates compiled formulas, which use "
+                        "double mode only\n");
+        return EXIT_FAILURE;
+    }
 
-    return !error_occurred;
-}
+    initContext(&ctx);
+    ctx.mode = opts.mode;
+    initCache(&cache, opts.cache_size);
+    if (opts.cache_size > 0)
+        ctx.cache = &cache;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-int main()
-{
-    char* input_str;
-    double result;
+    if (one_shot != NULL)
+    {
+        exit_status = runOneShot(one_shot, &ctx, &opts);
+        reportStats(&ctx, &opts, &start_time);
+        freeContext(&ctx);
+        freeCache(&cache);
+        return exit_status;
+    }
+
+    if (num_serve > 0)
+    {
+        exit_status = runServer(serve_addrs, num_serve, &opts, &ctx.stats);
+        reportStats(&ctx, &opts, &start_time);
+        freeContext(&ctx);
+        freeCache(&cache);
+        return exit_status;
+    }
+
+    if (csv_formula != NULL || stream || opts.binary)
+    {
+        stream_in = file_path != NULL ? fopen(file_path, "rb") : stdin;
+        if (stream_in == NULL)
+        {
+            fprintf(stderr, "Cannot open %s\n", file_path);
+            exit_status = EXIT_FAILURE;
+        }
+        else if (csv_formula != NULL)
+            exit_status = runCsv(stream_in, csv_formula, &ctx, &opts);
+        else if (opts.binary)
+            exit_status = runBinary(stream_in, &ctx);
+        else
+            exit_status = runStream(stream_in, &ctx, &opts);
+
+        if (stream_in != NULL && stream_in != stdin)
+            fclose(stream_in);
+        reportStats(&ctx, &opts, &start_time);
+        freeContext(&ctx);
+        freeCache(&cache);
+        return exit_status;
+    }
+
+    if (pipelined)
+    {
+        pipeline_fd = file_path != NULL ? open(file_path, O_RDONLY)
+                                        : STDIN_FILENO;
+        if (pipeline_fd < 0)
+        {
+            fprintf(stderr, "Cannot open %s\n", file_path);
+            exit_status = EXIT_FAILURE;
+        }
+        else
+            exit_status = runPipeline(pipeline_fd, &ctx.stats, &opts);
+
+        if (pipeline_fd >= 0 && pipeline_fd != STDIN_FILENO)
+            close(pipeline_fd);
+        reportStats(&ctx, &opts, &start_time);
+        freeContext(&ctx);
+        freeCache(&cache);
+        return exit_status;
+    }
+
+    if (file_path != NULL || batch)
+    {
+        exit_status = file_path != NULL
+                      ? runMappedFile(file_path, &ctx, &opts)
+                      : runBatch(&ctx, &opts);
+        reportStats(&ctx, &opts, &start_time);
+        freeContext(&ctx);
+        freeCache(&cache);
+        return exit_status;
+    }
 
     printf("Enter an expression to be evaluated!\n");
-    printf("Valid operators are + - * /\n");
-    printf("Valid operands are integers or floating point numbers.\n");
-    printf("Operands and operators must be space-separated.\n");
+    printf("Valid operators are + - * / %% ^, and parentheses group.\n");
+    printf("Functions are sqrt(x), log(x), min(a, b) and max(a, b).\n");
+    printf("Valid operands are integers or floating point numbers,\n");
+    printf("optionally signed and with an exponent, like -2.5 or 1e-3.\n");
+    printf("Spaces between operands and operators are optional.\n");
     printf("Type quit and hit enter when you are finished.\n");
 
     while (true)
@@ -166,214 +293,608 @@ int main()
         printf("\nInput expression: ");
         input_str = readline();
 
+        if (input_str == NULL)
+        {
+            printf("Error reading from stdin!\n");
+            exit(EXIT_FAILURE);
+        }
+
         if (strcmp(input_str, "quit") == 0)
+        {
+            free(input_str);
             break;
+        }
 
-        if (evalExpression(input_str, &result))
-            printResult(result);
+        status = evalExpression(&ctx, input_str, strlen(input_str), &result);
+        STAT_START(output_start);
+        if (status == CALC_OK)
+            printResult(result, &opts);
+        else
+            printError(&ctx, status);
+        STAT_PHASE(&ctx.stats, CALC_PHASE_OUTPUT, output_start);
 
         free(input_str);
     }
 
+    reportStats(&ctx, &opts, &start_time);
+    freeContext(&ctx);
+    freeCache(&cache);
     printf("Goodbye!\n");
 
     return 0;
 }
 
-/* readLine
- * ...Read a line from stdin, allocating the necessary memory
+/* printError
+ * ...Print the reason an expression failed to stdout
+ * ...Parameters:
+ * ......const CalcContext* ctx -- context the expression was evaluated in
+ * ......CalcStatus status -- code returned by evalExpression
+ * ...Returns:
+ * ......Nothing
+ */
+void printError(const CalcContext* ctx, CalcStatus status)
+{
+    fputs(statusMessage(status), stdout);
+    if (ctx->error_token != NULL)
+    {
+        fputs(": ", stdout);
+        fwrite(ctx->error_token, 1, ctx->error_len, stdout);
+    }
+    putchar('\n');
+}
+
+/* emitResult
+ * ...Write one batch output line for an evaluated expression
+ * ...Parameters:
+ * ......CalcContext* ctx -- context the expression was evaluated in,
+ * ...... its stats receive the time spent on output
+ * ......CalcStatus status -- code returned by evalExpression
+ * ......double result -- value to write when status is CALC_OK
+ * ......const CliOptions* opts -- command line options
  * ...Returns:
- * ......char* line_data -- pointer to read in characters
+ * ......Nothing
  */
-char* readline()
+void emitResult(CalcContext* ctx, CalcStatus status, double result,
+                const CliOptions* opts)
 {
-    size_t alloc_size = 128;
-    size_t num_char = 0;
-    char* line_data = (char *)malloc(alloc_size);
-    char* cursor;
-    char* temp_line_data;
+    char result_str[RESULT_STR_SIZE + 1];
+    size_t len;
+    STAT_START(output_start);
 
-    if (line_data == NULL)
+    if (status != CALC_OK)
+        printError(ctx, status);
+    else
     {
-        printAllocError();
-        exit(EXIT_FAILURE);
+        len = formatValue(opts, result, result_str);
+        result_str[len++] = '\n';
+        fwrite(result_str, 1, len, stdout);
     }
 
-    while(true)
-    {
-        cursor = line_data + num_char;
-        temp_line_data = fgets(cursor, alloc_size - num_char, stdin);
+    STAT_PHASE(&ctx->stats, CALC_PHASE_OUTPUT, output_start);
+}
 
-        if (temp_line_data == NULL)
+/* runOneShot
+ * ...Evaluate one expression from the command line and write its result
+ * ...or error message as a single line, without the banner or prompt
+ * ...Parameters:
+ * ......const char* exp -- the expression
+ * ......CalcContext* ctx -- evaluator context
+ * ......const CliOptions* opts -- command line options
+ * ...Returns:
+ * ......EXIT_SUCCESS if the expression evaluated, EXIT_FAILURE otherwise
+ */
+int runOneShot(const char* exp, CalcContext* ctx, const CliOptions* opts)
+{
+    char result_str[RESULT_STR_SIZE + 1];
+    char* line = result_str;
+    size_t len;
+    double result;
+    CalcStatus status = evalExpression(ctx, exp, strlen(exp), &result);
+    STAT_START(output_start);
+
+    if (status == CALC_OK)
+        len = formatValue(opts, result, result_str);
+    else
+    {   // room for the token, the message and the \n
+        line = (char *)malloc(ctx->error_len + ERROR_MESSAGE_SIZE + 1);
+        if (line == NULL)
         {
-            printf("Error reading from stdin!\n");
+            printAllocError();
             exit(EXIT_FAILURE);
         }
+        len = formatError(ctx, status, line);
+    }
+    line[len++] = '\n';
+    fwrite(line, 1, len, stdout);
+    fflush(stdout);
 
-        num_char += strlen(cursor);
+    if (line != result_str)
+        free(line);
+    STAT_PHASE(&ctx->stats, CALC_PHASE_OUTPUT, output_start);
 
-        if (num_char < alloc_size - 1 || line_data[num_char - 1] == '\n')
-            break;
+    return status == CALC_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-        alloc_size += 128;
+/* runBatch
+ * ...Evaluate expressions from stdin, one per line, without prompts
+ * ...Only results (or error messages) are written, one line per input,
+ * ...through a single large stdout buffer
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context shared by every line
+ * ......const CliOptions* opts -- command line options
+ * ...Returns:
+ * ......EXIT_SUCCESS if every line evaluated, EXIT_FAILURE otherwise
+ */
+int runBatch(CalcContext* ctx, const CliOptions* opts)
+{
+    static char out_buf[BATCH_OUT_SIZE];
+    char* input_str;
+    double result;
+    CalcStatus status;
+    bool all_ok = true;
+
+    if (opts->num_threads > 1)
+        return runBatchParallel(ctx, opts);
 
-        line_data = (char *)realloc(line_data, alloc_size);
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
 
-        if (line_data == NULL)
+    while ((input_str = readline()) != NULL)
+    {
+        if (strcmp(input_str, "quit") == 0)
         {
-            printAllocError();
-            exit(EXIT_FAILURE);
+            free(input_str);
+            break;
         }
-    }
 
-    if (line_data[num_char - 1] == '\n')
-        line_data[num_char - 1] = '\0';
+        status = evalExpression(ctx, input_str, strlen(input_str), &result);
+        emitResult(ctx, status, result, opts);
+        all_ok = all_ok && status == CALC_OK;
 
-    line_data = (char *)realloc(line_data, num_char);
+        free(input_str);
+    }
+
+    fflush(stdout);
 
-    return line_data;
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-/* validOperand
- * ...Check if given string only contains numbers
- * ...and no more than one decimal char
+/* runBatchParallel
+ * ...Evaluate expressions from stdin on several threads. Input is read
+ * ...in large blocks and each block's complete lines are evaluated in
+ * ...parallel, with results written in input order
  * ...Parameters:
- * ......const char* str -- string to validate
+ * ......CalcContext* ctx -- its stats receive the workers' counters
+ * ......const CliOptions* opts -- command line options
  * ...Returns:
- * ......true if given string only contains numbers and
- * ...... no more than one decimal char, false otherwise
+ * ......EXIT_SUCCESS if every line evaluated, EXIT_FAILURE otherwise
  */
-bool validOperand(const char* str)
+int runBatchParallel(CalcContext* ctx, const CliOptions* opts)
 {
-    unsigned int num_dec =  0;
+    static char out_buf[BATCH_OUT_SIZE];
+    size_t alloc_size = PARALLEL_READ_SIZE;
+    size_t num_char = 0;
+    size_t num_read;
+    size_t lines_len;
+    char* data = (char *)malloc(alloc_size);
+    char* temp_data;
+    bool at_eof = false;
+    bool quit = false;
+    bool all_ok = true;
+
+    if (data == NULL)
+    {
+        printAllocError();
+        exit(EXIT_FAILURE);
+    }
 
-    while (*str)
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    while (!at_eof && !quit)
     {
-        if (isdigit(*str) == 0
-            && *str != '.')
-            return false;
+        num_read = fread(data + num_char, 1, alloc_size - num_char, stdin);
+        num_char += num_read;
 
-        else if (*str == '.')
-            num_dec++;
+        if (num_read == 0)
+        {
+            if (ferror(stdin))
+            {
+                fprintf(stderr, "Error reading from stdin!\n");
+                exit(EXIT_FAILURE);
+            }
+
+            at_eof = true;
+            if (num_char > 0 && data[num_char - 1] != '\n')
+                data[num_char++] = '\n'; // terminate the last line
+        }
+
+        lines_len = num_char;
+        while (lines_len > 0 && data[lines_len - 1] != '\n')
+            lines_len--;
+
+        if (lines_len > 0)
+        {
+            all_ok = evalLinesParallel(data, lines_len, opts, &ctx->stats,
+                                       &quit)
+                     && all_ok;
+            memmove(data, data + lines_len, num_char - lines_len);
+            num_char -= lines_len;
+        }
 
-        str++;
+        if (num_char + 1 >= alloc_size)
+        {   // a single line fills the buffer, keep room for the \n
+            alloc_size *= 2;
+            temp_data = (char *)realloc(data, alloc_size);
+            if (temp_data == NULL)
+            {
+                printAllocError();
+                exit(EXIT_FAILURE);
+            }
+            data = temp_data;
+        }
     }
 
-    return num_dec <= 1;
+    fflush(stdout);
+    free(data);
+
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-/* validOperator
- * ...Check if given string is a valid operator
+/* runMappedFile
+ * ...Evaluate every line of a file in batch mode, reading it through a
+ * ...read-only memory mapping so expressions are tokenized in place
  * ...Parameters:
- * ......const char* str -- string to validate
+ * ......const char* path -- file containing one expression per line
+ * ......CalcContext* ctx -- evaluator context shared by every line
+ * ......const CliOptions* opts -- command line options
  * ...Returns:
- * ......true if given string consists of only one char and
- * ...... that char is +, -, *, or /, false otherwise
+ * ......EXIT_SUCCESS if every line evaluated, EXIT_FAILURE otherwise
  */
-bool validOperator(const char* str)
+int runMappedFile(const char* path, CalcContext* ctx,
+                  const CliOptions* opts)
 {
-    return strlen(str) == 1 && strpbrk(str, "+-*/") != NULL;
+    static char out_buf[BATCH_OUT_SIZE];
+    struct stat file_info;
+    const char* data;
+    const char* line;
+    const char* line_end;
+    const char* end;
+    size_t size;
+    size_t line_len;
+    double result;
+    CalcStatus status;
+    bool all_ok = true;
+    bool quit = false;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &file_info) != 0)
+    {
+        fprintf(stderr, "Cannot open %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return EXIT_FAILURE;
+    }
+
+    size = (size_t)file_info.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    data = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    posix_madvise((void *)data, size, POSIX_MADV_SEQUENTIAL);
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    end = data + size;
+    line = data;
+
+    if (opts->num_threads > 1)
+    {   // complete lines go to the workers, an unterminated last line
+        // is left for the loop below
+        line_end = end;
+        while (line_end > data && line_end[-1] != '\n')
+            line_end--;
+
+        if (line_end > data)
+            all_ok = evalLinesParallel(data, line_end - data, opts,
+                                       &ctx->stats, &quit);
+        line = quit ? end : line_end;
+    }
+
+    for (; line < end; line = line_end + 1)
+    {
+        line_end = (const char *)memchr(line, '\n', end - line);
+        if (line_end == NULL)
+            line_end = end; // unterminated last line
+
+        line_len = line_end - line;
+        if (line_len == 4 && memcmp(line, "quit", 4) == 0)
+            break;
+
+        status = evalExpression(ctx, line, line_len, &result);
+        emitResult(ctx, status, result, opts);
+        all_ok = all_ok && status == CALC_OK;
+    }
+
+    fflush(stdout);
+    munmap((void *)data, size);
+
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-/* indexOfOp
- * ...Find the index of the first occurence of op char in operators
+/* runStream
+ * ...Evaluate every line of a file in batch mode without ever holding a
+ * ...whole line: input is read in fixed-size pieces and each line is fed
+ * ...to a CalcStream as it arrives, so a single expression may be longer
+ * ...than memory. Lines are evaluated serially and bypass the cache
  * ...Parameters:
- * ......const char* operators -- operators from the provided expression
- * ......char op -- the operator character to find
- * ......int num_operators -- the number of operators to search
+ * ......FILE* in -- input with one expression per line
+ * ......CalcContext* ctx -- evaluator context shared by every line
+ * ......const CliOptions* opts -- command line options
  * ...Returns:
- * ......the integer index of the first occurence of op in operators,
- * ...... -1 otherwise
+ * ......EXIT_SUCCESS if every line evaluated, EXIT_FAILURE otherwise
  */
-int indexOfOp(const char* operators, char op, int num_operators)
+int runStream(FILE* in, CalcContext* ctx, const CliOptions* opts)
 {
-    for (int i = 0; i < num_operators; i++)
+    static char out_buf[BATCH_OUT_SIZE];
+    static char in_buf[STREAM_READ_SIZE];
+    CalcStream stream;
+    CalcStatus status;
+    const char* piece;
+    const char* line_end;
+    const char* end;
+    size_t num_read;
+    size_t line_len = 0; // characters of the current line so far
+    bool maybe_quit = true; // the current line is a prefix of quit
+    bool all_ok = true;
+    double result;
+
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    beginStream(ctx, &stream);
+
+    while ((num_read = fread(in_buf, 1, sizeof(in_buf), in)) > 0)
     {
-        if (operators[i] == op)
-            return i;
+        end = in_buf + num_read;
+
+        for (piece = in_buf; piece < end; piece = line_end + 1)
+        {
+            line_end = (const char *)memchr(piece, '\n', end - piece);
+            if (line_end == NULL)
+                line_end = end; // the line goes on in the next read
+
+            maybe_quit = maybe_quit && line_len + (line_end - piece) <= 4
+                         && memcmp(piece, "quit" + line_len,
+                                   line_end - piece) == 0;
+            line_len += line_end - piece;
+            feedStream(&stream, piece, line_end - piece);
+
+            if (line_end == end)
+                break;
+
+            if (maybe_quit && line_len == 4)
+            {
+                fflush(stdout);
+                return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+
+            status = endStream(&stream, &result);
+            emitResult(ctx, status, result, opts);
+            all_ok = all_ok && status == CALC_OK;
+
+            beginStream(ctx, &stream);
+            line_len = 0;
+            maybe_quit = true;
+        }
     }
 
-    return -1;
+    if (ferror(in))
+    {
+        fprintf(stderr, "Error reading input!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (line_len > 0 && !(maybe_quit && line_len == 4))
+    {   // unterminated last line
+        status = endStream(&stream, &result);
+        emitResult(ctx, status, result, opts);
+        all_ok = all_ok && status == CALC_OK;
+    }
+
+    fflush(stdout);
+
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-/* applyOp
- * ...Apply operation op on a and b
+/* runBinary
+ * ...Evaluate binary mode frames until the end of the input, writing one
+ * ...binary reply per frame. Frames are evaluated serially and bypass
+ * ...the cache
  * ...Parameters:
- * ......double a -- the first number to operate on
- * ......double b -- the second number to operate on
- * ......char op -- char representing the operation to perform
+ * ......FILE* in -- input holding a sequence of frames
+ * ......CalcContext* ctx -- evaluator context shared by every frame
  * ...Returns:
- * ......the result of the operation, DBL_MAX if divide by zero
+ * ......EXIT_SUCCESS if every frame evaluated, EXIT_FAILURE otherwise
  */
-double applyOp(double a, double b, char op)
+int runBinary(FILE* in, CalcContext* ctx)
 {
-    double result = 0.0;
-    switch (op)
-    {
-        case '+':
-            result = a + b;
-            break;
+    static char out_buf[BATCH_OUT_SIZE];
+    unsigned char header[WIRE_HEADER_SIZE];
+    unsigned char reply[WIRE_REPLY_SIZE];
+    unsigned char* exp = NULL;
+    unsigned char* new_exp;
+    size_t exp_cap = 0;
+    size_t len;
+    size_t num_read;
+    double result;
+    CalcStatus status;
+    bool all_ok = true;
 
-        case '-':
-            result = a - b;
-            break;
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
 
-        case '*':
-            result = a * b;
+    while ((num_read = fread(header, 1, sizeof(header), in)) > 0)
+    {
+        len = wireLength(header);
+        if (num_read == sizeof(header) && len > exp_cap)
+        {
+            new_exp = (unsigned char *)realloc(exp, len);
+            if (new_exp == NULL)
+            {
+                printAllocError();
+                exit(EXIT_FAILURE);
+            }
+            exp = new_exp;
+            exp_cap = len;
+        }
+
+        if (num_read != sizeof(header) || fread(exp, 1, len, in) != len)
+        {
+            fprintf(stderr, "Truncated binary input\n");
+            all_ok = false;
             break;
+        }
 
-        case '/':
-            if (fabs(b) < DBL_EPSILON)
-                result = DBL_MAX; // divide by zero
-            else
-                result = a / b;
+        status = evalBinary(ctx, exp, len, &result);
+        STAT_START(output_start);
+        formatWireReply(status, result, reply);
+        fwrite(reply, 1, sizeof(reply), stdout);
+        STAT_PHASE(&ctx->stats, CALC_PHASE_OUTPUT, output_start);
+        all_ok = all_ok && status == CALC_OK;
     }
 
-    return result;
+    fflush(stdout);
+    free(exp);
+
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /* printResult
- * ...Print val to stdout, removing trailing zeros and decimal if val is int
+ * ...Print val to stdout in the format the options ask for
  * ...Parameters:
  * ......double val -- value to print to stdout
+ * ......const CliOptions* opts -- command line options
  * ...Returns:
  * ......Nothing
  */
-void printResult(double val)
+void printResult(double val, const CliOptions* opts)
 {
-    char* p;
-    char* result_str = (char *)malloc(101); // 100 chars is plenty,
-                                            // extra 1 for \0 char
-    if (result_str != NULL)
-    {
-        snprintf(result_str, 100, "%.10f", val);
-        p = strchr(result_str, '\0'); // pointer to last character in the str
+    char result_str[RESULT_STR_SIZE];
+
+    formatValue(opts, val, result_str);
+    printf("Result: %s\n", result_str);
+}
+
+/* reportStats
+ * ...Print the --stats report to stderr, if it was asked for
+ * ...Parameters:
+ * ......CalcContext* ctx -- context holding the merged counters
+ * ......const CliOptions* opts -- command line options
+ * ......const struct timespec* start_time -- when evaluation started
+ * ...Returns:
+ * ......Nothing
+ */
+void reportStats(CalcContext* ctx, const CliOptions* opts,
+                 const struct timespec* start_time)
+{
+    struct timespec end_time;
+    double seconds;
 
-        p--;
-        while (*p == '0') // remove trailing zeros
-            *p-- = '\0';
+    if (opts->stats == STATS_NONE)
+        return;
 
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    seconds = (double)(end_time.tv_sec - start_time->tv_sec)
+              + (end_time.tv_nsec - start_time->tv_nsec) / 1e9;
 
-        if (*p == '.' || *p == ',')
-            *p = '\0'; // remove decimal if val is an integer
+    ctx->stats.allocations += readlineAllocations();
+    printStats(stderr, &ctx->stats, seconds, opts->stats);
+}
 
-        printf("Result: %s\n", result_str);
+/* parseSize
+ * ...Read a byte count with an optional K, M or G suffix (powers of 1024)
+ * ...Parameters:
+ * ......const char* str -- text to read, such as 64M
+ * ......size_t* size -- set to the number of bytes
+ * ...Returns:
+ * ......true if str is a valid size, false otherwise
+ */
+bool parseSize(const char* str, size_t* size)
+{
+    char* end;
+    unsigned long long value;
+    int shift = 0;
 
-        free(result_str);
-    }
+    if (!isdigit((unsigned char)str[0]))
+        return false;
+
+    value = strtoull(str, &end, 10);
+    if (*end == 'K' || *end == 'k')
+        shift = 10;
+    else if (*end == 'M' || *end == 'm')
+        shift = 20;
+    else if (*end == 'G' || *end == 'g')
+        shift = 30;
+
+    if (shift > 0)
+        end++;
+    if (*end != '\0' || value > (SIZE_MAX >> shift))
+        return false;
+
+    *size = (size_t)value << shift;
+
+    return true;
+}
+
+/* parseMode
+ * ...Read the name of an arithmetic mode
+ * ...Parameters:
+ * ......const char* str -- double, compensated or exact
+ * ......CalcMode* mode -- set to the mode named
+ * ...Returns:
+ * ......true if str names a mode, false otherwise
+ */
+bool parseMode(const char* str, CalcMode* mode)
+{
+    if (strcmp(str, "double") == 0)
+        *mode = CALC_MODE_DOUBLE;
+    else if (strcmp(str, "compensated") == 0)
+        *mode = CALC_MODE_COMPENSATED;
+    else if (strcmp(str, "exact") == 0)
+        *mode = CALC_MODE_EXACT;
     else
-    {
-        printAllocError();
-        exit(EXIT_FAILURE);
-    }
+        return false;
+
+    return true;
 }
 
-/* printAllocError
- * ...Print memory allocation error message to stdout
+/* parsePrecision
+ * ...Read a number of fixed decimal places
+ * ...Parameters:
+ * ......const char* str -- text to read, 0 to MAX_FIXED_PRECISION
+ * ......int* precision -- set to the number read
  * ...Returns:
- * ......Nothing
+ * ......true if str is a valid precision, false otherwise
  */
-void printAllocError()
+bool parsePrecision(const char* str, int* precision)
 {
-    printf("Memory allocation error\n");
+    char* end;
+    long value;
+
+    if (!isdigit((unsigned char)str[0]))
+        return false;
+
+    value = strtol(str, &end, 10);
+    if (*end != '\0' || value > MAX_FIXED_PRECISION)
+        return false;
+
+    *precision = (int)value;
+
+    return true;
 }
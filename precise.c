@@ -0,0 +1,306 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Operand arithmetic of CALC_MODE_COMPENSATED and           *
+ * CALC_MODE_EXACT, applied by the stream evaluator in place *
+ * of plain doubles                                          *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+
+static CalcStatus applyCompensated(double*, double*, size_t, OpCode);
+static void renormalize(double*, double*, double, double);
+
+/* evalPrecise
+ * ...Evaluate an expression in ctx->mode with the stream evaluator, as
+ * ...one piece. Its grammar and statuses are those of evalExpression,
+ * ...though of several errors in one expression a different one may be
+ * ...reported first
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, ctx->mode is
+ * ...... CALC_MODE_COMPENSATED or CALC_MODE_EXACT
+ * ......const char* exp -- characters of the expression
+ * ......size_t len -- number of characters in exp
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... for a bad token, ctx->error_token and ctx->error_len identify
+ * ...... its first STREAM_ERROR_SIZE characters until the next call
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ */
+CalcStatus evalPrecise(CalcContext* ctx, const char* exp, size_t len,
+                       double* result)
+{
+    CalcStream* stream;
+
+    if (!reservePrecise(ctx, 1))
+        return CALC_NO_MEMORY;
+
+    stream = &ctx->precise->stream;
+    beginStream(ctx, stream);
+    feedStream(stream, exp, len);
+
+    return endStream(stream, result);
+}
+
+/* reservePrecise
+ * ...Make room for count pending operands of the precise modes, creating
+ * ...ctx->precise the first time
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context
+ * ......size_t count -- operands needed
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+bool reservePrecise(CalcContext* ctx, size_t count)
+{
+    struct PreciseState* p = ctx->precise;
+    size_t new_capacity;
+    double* new_lo;
+    Rational* new_values;
+
+    if (p == NULL)
+    {
+        p = (struct PreciseState *)calloc(1, sizeof(*p));
+        if (p == NULL)
+            return false;
+        initScratch(&p->scratch);
+        ctx->precise = p;
+        STAT_ADD(ctx->stats.allocations, 1);
+    }
+
+    if (count <= p->capacity)
+        return true;
+    if (count > SIZE_MAX / sizeof(Rational))
+        return false;
+
+    new_capacity = p->capacity > 0 ? p->capacity : 16;
+    while (new_capacity < count)
+        new_capacity = new_capacity <= SIZE_MAX / sizeof(Rational) / 2
+                       ? new_capacity * 2 : count;
+
+    new_lo = (double *)realloc(p->lo, sizeof(double) * new_capacity);
+    if (new_lo == NULL)
+        return false;
+    p->lo = new_lo;
+
+    new_values = (Rational *)realloc(p->values,
+                                     sizeof(Rational) * new_capacity);
+    if (new_values == NULL)
+        return false;
+    p->values = new_values;
+
+    for (size_t i = p->capacity; i < new_capacity; i++)
+        initRational(&p->values[i]);
+    p->capacity = new_capacity;
+    STAT_ADD(ctx->stats.allocations, 2);
+
+    return true;
+}
+
+/* pushPrecise
+ * ...Set a pending operand of a precise mode. An exact operand is read
+ * ...from its text, so 0.1 is exactly one tenth
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, with room for the operand
+ * ......CalcMode mode -- CALC_MODE_COMPENSATED or CALC_MODE_EXACT
+ * ......size_t index -- operand stack entry, whose double is value
+ * ......double value -- the operand
+ * ......const char* token -- text of the operand, NULL if there is none
+ * ......size_t len -- number of characters in token
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ */
+CalcStatus pushPrecise(CalcContext* ctx, CalcMode mode, size_t index,
+                       double value, const char* token, size_t len)
+{
+    struct PreciseState* p = ctx->precise;
+
+    if (mode == CALC_MODE_COMPENSATED)
+    {
+        p->lo[index] = 0.0;
+        return CALC_OK;
+    }
+
+    if (token == NULL)
+        return doubleToRational(&p->values[index], value);
+
+    return parseRational(&p->values[index], token, len, &p->scratch);
+}
+
+/* applyPrecise
+ * ...Apply an operator to the pending operands of a precise mode on top
+ * ...of the operand stack, leaving the result in place of the first
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context
+ * ......CalcMode mode -- CALC_MODE_COMPENSATED or CALC_MODE_EXACT
+ * ......size_t top -- operand stack entry of the last operand
+ * ......OpCode op -- the operation to perform
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ */
+CalcStatus applyPrecise(CalcContext* ctx, CalcMode mode, size_t top,
+                        OpCode op)
+{
+    struct PreciseState* p = ctx->precise;
+
+    if (mode == CALC_MODE_COMPENSATED)
+        return applyCompensated(ctx->stacks.operands, p->lo, top, op);
+
+    if (op_table[op].arity == 1)
+        return applyRationalUnary(&p->values[top], op);
+
+    return applyRational(&p->values[top - 1], &p->values[top], op,
+                         &p->scratch);
+}
+
+/* resultPrecise
+ * ...Round the final operand of a precise mode to a double
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context holding one operand
+ * ......CalcMode mode -- CALC_MODE_COMPENSATED or CALC_MODE_EXACT
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_TOO_LARGE or CALC_NO_MEMORY otherwise
+ */
+CalcStatus resultPrecise(CalcContext* ctx, CalcMode mode, double* result)
+{
+    struct PreciseState* p = ctx->precise;
+
+    if (mode == CALC_MODE_COMPENSATED)
+    {
+        *result = ctx->stacks.operands[0] + p->lo[0];
+        return CALC_OK;
+    }
+
+    return rationalToDouble(&p->values[0], &p->scratch, result);
+}
+
+/* freePrecise
+ * ...Release the operands of the precise modes held by a context
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context
+ * ...Returns:
+ * ......Nothing
+ */
+void freePrecise(CalcContext* ctx)
+{
+    struct PreciseState* p = ctx->precise;
+
+    if (p == NULL)
+        return;
+
+    for (size_t i = 0; i < p->capacity; i++)
+        freeRational(&p->values[i]);
+    free(p->values);
+    free(p->lo);
+    freeScratch(&p->scratch);
+    free(p);
+    ctx->precise = NULL;
+}
+
+/* applyCompensated
+ * ...Apply an operator to double-double operands, each the unevaluated
+ * ...sum hi + lo of a double and its error. +, -, * and / recover the
+ * ...rounding error of the double operation exactly, from TwoSum and
+ * ...from fma; the other operations act on hi + lo with error zero
+ * ...Parameters:
+ * ......double* hi -- high parts of the operand stack
+ * ......double* lo -- error parts of the operand stack
+ * ......size_t top -- entry of the last operand
+ * ......OpCode op -- the operation to perform
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_DIVIDE_BY_ZERO under the same rule
+ * ...... as applyOp, with hi + lo as the divisor
+ */
+static CalcStatus applyCompensated(double* hi, double* lo, size_t top,
+                                   OpCode op)
+{
+    size_t dst = op_table[op].arity == 1 ? top : top - 1;
+    double a = hi[dst];
+    double a_lo = lo[dst];
+    double b = hi[top];
+    double b_lo = lo[top];
+    double sum;
+    double part;
+    double err;
+
+    switch (op)
+    {
+        case OP_NEGATE:
+            hi[dst] = -a;
+            lo[dst] = -a_lo;
+            return CALC_OK;
+
+        case OP_SUB:
+            b = -b;
+            b_lo = -b_lo;
+            // fall through
+        case OP_ADD:
+            sum = a + b;
+            part = sum - a;
+            err = (a - (sum - part)) + (b - part);
+            renormalize(&hi[dst], &lo[dst], sum, err + a_lo + b_lo);
+            return CALC_OK;
+
+        case OP_MUL:
+            sum = a * b;
+            err = fma(a, b, -sum) + (a * b_lo + a_lo * b);
+            renormalize(&hi[dst], &lo[dst], sum, err);
+            return CALC_OK;
+
+        case OP_DIV:
+            if (fabs(b + b_lo) < DBL_EPSILON)
+                return CALC_DIVIDE_BY_ZERO;
+            sum = a / b;
+            err = (fma(-sum, b, a) + a_lo - sum * b_lo) / b;
+            renormalize(&hi[dst], &lo[dst], sum, err);
+            return CALC_OK;
+
+        case OP_MOD:
+            if (fabs(b + b_lo) < DBL_EPSILON)
+                return CALC_DIVIDE_BY_ZERO;
+            // fall through
+        default:
+            if (op_table[op].arity == 1)
+                hi[dst] = applyUnary(a + a_lo, op);
+            else
+                hi[dst] = applyOp(a + a_lo, b + b_lo, op);
+            lo[dst] = 0.0;
+            return CALC_OK;
+    }
+}
+
+/* renormalize
+ * ...Store a double-double with its error no larger than half a unit in
+ * ...the last place of its high part; beyond the range of doubles the
+ * ...error is dropped, as it would otherwise turn an infinity into nan
+ * ...Parameters:
+ * ......double* hi -- receives the high part
+ * ......double* lo -- receives the error
+ * ......double sum -- approximate value
+ * ......double err -- error of sum
+ * ...Returns:
+ * ......Nothing
+ */
+static void renormalize(double* hi, double* lo, double sum, double err)
+{
+    double s = sum + err;
+
+    if (isinf(sum) || isnan(sum) || isinf(s))
+    {
+        *hi = isinf(sum) || isnan(sum) ? sum : s;
+        *lo = 0.0;
+        return;
+    }
+
+    *hi = s;
+    *lo = err - (s - sum);
+}
@@ -0,0 +1,1188 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Exact rational arithmetic on arbitrary-precision integers *
+ * for CALC_MODE_EXACT. Buffers only grow and are reused, so *
+ * steady-state evaluation does not allocate                 *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+// Temporaries used by each operation
+#define T_LEFT 0    // cross products of the operands
+#define T_RIGHT 1
+#define T_DEN 2     // product of the denominators
+#define T_REM 3     // remainders
+#define T_GCD 4     // ratReduce: common divisor
+#define T_QUOT 5    // ratReduce: quotients
+#define T_WORK 6    // bigGcd and bigDivMod working value
+
+static CalcStatus ratReduce(Rational*, RationalScratch*);
+static CalcStatus ratPow(Rational*, const Rational*, RationalScratch*);
+static bool ratIsZero(const Rational*);
+static void ratSetZero(Rational*);
+static CalcStatus bigStatus(void);
+static bool bigReserve(BigNat*, size_t);
+static void bigTrim(BigNat*);
+static bool bigSetSmall(BigNat*, uint32_t);
+static bool bigCopy(BigNat*, const BigNat*);
+static void bigSwap(BigNat*, BigNat*);
+static int bigCmp(const BigNat*, const BigNat*);
+static bool bigIsOne(const BigNat*);
+static bool bigAdd(BigNat*, const BigNat*, const BigNat*);
+static bool bigSub(BigNat*, const BigNat*, const BigNat*);
+static bool bigMul(BigNat*, const BigNat*, const BigNat*);
+static bool bigMulSmall(BigNat*, uint32_t, uint32_t);
+static bool bigPowTen(BigNat*, uint32_t);
+static bool bigShl(BigNat*, const BigNat*, size_t);
+static void bigShr(BigNat*, size_t);
+static size_t bigBitLen(const BigNat*);
+static size_t bigTrailingZeros(const BigNat*);
+static bool bigDivMod(BigNat*, BigNat*, const BigNat*, const BigNat*,
+                      BigNat*);
+static bool bigGcd(BigNat*, const BigNat*, const BigNat*, BigNat*);
+
+/* initRational
+ * ...Prepare an empty rational, equal to zero
+ * ...Parameters:
+ * ......Rational* x -- rational to initialize
+ * ...Returns:
+ * ......Nothing
+ */
+void initRational(Rational* x)
+{
+    memset(x, 0, sizeof(*x));
+}
+
+/* freeRational
+ * ...Release the limbs held by a rational
+ * ...Parameters:
+ * ......Rational* x -- rational to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeRational(Rational* x)
+{
+    free(x->num.limbs);
+    free(x->den.limbs);
+    initRational(x);
+}
+
+/* initScratch
+ * ...Prepare the temporaries of the rational operations
+ * ...Parameters:
+ * ......RationalScratch* s -- scratch to initialize
+ * ...Returns:
+ * ......Nothing
+ */
+void initScratch(RationalScratch* s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+/* freeScratch
+ * ...Release the temporaries of the rational operations
+ * ...Parameters:
+ * ......RationalScratch* s -- scratch to release
+ * ...Returns:
+ * ......Nothing
+ */
+void freeScratch(RationalScratch* s)
+{
+    for (int i = 0; i < RATIONAL_TEMPS; i++)
+        free(s->t[i].limbs);
+    initScratch(s);
+}
+
+/* parseRational
+ * ...Convert a number token to the exact value it spells, so 0.1 is
+ * ...1/10 rather than the double nearest to it
+ * ...Parameters:
+ * ......Rational* x -- set to the value
+ * ......const char* token -- a number as parseNumber accepts it
+ * ......size_t len -- number of characters in token
+ * ......RationalScratch* s -- temporaries
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_TOO_LARGE if the value needs more
+ * ...... than RATIONAL_MAX_LIMBS limbs, CALC_NO_MEMORY if they could
+ * ...... not be allocated
+ */
+CalcStatus parseRational(Rational* x, const char* token, size_t len,
+                         RationalScratch* s)
+{
+    const char* p = token;
+    const char* end = token + len;
+    uint32_t chunk = 0;
+    uint32_t chunk_digits = 0;
+    long scale = 0; // power of ten the digits are multiplied by
+    long exp_val = 0;
+    bool exp_negative = false;
+    bool frac = false;
+    bool ok;
+
+    x->negative = p < end && *p == '-';
+    if (p < end && (*p == '+' || *p == '-'))
+        p++;
+
+    ok = bigSetSmall(&x->num, 0) && bigSetSmall(&x->den, 1);
+
+    for (; ok && p < end && (isdigit((unsigned char)*p) || *p == '.'); p++)
+    {
+        if (*p == '.')
+        {
+            frac = true;
+            continue;
+        }
+
+        chunk = chunk * 10 + (uint32_t)(*p - '0');
+        scale -= frac;
+        if (++chunk_digits == 9) // 10^9 is the largest power in a limb
+        {
+            ok = bigMulSmall(&x->num, 1000000000u, chunk);
+            chunk = 0;
+            chunk_digits = 0;
+        }
+    }
+
+    if (ok && chunk_digits > 0)
+    {
+        uint32_t power = 1;
+        while (chunk_digits-- > 0)
+            power *= 10;
+        ok = bigMulSmall(&x->num, power, chunk);
+    }
+
+    if (p < end)
+    {   // the exponent; parseNumber already checked its digits
+        p++;
+        exp_negative = *p == '-';
+        if (*p == '+' || *p == '-')
+            p++;
+        for (; p < end; p++)
+        {
+            if (exp_val < 10L * RATIONAL_MAX_LIMBS * 9)
+                exp_val = exp_val * 10 + (*p - '0');
+        }
+        scale += exp_negative ? -exp_val : exp_val;
+    }
+
+    if (!ok)
+        return bigStatus();
+
+    if (x->num.len == 0)
+    {
+        ratSetZero(x);
+        return CALC_OK;
+    }
+
+    // Each limb holds under ten digits, so a power beyond this
+    // cannot fit in RATIONAL_MAX_LIMBS
+    if (scale > 9L * RATIONAL_MAX_LIMBS || scale < -9L * RATIONAL_MAX_LIMBS)
+        return CALC_TOO_LARGE;
+
+    if (scale > 0)
+    {
+        if (!bigPowTen(&s->t[T_LEFT], (uint32_t)scale)
+            || !bigMul(&s->t[T_RIGHT], &x->num, &s->t[T_LEFT]))
+            return bigStatus();
+        bigSwap(&x->num, &s->t[T_RIGHT]);
+    }
+    else if (scale < 0 && !bigPowTen(&x->den, (uint32_t)-scale))
+        return bigStatus();
+
+    return ratReduce(x, s);
+}
+
+/* doubleToRational
+ * ...Convert a double to the fraction it represents exactly, for
+ * ...operands that arrive as doubles rather than text
+ * ...Parameters:
+ * ......Rational* x -- set to the value
+ * ......double value -- a finite double
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_NOT_EXACT for an infinity or nan,
+ * ...... CALC_NO_MEMORY if allocation failed
+ */
+CalcStatus doubleToRational(Rational* x, double value)
+{
+    uint64_t mantissa;
+    int exponent;
+
+    if (isnan(value) || isinf(value))
+        return CALC_NOT_EXACT;
+
+    if (value == 0.0)
+    {
+        if (!bigReserve(&x->den, 1))
+            return bigStatus();
+        ratSetZero(x);
+        return CALC_OK;
+    }
+
+    // value = mantissa * 2^exponent with an odd mantissa, which puts
+    // the fraction in lowest terms
+    x->negative = value < 0.0;
+    mantissa = (uint64_t)ldexp(frexp(fabs(value), &exponent), 53);
+    exponent -= 53;
+    while ((mantissa & 1) == 0)
+    {
+        mantissa >>= 1;
+        exponent++;
+    }
+
+    if (!bigReserve(&x->num, 2) || !bigSetSmall(&x->den, 1))
+        return bigStatus();
+    x->num.limbs[0] = (uint32_t)mantissa;
+    x->num.limbs[1] = (uint32_t)(mantissa >> 32);
+    x->num.len = 2;
+    bigTrim(&x->num);
+
+    if (exponent > 0)
+        return bigShl(&x->num, &x->num, (size_t)exponent)
+               ? CALC_OK : bigStatus();
+    if (exponent < 0)
+        return bigShl(&x->den, &x->den, (size_t)-exponent)
+               ? CALC_OK : bigStatus();
+
+    return CALC_OK;
+}
+
+/* applyRational
+ * ...Apply binary operation op exactly: a = a op b
+ * ...Parameters:
+ * ......Rational* a -- the first operand, replaced by the result
+ * ......const Rational* b -- the second operand
+ * ......OpCode op -- the operation to perform, one with arity 2
+ * ......RationalScratch* s -- temporaries
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_DIVIDE_BY_ZERO for / or % by exactly
+ * ...... zero or a negative power of zero, CALC_NOT_EXACT for a power
+ * ...... with a fractional exponent, CALC_TOO_LARGE if the result needs
+ * ...... more than RATIONAL_MAX_LIMBS limbs, CALC_NO_MEMORY if they
+ * ...... could not be allocated
+ */
+CalcStatus applyRational(Rational* a, const Rational* b, OpCode op,
+                         RationalScratch* s)
+{
+    BigNat* left = &s->t[T_LEFT];
+    BigNat* right = &s->t[T_RIGHT];
+    BigNat* den = &s->t[T_DEN];
+    bool b_negative = b->negative;
+    int cmp;
+
+    switch (op)
+    {
+        case OP_SUB:
+            b_negative = !b_negative;
+            // fall through
+        case OP_ADD:
+            if (bigCmp(&a->den, &b->den) == 0)
+            {   // common in money amounts: no cross multiplication
+                if (!bigCopy(left, &a->num) || !bigCopy(right, &b->num))
+                    return bigStatus();
+            }
+            else if (!bigMul(left, &a->num, &b->den)
+                     || !bigMul(right, &b->num, &a->den)
+                     || !bigMul(den, &a->den, &b->den))
+                return bigStatus();
+            else
+                bigSwap(&a->den, den);
+
+            if (a->negative == b_negative)
+                return bigAdd(&a->num, left, right) ? ratReduce(a, s)
+                                                    : bigStatus();
+
+            cmp = bigCmp(left, right);
+            if (cmp == 0)
+            {
+                ratSetZero(a);
+                return CALC_OK;
+            }
+            a->negative = cmp > 0 ? a->negative : b_negative;
+            if (!(cmp > 0 ? bigSub(&a->num, left, right)
+                          : bigSub(&a->num, right, left)))
+                return bigStatus();
+            return ratReduce(a, s);
+
+        case OP_MUL:
+        case OP_DIV:
+            if (op == OP_DIV && ratIsZero(b))
+                return CALC_DIVIDE_BY_ZERO;
+            if (!bigMul(left, &a->num, op == OP_MUL ? &b->num : &b->den)
+                || !bigMul(right, &a->den, op == OP_MUL ? &b->den : &b->num))
+                return bigStatus();
+            bigSwap(&a->num, left);
+            bigSwap(&a->den, right);
+            a->negative = a->negative != b->negative;
+            if (a->num.len == 0)
+            {
+                ratSetZero(a);
+                return CALC_OK;
+            }
+            return ratReduce(a, s);
+
+        case OP_MOD:
+            // a - b * trunc(a / b) has the sign of a and magnitude
+            // (|a.num| * b.den mod |b.num| * a.den) / (a.den * b.den)
+            if (ratIsZero(b))
+                return CALC_DIVIDE_BY_ZERO;
+            if (!bigMul(left, &a->num, &b->den)
+                || !bigMul(right, &b->num, &a->den)
+                || !bigDivMod(NULL, &s->t[T_REM], left, right, &s->t[T_WORK])
+                || !bigMul(den, &a->den, &b->den))
+                return bigStatus();
+            bigSwap(&a->num, &s->t[T_REM]);
+            bigSwap(&a->den, den);
+            if (a->num.len == 0)
+            {
+                ratSetZero(a);
+                return CALC_OK;
+            }
+            return ratReduce(a, s);
+
+        case OP_POW:
+            return ratPow(a, b, s);
+
+        case OP_MIN:
+        case OP_MAX:
+            cmp = compareRational(a, b, s);
+            if (cmp == COMPARE_FAILED)
+                return bigStatus();
+            if (op == OP_MIN ? cmp > 0 : cmp < 0)
+            {
+                if (!bigCopy(&a->num, &b->num) || !bigCopy(&a->den, &b->den))
+                    return bigStatus();
+                a->negative = b->negative;
+            }
+            return CALC_OK;
+
+        default:
+            return CALC_NOT_EXACT;
+    }
+}
+
+/* applyRationalUnary
+ * ...Apply unary operation op exactly: x = op x
+ * ...Parameters:
+ * ......Rational* x -- the operand, replaced by the result
+ * ......OpCode op -- the operation to perform, one with arity 1
+ * ...Returns:
+ * ......CALC_OK for negation, CALC_NOT_EXACT for sqrt and log, whose
+ * ...... results are irrational in general
+ */
+CalcStatus applyRationalUnary(Rational* x, OpCode op)
+{
+    if (op != OP_NEGATE)
+        return CALC_NOT_EXACT;
+
+    x->negative = !x->negative && x->num.len > 0;
+
+    return CALC_OK;
+}
+
+/* compareRational
+ * ...Order two rationals
+ * ...Parameters:
+ * ......const Rational* a -- first value
+ * ......const Rational* b -- second value
+ * ......RationalScratch* s -- temporaries
+ * ...Returns:
+ * ......negative, zero or positive as a is less than, equal to or
+ * ...... greater than b, COMPARE_FAILED if a product could not be
+ * ...... formed, with the reason for bigStatus in errno
+ */
+int compareRational(const Rational* a, const Rational* b,
+                    RationalScratch* s)
+{
+    int cmp;
+
+    if (a->negative != b->negative)
+        return a->negative ? -1 : 1;
+
+    if (!bigMul(&s->t[T_LEFT], &a->num, &b->den)
+        || !bigMul(&s->t[T_RIGHT], &b->num, &a->den))
+        return COMPARE_FAILED;
+
+    cmp = bigCmp(&s->t[T_LEFT], &s->t[T_RIGHT]);
+
+    return a->negative ? -cmp : cmp;
+}
+
+/* rationalToDouble
+ * ...Round a rational to the nearest double, ties to even, so the exact
+ * ...result is rounded once, at the end
+ * ...Parameters:
+ * ......const Rational* x -- value to convert
+ * ......RationalScratch* s -- temporaries
+ * ......double* value -- set to the nearest double, an infinity beyond
+ * ...... the range of doubles
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_TOO_LARGE if the shifted value needs
+ * ...... more than RATIONAL_MAX_LIMBS limbs, CALC_NO_MEMORY otherwise
+ */
+CalcStatus rationalToDouble(const Rational* x, RationalScratch* s,
+                            double* value)
+{
+    BigNat* n = &s->t[T_LEFT];
+    BigNat* d = &s->t[T_RIGHT];
+    BigNat* q = &s->t[T_QUOT];
+    size_t num_bits = bigBitLen(&x->num);
+    size_t den_bits = bigBitLen(&x->den);
+    long shift;    // the quotient is taken of x * 2^shift
+    long exponent; // of the quotient's leading bit in x
+    int bits;      // in the quotient, 56 or 57
+    int excess;    // low bits of the quotient rounded away
+    uint64_t mantissa;
+    uint64_t rem;
+    uint64_t half;
+    bool sticky;
+
+    if (num_bits == 0)
+    {
+        *value = 0.0;
+        return CALC_OK;
+    }
+
+    // Quotients below 2^-1076 round to zero and those of 2^1025 or
+    // more overflow, so the shifts below stay small
+    if ((long)num_bits - (long)den_bits > 1025)
+    {
+        *value = x->negative ? -HUGE_VAL : HUGE_VAL;
+        return CALC_OK;
+    }
+    if ((long)den_bits - (long)num_bits > 1077)
+    {
+        *value = x->negative ? -0.0 : 0.0;
+        return CALC_OK;
+    }
+
+    shift = 56 + (long)den_bits - (long)num_bits;
+    if (!(shift >= 0 ? bigShl(n, &x->num, (size_t)shift)
+                       && bigCopy(d, &x->den)
+                     : bigCopy(n, &x->num)
+                       && bigShl(d, &x->den, (size_t)-shift))
+        || !bigDivMod(q, &s->t[T_REM], n, d, &s->t[T_WORK]))
+        return bigStatus();
+
+    mantissa = q->limbs[0] | (q->len > 1 ? (uint64_t)q->limbs[1] << 32 : 0);
+    sticky = s->t[T_REM].len > 0;
+    bits = (int)bigBitLen(q);
+    exponent = bits - 1 - shift;
+
+    excess = bits - 53;
+    if (exponent < -1022) // subnormal, fewer bits are kept
+        excess += (int)(-1022 - exponent);
+    if (excess > 60)
+    {
+        *value = x->negative ? -0.0 : 0.0;
+        return CALC_OK;
+    }
+
+    rem = mantissa & (((uint64_t)1 << excess) - 1);
+    half = (uint64_t)1 << (excess - 1);
+    mantissa >>= excess;
+    if (rem > half || (rem == half && (sticky || (mantissa & 1))))
+        mantissa++;
+
+    *value = ldexp((double)mantissa, (int)(excess - shift));
+    if (x->negative)
+        *value = -*value;
+
+    return CALC_OK;
+}
+
+/* ratReduce
+ * ...Bring a rational to lowest terms
+ * ...Parameters:
+ * ......Rational* x -- nonzero rational to reduce
+ * ......RationalScratch* s -- temporaries
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_NO_MEMORY otherwise
+ */
+static CalcStatus ratReduce(Rational* x, RationalScratch* s)
+{
+    BigNat* g = &s->t[T_GCD];
+
+    if (bigIsOne(&x->den) || bigIsOne(&x->num))
+        return CALC_OK;
+
+    if (!bigGcd(g, &x->num, &x->den, &s->t[T_WORK]))
+        return bigStatus();
+    if (bigIsOne(g))
+        return CALC_OK;
+
+    if (!bigDivMod(&s->t[T_QUOT], &s->t[T_REM], &x->num, g, &s->t[T_WORK]))
+        return bigStatus();
+    bigSwap(&x->num, &s->t[T_QUOT]);
+    if (!bigDivMod(&s->t[T_QUOT], &s->t[T_REM], &x->den, g, &s->t[T_WORK]))
+        return bigStatus();
+    bigSwap(&x->den, &s->t[T_QUOT]);
+
+    return CALC_OK;
+}
+
+/* ratPow
+ * ...Raise a to the integer power b by repeated squaring. Powers of a
+ * ...fraction in lowest terms are in lowest terms, so nothing is reduced
+ * ...Parameters:
+ * ......Rational* a -- the base, replaced by the result
+ * ......const Rational* b -- the exponent
+ * ......RationalScratch* s -- temporaries
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_NOT_EXACT if b is not an integer,
+ * ...... CALC_DIVIDE_BY_ZERO for a negative power of zero,
+ * ...... CALC_TOO_LARGE if the result is too large, CALC_NO_MEMORY if
+ * ...... allocation failed
+ */
+static CalcStatus ratPow(Rational* a, const Rational* b, RationalScratch* s)
+{
+    BigNat* num = &s->t[T_LEFT];
+    BigNat* den = &s->t[T_RIGHT];
+    BigNat* prod = &s->t[T_DEN];
+    uint32_t power;
+    bool odd;
+
+    if (!bigIsOne(&b->den))
+        return CALC_NOT_EXACT;
+
+    if (ratIsZero(b))
+        return bigSetSmall(&a->num, 1) && bigSetSmall(&a->den, 1)
+               ? (a->negative = false, CALC_OK) : bigStatus();
+
+    if (ratIsZero(a))
+        return b->negative ? CALC_DIVIDE_BY_ZERO : CALC_OK;
+
+    odd = (b->num.limbs[0] & 1) != 0;
+    if (bigIsOne(&a->num) && bigIsOne(&a->den))
+    {   // powers of 1 and -1, whatever the size of b
+        a->negative = a->negative && odd;
+        return CALC_OK;
+    }
+
+    if (b->num.len > 1)
+        return CALC_TOO_LARGE; // at least 2^(2^32) in magnitude
+
+    if (b->negative)
+        bigSwap(&a->num, &a->den);
+    a->negative = a->negative && odd;
+
+    if (!bigSetSmall(num, 1) || !bigSetSmall(den, 1))
+        return bigStatus();
+
+    for (power = b->num.limbs[0]; power != 0; power >>= 1)
+    {
+        if (power & 1)
+        {
+            if (!bigMul(prod, num, &a->num))
+                return bigStatus();
+            bigSwap(num, prod);
+            if (!bigMul(prod, den, &a->den))
+                return bigStatus();
+            bigSwap(den, prod);
+        }
+
+        if (power > 1)
+        {
+            if (!bigMul(prod, &a->num, &a->num))
+                return bigStatus();
+            bigSwap(&a->num, prod);
+            if (!bigMul(prod, &a->den, &a->den))
+                return bigStatus();
+            bigSwap(&a->den, prod);
+        }
+    }
+
+    bigSwap(&a->num, num);
+    bigSwap(&a->den, den);
+
+    return CALC_OK;
+}
+
+/* ratIsZero
+ * ...Check if a rational is zero
+ * ...Parameters:
+ * ......const Rational* x -- rational to check
+ * ...Returns:
+ * ......true if x is zero, false otherwise
+ */
+static bool ratIsZero(const Rational* x)
+{
+    return x->num.len == 0;
+}
+
+/* ratSetZero
+ * ...Set a rational to 0/1; den always has room for one limb here
+ * ...Parameters:
+ * ......Rational* x -- rational to clear
+ * ...Returns:
+ * ......Nothing
+ */
+static void ratSetZero(Rational* x)
+{
+    x->negative = false;
+    x->num.len = 0;
+    bigSetSmall(&x->den, 1);
+}
+
+/* bigStatus
+ * ...Give the reason the last big integer operation on this thread
+ * ...failed, which bigReserve leaves in errno
+ * ...Parameters:
+ * ......None
+ * ...Returns:
+ * ......CALC_TOO_LARGE if a number would have exceeded
+ * ...... RATIONAL_MAX_LIMBS limbs, CALC_NO_MEMORY otherwise
+ */
+static CalcStatus bigStatus(void)
+{
+    return errno == ERANGE ? CALC_TOO_LARGE : CALC_NO_MEMORY;
+}
+
+/* bigReserve
+ * ...Make room for n limbs, doubling the allocation. On failure errno
+ * ...is ERANGE for the limit and ENOMEM for the allocator, for bigStatus
+ * ...Parameters:
+ * ......BigNat* x -- number to grow
+ * ......size_t n -- limbs needed
+ * ...Returns:
+ * ......false if n exceeds RATIONAL_MAX_LIMBS or allocation failed,
+ * ...... true otherwise
+ */
+static bool bigReserve(BigNat* x, size_t n)
+{
+    size_t new_cap = x->cap > 0 ? x->cap : 4;
+    uint32_t* new_limbs;
+
+    if (n <= x->cap)
+        return true;
+    if (n > RATIONAL_MAX_LIMBS)
+    {
+        errno = ERANGE;
+        return false;
+    }
+
+    while (new_cap < n)
+        new_cap *= 2;
+
+    new_limbs = (uint32_t *)realloc(x->limbs, new_cap * sizeof(uint32_t));
+    if (new_limbs == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    x->limbs = new_limbs;
+    x->cap = new_cap;
+
+    return true;
+}
+
+/* bigTrim
+ * ...Drop leading zero limbs
+ * ...Parameters:
+ * ......BigNat* x -- number to normalize
+ * ...Returns:
+ * ......Nothing
+ */
+static void bigTrim(BigNat* x)
+{
+    while (x->len > 0 && x->limbs[x->len - 1] == 0)
+        x->len--;
+}
+
+/* bigSetSmall
+ * ...Set a number to a value that fits in one limb
+ * ...Parameters:
+ * ......BigNat* x -- number to set
+ * ......uint32_t v -- the value
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+static bool bigSetSmall(BigNat* x, uint32_t v)
+{
+    if (!bigReserve(x, 1))
+        return false;
+
+    x->limbs[0] = v;
+    x->len = v != 0;
+
+    return true;
+}
+
+/* bigCopy
+ * ...Copy a number
+ * ...Parameters:
+ * ......BigNat* dst -- destination
+ * ......const BigNat* src -- number to copy
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+static bool bigCopy(BigNat* dst, const BigNat* src)
+{
+    if (dst == src)
+        return true;
+    if (!bigReserve(dst, src->len))
+        return false;
+
+    if (src->len > 0)
+        memcpy(dst->limbs, src->limbs, src->len * sizeof(uint32_t));
+    dst->len = src->len;
+
+    return true;
+}
+
+/* bigSwap
+ * ...Exchange two numbers along with their buffers
+ * ...Parameters:
+ * ......BigNat* a -- first number
+ * ......BigNat* b -- second number
+ * ...Returns:
+ * ......Nothing
+ */
+static void bigSwap(BigNat* a, BigNat* b)
+{
+    BigNat t = *a;
+
+    *a = *b;
+    *b = t;
+}
+
+/* bigCmp
+ * ...Order two numbers
+ * ...Parameters:
+ * ......const BigNat* a -- first number
+ * ......const BigNat* b -- second number
+ * ...Returns:
+ * ......-1, 0 or 1 as a is less than, equal to or greater than b
+ */
+static int bigCmp(const BigNat* a, const BigNat* b)
+{
+    if (a->len != b->len)
+        return a->len < b->len ? -1 : 1;
+
+    for (size_t i = a->len; i-- > 0;)
+    {
+        if (a->limbs[i] != b->limbs[i])
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/* bigIsOne
+ * ...Check if a number is one
+ * ...Parameters:
+ * ......const BigNat* x -- number to check
+ * ...Returns:
+ * ......true if x is one, false otherwise
+ */
+static bool bigIsOne(const BigNat* x)
+{
+    return x->len == 1 && x->limbs[0] == 1;
+}
+
+/* bigAdd
+ * ...Add two numbers: dst = a + b
+ * ...Parameters:
+ * ......BigNat* dst -- receives the sum, may be a or b
+ * ......const BigNat* a -- first addend
+ * ......const BigNat* b -- second addend
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+static bool bigAdd(BigNat* dst, const BigNat* a, const BigNat* b)
+{
+    size_t a_len = a->len;
+    size_t b_len = b->len;
+    size_t n = a_len > b_len ? a_len : b_len;
+    uint64_t carry = 0;
+
+    if (!bigReserve(dst, n + 1))
+        return false;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        carry += (uint64_t)(i < a_len ? a->limbs[i] : 0)
+                 + (i < b_len ? b->limbs[i] : 0);
+        dst->limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    dst->limbs[n] = (uint32_t)carry;
+    dst->len = n + 1;
+    bigTrim(dst);
+
+    return true;
+}
+
+/* bigSub
+ * ...Subtract two numbers: dst = a - b, where b <= a
+ * ...Parameters:
+ * ......BigNat* dst -- receives the difference, may be a or b
+ * ......const BigNat* a -- minuend
+ * ......const BigNat* b -- subtrahend, at most a
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+static bool bigSub(BigNat* dst, const BigNat* a, const BigNat* b)
+{
+    size_t a_len = a->len;
+    size_t b_len = b->len;
+    int64_t borrow = 0;
+
+    if (!bigReserve(dst, a_len))
+        return false;
+
+    for (size_t i = 0; i < a_len; i++)
+    {
+        borrow += (int64_t)a->limbs[i] - (i < b_len ? b->limbs[i] : 0);
+        dst->limbs[i] = (uint32_t)borrow;
+        borrow = borrow < 0 ? -1 : 0;
+    }
+
+    dst->len = a_len;
+    bigTrim(dst);
+
+    return true;
+}
+
+/* bigMul
+ * ...Multiply two numbers, schoolbook: dst = a * b
+ * ...Parameters:
+ * ......BigNat* dst -- receives the product, neither a nor b
+ * ......const BigNat* a -- first factor
+ * ......const BigNat* b -- second factor
+ * ...Returns:
+ * ......false if the product is too large or allocation failed, true
+ * ...... otherwise
+ */
+static bool bigMul(BigNat* dst, const BigNat* a, const BigNat* b)
+{
+    uint64_t carry;
+
+    if (a->len == 0 || b->len == 0)
+    {
+        dst->len = 0;
+        return true;
+    }
+
+    if (!bigReserve(dst, a->len + b->len))
+        return false;
+    memset(dst->limbs, 0, (a->len + b->len) * sizeof(uint32_t));
+
+    for (size_t i = 0; i < a->len; i++)
+    {
+        carry = 0;
+        for (size_t j = 0; j < b->len; j++)
+        {
+            carry += (uint64_t)a->limbs[i] * b->limbs[j] + dst->limbs[i + j];
+            dst->limbs[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        dst->limbs[i + b->len] = (uint32_t)carry;
+    }
+
+    dst->len = a->len + b->len;
+    bigTrim(dst);
+
+    return true;
+}
+
+/* bigMulSmall
+ * ...Multiply a number by a one-limb factor and add a one-limb term in
+ * ...place: x = x * m + add
+ * ...Parameters:
+ * ......BigNat* x -- number to update
+ * ......uint32_t m -- factor
+ * ......uint32_t add -- term
+ * ...Returns:
+ * ......false if the result is too large or allocation failed, true
+ * ...... otherwise
+ */
+static bool bigMulSmall(BigNat* x, uint32_t m, uint32_t add)
+{
+    uint64_t carry = add;
+
+    for (size_t i = 0; i < x->len; i++)
+    {
+        carry += (uint64_t)x->limbs[i] * m;
+        x->limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    if (carry != 0)
+    {
+        if (!bigReserve(x, x->len + 1))
+            return false;
+        x->limbs[x->len++] = (uint32_t)carry;
+    }
+
+    return true;
+}
+
+/* bigPowTen
+ * ...Set a number to a power of ten
+ * ...Parameters:
+ * ......BigNat* x -- number to set
+ * ......uint32_t power -- the exponent
+ * ...Returns:
+ * ......false if the result is too large or allocation failed, true
+ * ...... otherwise
+ */
+static bool bigPowTen(BigNat* x, uint32_t power)
+{
+    uint32_t last = 1;
+
+    if (!bigSetSmall(x, 1))
+        return false;
+
+    for (; power >= 9; power -= 9)
+    {
+        if (!bigMulSmall(x, 1000000000u, 0))
+            return false;
+    }
+
+    while (power-- > 0)
+        last *= 10;
+
+    return bigMulSmall(x, last, 0);
+}
+
+/* bigShl
+ * ...Shift a number left: dst = a * 2^bits
+ * ...Parameters:
+ * ......BigNat* dst -- receives the result, may be a
+ * ......const BigNat* a -- number to shift
+ * ......size_t bits -- places to shift by
+ * ...Returns:
+ * ......false if the result is too large or allocation failed, true
+ * ...... otherwise
+ */
+static bool bigShl(BigNat* dst, const BigNat* a, size_t bits)
+{
+    size_t a_len = a->len;
+    size_t limbs = bits / 32;
+    unsigned shift = (unsigned)(bits % 32);
+    uint32_t v;
+
+    if (a_len == 0)
+    {
+        dst->len = 0;
+        return true;
+    }
+
+    if (!bigReserve(dst, a_len + limbs + 1))
+        return false;
+
+    // From the top down, so dst may overlap a
+    dst->limbs[a_len + limbs] = 0;
+    for (size_t i = a_len; i-- > 0;)
+    {
+        v = a->limbs[i];
+        if (shift != 0)
+            dst->limbs[i + limbs + 1] |= v >> (32 - shift);
+        dst->limbs[i + limbs] = v << shift;
+    }
+    memset(dst->limbs, 0, limbs * sizeof(uint32_t));
+
+    dst->len = a_len + limbs + 1;
+    bigTrim(dst);
+
+    return true;
+}
+
+/* bigShr
+ * ...Shift a number right in place: x = floor(x / 2^bits)
+ * ...Parameters:
+ * ......BigNat* x -- number to shift
+ * ......size_t bits -- places to shift by
+ * ...Returns:
+ * ......Nothing
+ */
+static void bigShr(BigNat* x, size_t bits)
+{
+    size_t limbs = bits / 32;
+    unsigned shift = (unsigned)(bits % 32);
+    size_t n;
+
+    if (limbs >= x->len)
+    {
+        x->len = 0;
+        return;
+    }
+
+    n = x->len - limbs;
+    for (size_t i = 0; i < n; i++)
+    {
+        x->limbs[i] = x->limbs[i + limbs] >> shift;
+        if (shift != 0 && i + 1 < n)
+            x->limbs[i] |= x->limbs[i + limbs + 1] << (32 - shift);
+    }
+
+    x->len = n;
+    bigTrim(x);
+}
+
+/* bigBitLen
+ * ...Count the bits of a number up to its highest set bit
+ * ...Parameters:
+ * ......const BigNat* x -- number to measure
+ * ...Returns:
+ * ......the bit length of x, 0 for zero
+ */
+static size_t bigBitLen(const BigNat* x)
+{
+    size_t bits;
+    uint32_t top;
+
+    if (x->len == 0)
+        return 0;
+
+    bits = (x->len - 1) * 32;
+    for (top = x->limbs[x->len - 1]; top != 0; top >>= 1)
+        bits++;
+
+    return bits;
+}
+
+/* bigTrailingZeros
+ * ...Count the zero bits below the lowest set bit
+ * ...Parameters:
+ * ......const BigNat* x -- nonzero number
+ * ...Returns:
+ * ......the number of trailing zero bits of x
+ */
+static size_t bigTrailingZeros(const BigNat* x)
+{
+    size_t i = 0;
+    size_t bits;
+    uint32_t v;
+
+    while (x->limbs[i] == 0)
+        i++;
+
+    bits = i * 32;
+    for (v = x->limbs[i]; (v & 1) == 0; v >>= 1)
+        bits++;
+
+    return bits;
+}
+
+/* bigDivMod
+ * ...Divide two numbers: q = floor(a / b) and r = a mod b. A one-limb
+ * ...divisor divides limb by limb; otherwise the quotient is found one
+ * ...bit at a time by shifting and subtracting
+ * ...Parameters:
+ * ......BigNat* q -- receives the quotient, NULL if not wanted
+ * ......BigNat* r -- receives the remainder
+ * ......const BigNat* a -- dividend
+ * ......const BigNat* b -- nonzero divisor
+ * ......BigNat* work -- temporary
+ * ...... q, r and work are distinct from each other, a and b
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+static bool bigDivMod(BigNat* q, BigNat* r, const BigNat* a,
+                      const BigNat* b, BigNat* work)
+{
+    size_t shift;
+    uint64_t rem = 0;
+
+    if (q != NULL && !bigReserve(q, a->len + 1))
+        return false;
+
+    if (b->len == 1)
+    {
+        for (size_t i = a->len; i-- > 0;)
+        {
+            rem = rem << 32 | a->limbs[i];
+            if (q != NULL)
+                q->limbs[i] = (uint32_t)(rem / b->limbs[0]);
+            rem %= b->limbs[0];
+        }
+        if (q != NULL)
+        {
+            q->len = a->len;
+            bigTrim(q);
+        }
+        return bigSetSmall(r, (uint32_t)rem);
+    }
+
+    if (!bigCopy(r, a))
+        return false;
+    if (q != NULL)
+        q->len = 0;
+    if (bigCmp(r, b) < 0)
+        return true;
+
+    shift = bigBitLen(r) - bigBitLen(b);
+    if (!bigShl(work, b, shift))
+        return false;
+
+    if (q != NULL)
+    {
+        q->len = shift / 32 + 1;
+        memset(q->limbs, 0, q->len * sizeof(uint32_t));
+    }
+
+    for (size_t bit = shift + 1; bit-- > 0;)
+    {
+        if (bigCmp(r, work) >= 0)
+        {
+            bigSub(r, r, work);
+            if (q != NULL)
+                q->limbs[bit / 32] |= (uint32_t)1 << (bit % 32);
+        }
+        bigShr(work, 1);
+    }
+
+    if (q != NULL)
+        bigTrim(q);
+
+    return true;
+}
+
+/* bigGcd
+ * ...Find the greatest common divisor by the binary method, which needs
+ * ...only shifts and subtraction
+ * ...Parameters:
+ * ......BigNat* g -- receives the divisor
+ * ......const BigNat* a -- first nonzero number
+ * ......const BigNat* b -- second nonzero number
+ * ......BigNat* work -- temporary, distinct from g
+ * ...Returns:
+ * ......false if allocation failed, true otherwise
+ */
+static bool bigGcd(BigNat* g, const BigNat* a, const BigNat* b,
+                   BigNat* work)
+{
+    size_t a_zeros = bigTrailingZeros(a);
+    size_t b_zeros = bigTrailingZeros(b);
+    size_t common = a_zeros < b_zeros ? a_zeros : b_zeros;
+
+    if (!bigCopy(g, a) || !bigCopy(work, b))
+        return false;
+
+    bigShr(g, a_zeros);
+    bigShr(work, b_zeros);
+
+    // Both odd from here on; their difference is even and nonzero until
+    // they meet
+    while (work->len > 0)
+    {
+        if (bigCmp(g, work) > 0)
+            bigSwap(g, work);
+        bigSub(work, work, g);
+        if (work->len > 0)
+            bigShr(work, bigTrailingZeros(work));
+    }
+
+    return bigShl(g, g, common);
+}
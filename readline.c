@@ -0,0 +1,105 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Line input from stdin for the command line program        *
+ *************************************************************/
+
+#include "readline.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+static uint64_t num_allocs = 0; // counted only with CALC_STATS
+
+/* readLine
+ * ...Read a line from stdin, allocating the necessary memory
+ * ...Returns:
+ * ......char* line_data -- pointer to read in characters,
+ * ...... NULL at end of input
+ */
+char* readline()
+{
+    size_t alloc_size = 128;
+    size_t num_char = 0;
+    char* line_data = (char *)malloc(alloc_size);
+    char* cursor;
+    char* temp_line_data;
+
+    STAT_ADD(num_allocs, 1);
+    if (line_data == NULL)
+    {
+        printAllocError();
+        exit(EXIT_FAILURE);
+    }
+
+    while(true)
+    {
+        cursor = line_data + num_char;
+        temp_line_data = fgets(cursor, alloc_size - num_char, stdin);
+
+        if (temp_line_data == NULL)
+        {
+            if (ferror(stdin))
+            {
+                fprintf(stderr, "Error reading from stdin!\n");
+                exit(EXIT_FAILURE);
+            }
+
+            if (num_char > 0)
+                break; // last line had no trailing newline
+
+            free(line_data);
+            return NULL;
+        }
+
+        num_char += strlen(cursor);
+
+        if (num_char < alloc_size - 1 || line_data[num_char - 1] == '\n')
+            break;
+
+        alloc_size *= 2; // geometric growth keeps long lines linear
+
+        line_data = (char *)realloc(line_data, alloc_size);
+        STAT_ADD(num_allocs, 1);
+
+        if (line_data == NULL)
+        {
+            printAllocError();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (line_data[num_char - 1] == '\n')
+        line_data[num_char - 1] = '\0';
+
+    temp_line_data = (char *)realloc(line_data, num_char + 1);
+    STAT_ADD(num_allocs, 1);
+
+    return temp_line_data != NULL ? temp_line_data : line_data;
+}
+
+/* readlineAllocations
+ * ...Report how many heap allocations readline has made, counted only
+ * ...when built with CALC_STATS
+ * ...Returns:
+ * ......the number of malloc and realloc calls made by readline
+ */
+uint64_t readlineAllocations()
+{
+    return num_allocs;
+}
+
+/* printAllocError
+ * ...Print memory allocation error message to stderr, keeping it out of
+ * ...the results on stdout
+ * ...Returns:
+ * ......Nothing
+ */
+void printAllocError()
+{
+    fputs("Memory allocation error\n", stderr);
+}
@@ -0,0 +1,17 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Line input from stdin for the command line program        *
+ *************************************************************/
+
+#ifndef READLINE_H
+#define READLINE_H
+
+#include <stdint.h>
+
+char* readline();
+uint64_t readlineAllocations();
+void printAllocError();
+
+#endif // READLINE_H
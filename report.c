@@ -0,0 +1,144 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Prints the --stats report of the command line program,    *
+ * as aligned text for people or one JSON object for a       *
+ * metrics pipeline                                          *
+ *************************************************************/
+
+#include "report.h"
+#include "stats.h"
+
+#ifndef STAT_CLOCK_NAME
+#define STAT_CLOCK_NAME "none" // built without CALC_STATS
+#endif
+
+static const char* phase_names[CALC_NUM_PHASES] = {
+    "tokenize", "validate", "reduce", "output"
+};
+
+static void printText(FILE*, const CalcStats*, double);
+static void printJson(FILE*, const CalcStats*, double);
+
+/* printStats
+ * ...Print the counters gathered while the program ran
+ * ...Parameters:
+ * ......FILE* out -- stream to print to
+ * ......const CalcStats* stats -- counters of every context, merged
+ * ......double seconds -- wall clock time spent evaluating
+ * ......StatsFormat format -- STATS_TEXT or STATS_JSON
+ * ...Returns:
+ * ......Nothing
+ */
+void printStats(FILE* out, const CalcStats* stats, double seconds,
+                StatsFormat format)
+{
+    if (format == STATS_JSON)
+        printJson(out, stats, seconds);
+    else if (format == STATS_TEXT)
+        printText(out, stats, seconds);
+}
+
+/* printText
+ * ...Print the counters as an aligned table
+ * ...Parameters:
+ * ......FILE* out -- stream to print to
+ * ......const CalcStats* stats -- counters to print
+ * ......double seconds -- wall clock time spent evaluating
+ * ...Returns:
+ * ......Nothing
+ */
+static void printText(FILE* out, const CalcStats* stats, double seconds)
+{
+    uint64_t total_ticks = 0;
+    double per_expr;
+    double share;
+
+    for (int i = 0; i < CALC_NUM_PHASES; i++)
+        total_ticks += stats->cycles[i];
+
+    fprintf(out, "expressions      %llu\n",
+            (unsigned long long)stats->expressions);
+    fprintf(out, "failures         %llu\n",
+            (unsigned long long)stats->failures);
+    fprintf(out, "seconds          %.6f\n", seconds);
+    fprintf(out, "expressions/sec  %.0f\n",
+            seconds > 0.0 ? stats->expressions / seconds : 0.0);
+    fprintf(out, "bytes            %llu\n",
+            (unsigned long long)stats->bytes);
+    fprintf(out, "allocations      %llu\n",
+            (unsigned long long)stats->allocations);
+    fprintf(out, "cache hits       %llu\n",
+            (unsigned long long)stats->cache_hits);
+    fprintf(out, "cache misses     %llu\n",
+            (unsigned long long)stats->cache_misses);
+
+    fprintf(out, "\n%-16s %16s %12s %8s\n", "phase",
+            STAT_CLOCK_NAME " ticks", "per expr", "share");
+    for (int i = 0; i < CALC_NUM_PHASES; i++)
+    {
+        per_expr = stats->expressions > 0
+                   ? (double)stats->cycles[i] / stats->expressions : 0.0;
+        share = total_ticks > 0
+                ? 100.0 * stats->cycles[i] / total_ticks : 0.0;
+        fprintf(out, "%-16s %16llu %12.1f %7.1f%%\n", phase_names[i],
+                (unsigned long long)stats->cycles[i], per_expr, share);
+    }
+
+    fprintf(out, "\n%-16s %16s\n", "latency ticks", "expressions");
+    for (int i = 0; i < CALC_LATENCY_BUCKETS; i++)
+    {
+        if (stats->latency[i] > 0)
+            fprintf(out, "< 2^%-12d %16llu\n", i + 1,
+                    (unsigned long long)stats->latency[i]);
+    }
+}
+
+/* printJson
+ * ...Print the counters as a single-line JSON object
+ * ...Parameters:
+ * ......FILE* out -- stream to print to
+ * ......const CalcStats* stats -- counters to print
+ * ......double seconds -- wall clock time spent evaluating
+ * ...Returns:
+ * ......Nothing
+ */
+static void printJson(FILE* out, const CalcStats* stats, double seconds)
+{
+    bool first = true;
+
+    fprintf(out, "{\"expressions\":%llu,\"failures\":%llu,"
+                 "\"seconds\":%.6f,\"expressions_per_sec\":%.0f,"
+                 "\"bytes\":%llu,\"allocations\":%llu,"
+                 "\"cache_hits\":%llu,\"cache_misses\":%llu,"
+                 "\"clock\":\"%s\"",
+            (unsigned long long)stats->expressions,
+            (unsigned long long)stats->failures, seconds,
+            seconds > 0.0 ? stats->expressions / seconds : 0.0,
+            (unsigned long long)stats->bytes,
+            (unsigned long long)stats->allocations,
+            (unsigned long long)stats->cache_hits,
+            (unsigned long long)stats->cache_misses, STAT_CLOCK_NAME);
+
+    fprintf(out, ",\"phase_ticks\":{");
+    for (int i = 0; i < CALC_NUM_PHASES; i++)
+    {
+        fprintf(out, "%s\"%s\":%llu", i > 0 ? "," : "", phase_names[i],
+                (unsigned long long)stats->cycles[i]);
+    }
+
+    // Non-empty buckets only, each with its exclusive upper bound
+    fprintf(out, "},\"latency\":[");
+    for (int i = 0; i < CALC_LATENCY_BUCKETS; i++)
+    {
+        if (stats->latency[i] == 0)
+            continue;
+
+        fprintf(out, "%s{\"below_ticks\":%llu,\"count\":%llu}",
+                first ? "" : ",", 2ULL << i,
+                (unsigned long long)stats->latency[i]);
+        first = false;
+    }
+    fprintf(out, "]}\n");
+}
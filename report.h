@@ -0,0 +1,19 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Prints the --stats report of the command line program     *
+ *************************************************************/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "calc.h"
+#include "cli.h"
+
+#include <stdio.h>
+
+void printStats(FILE* out, const CalcStats* stats, double seconds,
+                StatsFormat format);
+
+#endif // REPORT_H
@@ -0,0 +1,723 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Serves expressions over sockets, as lines of text or as   *
+ * binary frames. Each worker thread runs its own epoll loop *
+ * and evaluator context and owns the connections it         *
+ * accepts; pipelined requests are answered with one write   *
+ * per batch of input                                        *
+ *************************************************************/
+
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "calc.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Events handled per epoll_wait call
+#define MAX_EVENTS 64
+
+// Input read per call, and the smallest input buffer
+#define READ_SIZE (64 * 1024)
+
+// Unsent output beyond which a connection stops evaluating until the
+// client reads, so a client that never reads cannot exhaust memory
+#define MAX_UNSENT (1024 * 1024)
+
+// Longest line accepted; a longer one closes the connection
+#define MAX_LINE (16 * 1024 * 1024)
+
+typedef struct Connection
+{
+    int fd;
+    bool listening;          // a listening socket, shared by the workers
+    bool closing;            // close once the output is sent
+    char* in;
+    size_t in_len;
+    size_t in_cap;
+    char* out;
+    size_t out_len;
+    size_t out_sent;         // characters of out already written
+    size_t out_cap;
+    struct Connection* prev; // the worker's open connections
+    struct Connection* next;
+} Connection;
+
+typedef struct
+{
+    int epoll_fd;
+    CalcContext ctx;
+    ResultCache cache;
+    const CliOptions* opts;
+    Connection* connections;
+    pthread_t thread;
+} ServerWorker;
+
+static int openListener(const char*);
+static bool setupWorker(ServerWorker*, Connection*, int, int);
+static void closeListeners(Connection*, const char* const*, int);
+static void* serverMain(void*);
+static void acceptConnection(ServerWorker*, int);
+static bool serviceConnection(ServerWorker*, Connection*);
+static bool evalLines(ServerWorker*, Connection*);
+static bool evalFrames(ServerWorker*, Connection*);
+static bool appendReply(Connection*, const CalcContext*, CalcStatus,
+                        double, const CliOptions*);
+static bool flushOutput(Connection*);
+static bool reserveBuffer(char**, size_t*, size_t);
+static void closeConnection(ServerWorker*, Connection*);
+
+/* runServer
+ * ...Listen on every address and answer expressions until SIGINT or
+ * ...SIGTERM. Each line a client sends gets one line back, the result
+ * ...or the error message, in order; a quit line closes the connection
+ * ...Parameters:
+ * ......const char* const* addrs -- addresses to listen on: [HOST:]PORT
+ * ...... for TCP, or unix:PATH for a Unix domain socket
+ * ......int num_addrs -- number of entries in addrs
+ * ......const CliOptions* opts -- command line options, num_threads
+ * ...... sets the number of worker threads
+ * ......CalcStats* stats -- receives the counters of every worker
+ * ...Returns:
+ * ......EXIT_SUCCESS after a clean shutdown, EXIT_FAILURE otherwise
+ */
+int runServer(const char* const* addrs, int num_addrs,
+              const CliOptions* opts, CalcStats* stats)
+{
+    Connection listeners[MAX_LISTENERS];
+    ServerWorker* workers;
+    sigset_t signals;
+    int num_threads = opts->num_threads;
+    int num_ready = 0;
+    int wake_fd;
+    int sig;
+    uint64_t one = 1;
+
+    for (int i = 0; i < num_addrs; i++)
+    {
+        memset(&listeners[i], 0, sizeof(listeners[i]));
+        listeners[i].listening = true;
+        listeners[i].fd = openListener(addrs[i]);
+        if (listeners[i].fd < 0)
+        {
+            closeListeners(listeners, addrs, i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    workers = (ServerWorker *)calloc(num_threads, sizeof(ServerWorker));
+
+    // Every worker's epoll instance is set up before any thread starts,
+    // so a failure leaves nothing running
+    if (wake_fd >= 0 && workers != NULL)
+    {
+        while (num_ready < num_threads
+               && setupWorker(&workers[num_ready], listeners, num_addrs,
+                              wake_fd))
+        {
+            workers[num_ready].opts = opts;
+            initContext(&workers[num_ready].ctx);
+            workers[num_ready].ctx.mode = opts->mode;
+            initCache(&workers[num_ready].cache,
+                      opts->cache_size / num_threads);
+            if (opts->cache_size > 0)
+                workers[num_ready].ctx.cache = &workers[num_ready].cache;
+            num_ready++;
+        }
+    }
+
+    if (num_ready < num_threads)
+    {
+        fprintf(stderr, "Cannot start server: %s\n", strerror(errno));
+        for (int i = 0; i < num_ready; i++)
+        {
+            close(workers[i].epoll_fd);
+            freeContext(&workers[i].ctx);
+            freeCache(&workers[i].cache);
+        }
+        closeListeners(listeners, addrs, num_addrs);
+        if (wake_fd >= 0)
+            close(wake_fd);
+        free(workers);
+        return EXIT_FAILURE;
+    }
+
+    // Workers inherit the mask, so only sigwait below sees the signals
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, serverMain,
+                           &workers[i]) != 0)
+        {
+            fprintf(stderr, "Cannot start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sigwait(&signals, &sig);
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one))
+        fprintf(stderr, "Cannot stop worker threads\n");
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].epoll_fd);
+        mergeStats(stats, &workers[i].ctx.stats);
+        freeContext(&workers[i].ctx);
+        freeCache(&workers[i].cache);
+    }
+
+    closeListeners(listeners, addrs, num_addrs);
+    close(wake_fd);
+    free(workers);
+
+    return EXIT_SUCCESS;
+}
+
+/* setupWorker
+ * ...Create a worker's epoll instance and register the listeners and
+ * ...the shutdown signal with it
+ * ...Parameters:
+ * ......ServerWorker* worker -- worker whose epoll_fd is set
+ * ......Connection* listeners -- the listening sockets
+ * ......int num_listeners -- number of entries in listeners
+ * ......int wake_fd -- eventfd written to stop the workers
+ * ...Returns:
+ * ......true if sucessful, false with errno set and no epoll instance
+ * ...... left open otherwise
+ */
+static bool setupWorker(ServerWorker* worker, Connection* listeners,
+                        int num_listeners, int wake_fd)
+{
+    struct epoll_event event;
+    int saved_errno;
+
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epoll_fd < 0)
+        return false;
+
+    // Exclusive, so a new connection wakes one worker, not all
+    for (int i = 0; i <= num_listeners; i++)
+    {
+        event.events = i < num_listeners ? EPOLLIN | EPOLLEXCLUSIVE
+                                         : EPOLLIN;
+        // NULL marks the shutdown signal
+        event.data.ptr = i < num_listeners ? &listeners[i] : NULL;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD,
+                      i < num_listeners ? listeners[i].fd : wake_fd,
+                      &event) != 0)
+        {
+            saved_errno = errno;
+            close(worker->epoll_fd);
+            errno = saved_errno;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* closeListeners
+ * ...Close listening sockets and remove the files of the Unix ones
+ * ...Parameters:
+ * ......Connection* listeners -- the listening sockets
+ * ......const char* const* addrs -- the address each was opened on
+ * ......int num_listeners -- number of sockets to close
+ * ...Returns:
+ * ......Nothing
+ */
+static void closeListeners(Connection* listeners, const char* const* addrs,
+                           int num_listeners)
+{
+    for (int i = 0; i < num_listeners; i++)
+    {
+        close(listeners[i].fd);
+        if (strncmp(addrs[i], "unix:", 5) == 0)
+            unlink(addrs[i] + 5);
+    }
+}
+
+/* openListener
+ * ...Create a non-blocking socket listening on an address
+ * ...Parameters:
+ * ......const char* addr -- [HOST:]PORT, [IPV6]:PORT or unix:PATH
+ * ...Returns:
+ * ......the listening socket, -1 with a message on stderr on failure
+ */
+static int openListener(const char* addr)
+{
+    struct sockaddr_un unix_addr;
+    struct addrinfo hints;
+    struct addrinfo* info;
+    struct stat path_info;
+    char host[256];
+    const char* port = strrchr(addr, ':');
+    size_t host_len;
+    int fd = -1;
+    int on = 1;
+
+    if (strncmp(addr, "unix:", 5) == 0)
+    {
+        memset(&unix_addr, 0, sizeof(unix_addr));
+        unix_addr.sun_family = AF_UNIX;
+        if (strlen(addr + 5) >= sizeof(unix_addr.sun_path))
+        {
+            fprintf(stderr, "Socket path too long: %s\n", addr + 5);
+            return -1;
+        }
+        strcpy(unix_addr.sun_path, addr + 5);
+
+        // Replace a socket left by an earlier run, but no other file
+        if (lstat(unix_addr.sun_path, &path_info) == 0
+            && S_ISSOCK(path_info.st_mode))
+            unlink(unix_addr.sun_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0
+            || bind(fd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) != 0
+            || listen(fd, SOMAXCONN) != 0)
+        {
+            fprintf(stderr, "Cannot listen on %s: %s\n", addr,
+                    strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    // Split off the port, removing brackets from an IPv6 host
+    host_len = port != NULL ? (size_t)(port - addr) : 0;
+    port = port != NULL ? port + 1 : addr;
+    if (host_len >= 2 && addr[0] == '[' && addr[host_len - 1] == ']')
+    {
+        addr++;
+        host_len -= 2;
+    }
+    if (host_len >= sizeof(host))
+    {
+        fprintf(stderr, "Host name too long: %s\n", addr);
+        return -1;
+    }
+    memcpy(host, addr, host_len);
+    host[host_len] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host_len > 0 ? host : NULL, port, &hints, &info) != 0)
+    {
+        fprintf(stderr, "Cannot resolve %s\n", addr);
+        return -1;
+    }
+
+    fd = socket(info->ai_family,
+                info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                info->ai_protocol);
+    if (fd >= 0)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (fd < 0 || bind(fd, info->ai_addr, info->ai_addrlen) != 0
+        || listen(fd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Cannot listen on %s: %s\n", addr, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(info);
+
+    return fd;
+}
+
+/* serverMain
+ * ...Worker thread body: wait for socket events and service them until
+ * ...the shutdown signal, then close every connection this worker owns
+ * ...Parameters:
+ * ......void* arg -- the ServerWorker running on this thread
+ * ...Returns:
+ * ......NULL
+ */
+static void* serverMain(void* arg)
+{
+    ServerWorker* worker = (ServerWorker *)arg;
+    struct epoll_event events[MAX_EVENTS];
+    Connection* conn;
+    bool running = true;
+    int num_events;
+
+    while (running)
+    {
+        num_events = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+        if (num_events < 0 && errno != EINTR)
+            break;
+
+        for (int i = 0; i < num_events; i++)
+        {
+            conn = (Connection *)events[i].data.ptr;
+
+            if (conn == NULL)
+                running = false;
+            else if (conn->listening)
+                acceptConnection(worker, conn->fd);
+            else if (!serviceConnection(worker, conn))
+                closeConnection(worker, conn);
+        }
+    }
+
+    while (worker->connections != NULL)
+        closeConnection(worker, worker->connections);
+
+    return NULL;
+}
+
+/* acceptConnection
+ * ...Accept one pending connection and add it to this worker's loop.
+ * ...Taking one at a time lets the other workers take the rest
+ * ...Parameters:
+ * ......ServerWorker* worker -- worker that will own the connection
+ * ......int listen_fd -- listening socket with a pending connection
+ * ...Returns:
+ * ......Nothing
+ */
+static void acceptConnection(ServerWorker* worker, int listen_fd)
+{
+    struct epoll_event event;
+    Connection* conn;
+    int on = 1;
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd < 0)
+        return; // another worker took it, or the client already left
+
+    // Replies go out as soon as they are written, not after a delay
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    conn = (Connection *)calloc(1, sizeof(Connection));
+    if (conn == NULL)
+    {
+        close(fd);
+        return;
+    }
+    conn->fd = fd;
+
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = conn;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        close(fd);
+        free(conn);
+        return;
+    }
+
+    conn->next = worker->connections;
+    if (worker->connections != NULL)
+        worker->connections->prev = conn;
+    worker->connections = conn;
+}
+
+/* serviceConnection
+ * ...Read, evaluate and write for a connection until it would block.
+ * ...Events are edge-triggered, so this keeps going until the socket
+ * ...has no input left or cannot take more output
+ * ...Parameters:
+ * ......ServerWorker* worker -- worker owning the connection
+ * ......Connection* conn -- connection with a pending event
+ * ...Returns:
+ * ......false if the connection should be closed, true otherwise
+ */
+static bool serviceConnection(ServerWorker* worker, Connection* conn)
+{
+    ssize_t num_read;
+
+    while (true)
+    {
+        if (!flushOutput(conn))
+            return false;
+        if (conn->out_len - conn->out_sent > MAX_UNSENT)
+            return true; // wait until the client reads
+        if (conn->closing)
+            return conn->out_sent < conn->out_len;
+
+        if (worker->opts->binary ? evalFrames(worker, conn)
+                                 : evalLines(worker, conn))
+            continue; // send the replies before reading more
+
+        if (conn->in_len >= MAX_LINE
+            || !reserveBuffer(&conn->in, &conn->in_cap,
+                              conn->in_len + READ_SIZE))
+            return false;
+
+        num_read = read(conn->fd, conn->in + conn->in_len,
+                        conn->in_cap - conn->in_len);
+
+        if (num_read > 0)
+            conn->in_len += (size_t)num_read;
+        else if (num_read == 0)
+        {   // the client is done sending; answer an unterminated line
+            if (conn->in_len > 0 && !worker->opts->binary)
+            {
+                conn->in[conn->in_len++] = '\n'; // room left by reserve
+                evalLines(worker, conn);
+            }
+            conn->closing = true;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        else if (errno != EINTR)
+            return false;
+    }
+}
+
+/* evalLines
+ * ...Evaluate the complete lines waiting in a connection's input and
+ * ...queue their replies, stopping early once enough output is unsent
+ * ...Parameters:
+ * ......ServerWorker* worker -- worker owning the connection
+ * ......Connection* conn -- connection to evaluate for
+ * ...Returns:
+ * ......true if any line was evaluated, false otherwise
+ */
+static bool evalLines(ServerWorker* worker, Connection* conn)
+{
+    CalcContext* ctx = &worker->ctx;
+    const char* line = conn->in;
+    const char* end = conn->in + conn->in_len;
+    const char* line_end;
+    size_t line_len;
+    double result;
+    CalcStatus status;
+    bool any = false;
+
+    while (line < end && conn->out_len - conn->out_sent <= MAX_UNSENT)
+    {
+        line_end = (const char *)memchr(line, '\n', end - line);
+        if (line_end == NULL)
+            break;
+
+        line_len = line_end - line;
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line_len--; // telnet and friends end lines with \r\n
+        any = true;
+
+        if (line_len == 4 && memcmp(line, "quit", 4) == 0)
+        {
+            conn->closing = true;
+            line = end;
+            break;
+        }
+
+        status = evalExpression(ctx, line, line_len, &result);
+        STAT_START(output_start);
+        if (!appendReply(conn, ctx, status, result, worker->opts))
+        {
+            conn->closing = true;
+            line = end;
+            break;
+        }
+        STAT_PHASE(&ctx->stats, CALC_PHASE_OUTPUT, output_start);
+
+        line = line_end + 1;
+    }
+
+    conn->in_len = end - line;
+    memmove(conn->in, line, conn->in_len);
+
+    return any;
+}
+
+/* evalFrames
+ * ...Evaluate the complete binary mode frames waiting in a connection's
+ * ...input and queue their replies, stopping early once enough output
+ * ...is unsent
+ * ...Parameters:
+ * ......ServerWorker* worker -- worker owning the connection
+ * ......Connection* conn -- connection to evaluate for
+ * ...Returns:
+ * ......true if any frame was evaluated, false otherwise
+ */
+static bool evalFrames(ServerWorker* worker, Connection* conn)
+{
+    CalcContext* ctx = &worker->ctx;
+    const unsigned char* frame = (const unsigned char *)conn->in;
+    const unsigned char* end = frame + conn->in_len;
+    size_t len;
+    double result;
+    CalcStatus status;
+    bool any = false;
+
+    while (end - frame >= WIRE_HEADER_SIZE
+           && conn->out_len - conn->out_sent <= MAX_UNSENT)
+    {
+        len = wireLength(frame);
+        if (len > MAX_LINE)
+        {
+            conn->closing = true;
+            frame = end;
+            break;
+        }
+        if ((size_t)(end - frame) - WIRE_HEADER_SIZE < len)
+            break; // the rest of the frame has not arrived
+
+        if (!reserveBuffer(&conn->out, &conn->out_cap,
+                           conn->out_len + WIRE_REPLY_SIZE))
+        {
+            conn->closing = true;
+            frame = end;
+            break;
+        }
+
+        status = evalBinary(ctx, frame + WIRE_HEADER_SIZE, len, &result);
+        formatWireReply(status, result,
+                        (unsigned char *)conn->out + conn->out_len);
+        conn->out_len += WIRE_REPLY_SIZE;
+
+        frame += WIRE_HEADER_SIZE + len;
+        any = true;
+    }
+
+    conn->in_len = end - frame;
+    memmove(conn->in, frame, conn->in_len);
+
+    return any;
+}
+
+/* appendReply
+ * ...Queue the reply line for one evaluated expression
+ * ...Parameters:
+ * ......Connection* conn -- connection to reply on
+ * ......const CalcContext* ctx -- context the expression was evaluated in
+ * ......CalcStatus status -- code returned by evalExpression
+ * ......double result -- value to send when status is CALC_OK
+ * ......const CliOptions* opts -- command line options
+ * ...Returns:
+ * ......false if the output buffer could not be grown, true otherwise
+ */
+static bool appendReply(Connection* conn, const CalcContext* ctx,
+                        CalcStatus status, double result,
+                        const CliOptions* opts)
+{
+    size_t need = status == CALC_OK ? RESULT_STR_SIZE + 1
+                  : ctx->error_len + ERROR_MESSAGE_SIZE + 1;
+
+    if (!reserveBuffer(&conn->out, &conn->out_cap, conn->out_len + need))
+        return false;
+
+    if (status == CALC_OK)
+        conn->out_len += formatValue(opts, result, conn->out + conn->out_len);
+    else
+        conn->out_len += formatError(ctx, status, conn->out + conn->out_len);
+    conn->out[conn->out_len++] = '\n';
+
+    return true;
+}
+
+/* flushOutput
+ * ...Write as much queued output as the socket takes
+ * ...Parameters:
+ * ......Connection* conn -- connection to write
+ * ...Returns:
+ * ......false if the client is gone, true otherwise
+ */
+static bool flushOutput(Connection* conn)
+{
+    ssize_t num_sent;
+
+    while (conn->out_sent < conn->out_len)
+    {
+        num_sent = send(conn->fd, conn->out + conn->out_sent,
+                        conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (num_sent > 0)
+            conn->out_sent += (size_t)num_sent;
+        else if (num_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        else if (num_sent < 0 && errno == EINTR)
+            continue;
+        else
+            return false;
+    }
+
+    conn->out_len = 0;
+    conn->out_sent = 0;
+
+    return true;
+}
+
+/* reserveBuffer
+ * ...Make sure a connection buffer holds at least size characters,
+ * ...doubling its capacity when it needs to grow
+ * ...Parameters:
+ * ......char** buf -- buffer to grow
+ * ......size_t* cap -- capacity of buf, updated on growth
+ * ......size_t size -- number of characters required
+ * ...Returns:
+ * ......false if the buffer could not be grown, true otherwise
+ */
+static bool reserveBuffer(char** buf, size_t* cap, size_t size)
+{
+    size_t new_cap = *cap > 0 ? *cap : READ_SIZE;
+    char* new_buf;
+
+    if (size <= *cap)
+        return true;
+
+    while (new_cap < size)
+        new_cap *= 2;
+
+    new_buf = (char *)realloc(*buf, new_cap);
+    if (new_buf == NULL)
+        return false;
+
+    *buf = new_buf;
+    *cap = new_cap;
+
+    return true;
+}
+
+/* closeConnection
+ * ...Close a connection and release its buffers
+ * ...Parameters:
+ * ......ServerWorker* worker -- worker owning the connection
+ * ......Connection* conn -- connection to close
+ * ...Returns:
+ * ......Nothing
+ */
+static void closeConnection(ServerWorker* worker, Connection* conn)
+{
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        worker->connections = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+
+    close(conn->fd); // also removes it from the epoll set
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
@@ -0,0 +1,20 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Network server mode: newline-separated expressions over   *
+ * TCP or Unix domain sockets                                *
+ *************************************************************/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "cli.h"
+
+// Most addresses one server listens on
+#define MAX_LISTENERS 8
+
+int runServer(const char* const* addrs, int num_addrs,
+              const CliOptions* opts, CalcStats* stats);
+
+#endif // SERVER_H
@@ -0,0 +1,354 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Evaluates one very long expression on several threads by *
+ * cutting it between the terms of its top-level sum. Each  *
+ * thread parses and evaluates a run of terms, and the term *
+ * values are added in the order written                    *
+ *************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc.h"
+#include "calc_internal.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <pthread.h>
+
+typedef struct
+{
+    CalcContext* ctx;
+    const char* begin; // the piece: a slice while counting parentheses,
+    const char* end;   // then a run of whole terms
+    long depth;        // parentheses opened and not closed in the slice
+    char first_op;     // OP_ADD or OP_SUB applied to the first term
+    size_t num_terms;  // term values left in ctx->stacks
+    CalcStatus status;
+    pthread_t thread;
+} Segment;
+
+static void runSegments(Segment*, int, void* (*)(void*));
+static void* countParens(void*);
+static void* evalSegment(void*);
+static const char* findBoundary(const char*, const char*, const char*,
+                                long);
+static size_t countTerms(const char*, const char*);
+
+/* evalExpressionParallel
+ * ...Evaluate a long expression on several threads. It is cut at + and
+ * ...- outside parentheses into runs of terms of similar length, each
+ * ...run is evaluated on a thread of its own, and the values of all the
+ * ...terms are then added from left to right, so the result is that of
+ * ...evalExpression to the last bit. An expression too short to be
+ * ...worth splitting, or one that fails anywhere, is handed to
+ * ...evalExpression on the first context
+ * ...Parameters:
+ * ......CalcContext* const* ctxs -- evaluator contexts, one per thread,
+ * ...... none used by another thread during the call
+ * ......int num_ctx -- number of entries in ctxs, at least 1
+ * ......const char* exp -- characters of the expression, need not be
+ * ...... NUL-terminated and are never modified
+ * ......size_t len -- number of characters in exp
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ * ...... failures are those of evalExpression, with ctxs[0]->error_token
+ * ...... and ctxs[0]->error_len identifying a bad token
+ * ...... outside CALC_MODE_DOUBLE, and for ctxs[0]->cache, the expression
+ * ...... is left to evalExpression
+ */
+CalcStatus evalExpressionParallel(CalcContext* const* ctxs, int num_ctx,
+                                  const char* exp, size_t len,
+                                  double* result)
+{
+    const char* end = exp + len;
+    const char** cuts;
+    Segment* segs;
+    CalcContext* ctx;
+    long depth = 0;
+    double total;
+    int num_segs = len / SPLIT_MIN_SIZE < (size_t)num_ctx
+                   ? (int)(len / SPLIT_MIN_SIZE) : num_ctx;
+#ifdef CALC_STATS
+    uint64_t start = statClock();
+#endif
+
+    if (num_segs < 2 || ctxs[0]->mode != CALC_MODE_DOUBLE
+        || ctxs[0]->cache != NULL)
+        return evalExpression(ctxs[0], exp, len, result);
+
+    segs = (Segment *)calloc(num_segs, sizeof(Segment));
+    cuts = (const char **)malloc(sizeof(const char*) * (num_segs + 1));
+    if (segs == NULL || cuts == NULL)
+    {
+        free(segs);
+        free(cuts);
+        return evalExpression(ctxs[0], exp, len, result);
+    }
+
+    // Count parentheses in equal slices, giving the depth at each slice
+    // start, then cut at the first boundary of the sum after it
+    for (int i = 0; i < num_segs; i++)
+    {
+        segs[i].ctx = ctxs[i];
+        segs[i].begin = exp + len / num_segs * i;
+        segs[i].end = i == num_segs - 1 ? end
+                                        : exp + len / num_segs * (i + 1);
+    }
+    runSegments(segs, num_segs, countParens);
+
+    cuts[0] = exp;
+    cuts[num_segs] = end;
+    for (int i = 1; i < num_segs; i++)
+    {
+        depth += segs[i - 1].depth;
+        cuts[i] = findBoundary(exp, segs[i].begin, end, depth);
+    }
+
+    // The first run starts at exp, every other one after its operator;
+    // a run whose cut is that of the next one is empty
+    for (int i = 0; i < num_segs; i++)
+    {
+        segs[i].begin = i == 0 ? exp : cuts[i] + 1;
+        segs[i].end = cuts[i + 1];
+        segs[i].first_op = i > 0 && *cuts[i] == '-' ? OP_SUB : OP_ADD;
+        segs[i].status = CALC_OK;
+        segs[i].num_terms = 0;
+        if (i > 0 && (cuts[i] == end || cuts[i] == cuts[i + 1]))
+            segs[i].begin = segs[i].end = NULL;
+    }
+    runSegments(segs, num_segs, evalSegment);
+
+    for (int i = 0; i < num_segs; i++)
+    {
+        if (segs[i].status != CALC_OK)
+        {   // the serial evaluator reports exactly what failed
+            free(segs);
+            free(cuts);
+            return evalExpression(ctxs[0], exp, len, result);
+        }
+    }
+
+    total = ctxs[0]->stacks.operands[0];
+    for (int i = 0; i < num_segs; i++)
+    {
+        ctx = segs[i].ctx;
+        for (size_t t = i == 0 ? 1 : 0; t < segs[i].num_terms; t++)
+            total = applyOp(total, ctx->stacks.operands[t],
+                            (OpCode)ctx->stacks.operators[t]);
+    }
+
+    free(segs);
+    free(cuts);
+
+    ctxs[0]->error_token = NULL;
+    ctxs[0]->error_len = 0;
+    *result = total;
+#ifdef CALC_STATS
+    recordEval(&ctxs[0]->stats, CALC_OK, len, statClock() - start);
+#endif
+    if (ctxs[0]->errors != NULL)
+        recordError(ctxs[0]->errors, ctxs[0], CALC_OK, exp, len);
+
+    return CALC_OK;
+}
+
+/* runSegments
+ * ...Call a function on every segment, the first on the calling thread
+ * ...and the others on threads of their own, and wait for all of them.
+ * ...A segment whose thread cannot be started runs on the calling thread
+ * ...Parameters:
+ * ......Segment* segs -- segments to work on
+ * ......int num_segs -- number of entries in segs
+ * ......void* (*fn)(void*) -- function given each segment
+ * ...Returns:
+ * ......Nothing
+ */
+static void runSegments(Segment* segs, int num_segs, void* (*fn)(void*))
+{
+    bool* started = (bool *)calloc(num_segs, sizeof(bool));
+
+    for (int i = 1; i < num_segs; i++)
+    {
+        if (started != NULL)
+            started[i] = pthread_create(&segs[i].thread, NULL, fn,
+                                        &segs[i]) == 0;
+    }
+
+    for (int i = 0; i < num_segs; i++)
+    {
+        if (started == NULL || !started[i])
+            fn(&segs[i]);
+    }
+
+    for (int i = 1; i < num_segs; i++)
+    {
+        if (started != NULL && started[i])
+            pthread_join(segs[i].thread, NULL);
+    }
+
+    free(started);
+}
+
+/* countParens
+ * ...Count the parentheses a slice leaves open, negative if it closes
+ * ...more than it opens
+ * ...Parameters:
+ * ......void* arg -- the Segment holding the slice
+ * ...Returns:
+ * ......NULL
+ */
+static void* countParens(void* arg)
+{
+    Segment* seg = (Segment *)arg;
+    long depth = 0;
+
+    for (const char* p = seg->begin; p < seg->end; p++)
+        depth += (*p == '(') - (*p == ')');
+
+    seg->depth = depth;
+
+    return NULL;
+}
+
+/* evalSegment
+ * ...Parse and evaluate a run of terms, leaving the value of each term
+ * ...and the operator before it in ctx->stacks, in the order written
+ * ...Parameters:
+ * ......void* arg -- the Segment holding the run, empty if begin is NULL
+ * ...Returns:
+ * ......NULL
+ */
+static void* evalSegment(void* arg)
+{
+    Segment* seg = (Segment *)arg;
+    CalcContext* ctx = seg->ctx;
+    ExprNode* root;
+    ExprNode* node;
+    double value;
+    size_t t;
+
+    if (seg->begin == NULL)
+        return NULL;
+
+    seg->status = parseTree(ctx, seg->begin, seg->end - seg->begin,
+                            NULL, 0, &root);
+    if (seg->status == CALC_OK)
+        seg->status = evalTree(ctx, NULL, &value);
+    if (seg->status != CALC_OK)
+        return NULL;
+
+    // The terms are the right operands down the left spine of a + b - c
+    // ..., and the node the spine ends at. Parentheses leave no node, so
+    // the spine is only as long as the run has boundaries: in (a + b) - c
+    // the first term is a + b
+    seg->num_terms = countTerms(seg->begin, seg->end);
+
+    if (!reserveStacks(&ctx->stacks, seg->num_terms))
+    {
+        seg->status = CALC_NO_MEMORY;
+        return NULL;
+    }
+
+    node = root;
+    for (t = seg->num_terms - 1; t > 0; t--)
+    {
+        ctx->stacks.operands[t] = node->right->value;
+        ctx->stacks.operators[t] = node->op;
+        node = node->left;
+    }
+    ctx->stacks.operands[0] = node->value;
+    ctx->stacks.operators[0] = seg->first_op;
+
+    return NULL;
+}
+
+/* findBoundary
+ * ...Find the first + or - at or after a position that joins two terms
+ * ...of the top-level sum: outside parentheses, and following a number
+ * ...or a closing parenthesis, so neither a sign nor part of an exponent
+ * ...Parameters:
+ * ......const char* exp -- first character of the expression
+ * ......const char* from -- where the search starts
+ * ......const char* end -- one past the last character of the expression
+ * ......long depth -- parentheses open at from
+ * ...Returns:
+ * ......the operator found, end if there is none
+ */
+static const char* findBoundary(const char* exp, const char* from,
+                                const char* end, long depth)
+{
+    const char* p = from;
+    char last = '\0';
+
+    for (const char* q = from; q > exp; q--)
+    {
+        if (!isspace((unsigned char)q[-1]))
+        {
+            last = q[-1];
+            break;
+        }
+    }
+
+    for (; p < end; p++)
+    {
+        if ((*p == '+' || *p == '-') && depth == 0
+            && (isdigit((unsigned char)last) || last == '.' || last == ')'))
+            return p;
+
+        depth += (*p == '(') - (*p == ')');
+        if (!isspace((unsigned char)*p))
+            last = *p;
+    }
+
+    return end;
+}
+
+/* countTerms
+ * ...Count the terms of a sum, one more than the + and - in it that
+ * ...findBoundary would stop at
+ * ...Parameters:
+ * ......const char* begin -- first character of the sum
+ * ......const char* end -- one past its last character
+ * ...Returns:
+ * ......the number of terms
+ */
+static size_t countTerms(const char* begin, const char* end)
+{
+    size_t count = 1;
+    long depth = 0;
+    bool operand = false; // the last char that is not a space ends one
+
+    for (const char* p = begin; p < end; p++)
+    {
+        switch (*p)
+        {
+            case '(':
+                depth++;
+                operand = false;
+                break;
+
+            case ')':
+                depth--;
+                operand = true;
+                break;
+
+            case '+':
+            case '-':
+                count += depth == 0 && operand;
+                operand = false;
+                break;
+
+            default:
+                if (!isspace((unsigned char)*p))
+                    operand = isdigit((unsigned char)*p) || *p == '.';
+                break;
+        }
+    }
+
+    return count;
+}
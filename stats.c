@@ -0,0 +1,62 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Accumulates and combines the per-context counters kept    *
+ * when the library is built with CALC_STATS                 *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+/* recordEval
+ * ...Count one evaluated expression and add its latency to the histogram
+ * ...Parameters:
+ * ......CalcStats* stats -- counters of the evaluating context
+ * ......CalcStatus status -- outcome of the evaluation
+ * ......size_t len -- number of characters in the expression
+ * ......uint64_t ticks -- clock ticks the evaluation took
+ * ...Returns:
+ * ......Nothing
+ */
+void recordEval(CalcStats* stats, CalcStatus status, size_t len,
+                uint64_t ticks)
+{
+    int bucket = 0;
+
+    while (ticks > 1 && bucket < CALC_LATENCY_BUCKETS - 1)
+    {
+        ticks >>= 1;
+        bucket++;
+    }
+
+    stats->expressions++;
+    stats->bytes += len;
+    stats->latency[bucket]++;
+    if (status != CALC_OK)
+        stats->failures++;
+}
+
+/* mergeStats
+ * ...Add one context's counters into a running total, for example to
+ * ...combine the contexts of several worker threads
+ * ...Parameters:
+ * ......CalcStats* total -- counters to add to
+ * ......const CalcStats* stats -- counters to add
+ * ...Returns:
+ * ......Nothing
+ */
+void mergeStats(CalcStats* total, const CalcStats* stats)
+{
+    total->expressions += stats->expressions;
+    total->failures += stats->failures;
+    total->bytes += stats->bytes;
+    total->allocations += stats->allocations;
+    total->cache_hits += stats->cache_hits;
+    total->cache_misses += stats->cache_misses;
+
+    for (int i = 0; i < CALC_NUM_PHASES; i++)
+        total->cycles[i] += stats->cycles[i];
+    for (int i = 0; i < CALC_LATENCY_BUCKETS; i++)
+        total->latency[i] += stats->latency[i];
+}
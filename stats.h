@@ -0,0 +1,61 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Hot-path counters and phase timers. They only exist when  *
+ * built with CALC_STATS defined (make STATS=1); otherwise   *
+ * every STAT_ macro expands to nothing                      *
+ *************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "calc.h"
+
+#include <stdint.h>
+
+#ifdef CALC_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STAT_CLOCK_NAME "tsc"
+#elif defined(__aarch64__)
+#define STAT_CLOCK_NAME "cntvct"
+#else
+#include <time.h>
+#define STAT_CLOCK_NAME "clock"
+#endif
+
+/* statClock
+ * ...Read the cheapest fine-grained clock the target has: the time stamp
+ * ...counter on x86, the virtual counter on AArch64, clock() elsewhere
+ * ...Returns:
+ * ......the current clock reading in ticks
+ */
+static inline uint64_t statClock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return (uint64_t)clock();
+#endif
+}
+
+#define STAT_START(var) uint64_t var = statClock()
+#define STAT_PHASE(stats, phase, start) \
+    ((stats)->cycles[phase] += statClock() - (start))
+#define STAT_ADD(counter, n) ((counter) += (n))
+
+#else // !CALC_STATS
+
+#define STAT_START(var)
+#define STAT_PHASE(stats, phase, start) ((void)0)
+#define STAT_ADD(counter, n) ((void)0)
+
+#endif // CALC_STATS
+
+#endif // STATS_H
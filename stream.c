@@ -0,0 +1,494 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Evaluates an expression fed in pieces, applying each      *
+ * operator as soon as precedence allows so that memory      *
+ * stays bounded however long the expression is              *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+static void evalSegment(CalcStream*, const char*, size_t);
+static bool reserveStreamStacks(CalcStream*);
+static bool applyStreamOp(CalcStream*);
+static void streamError(CalcStream*, CalcStatus, const char*, size_t);
+static bool splitsTokens(char, char);
+static bool appendCarry(CalcStream*, const char*, size_t);
+
+/* beginStream
+ * ...Start evaluating a new expression. The context's stacks hold the
+ * ...pending operators, so ctx must not evaluate anything else until
+ * ...endStream is called
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context
+ * ......CalcStream* stream -- stream state to initialize
+ * ...Returns:
+ * ......Nothing
+ */
+void beginStream(CalcContext* ctx, CalcStream* stream)
+{
+    stream->ctx = ctx;
+    stream->num_values = 0;
+    stream->num_ops = 0;
+    stream->parse_operand = true;
+    stream->status = CALC_OK;
+    stream->carry_len = 0;
+    stream->last = ' ';
+    stream->bytes = 0;
+    stream->mode = ctx->mode;
+#ifdef CALC_STATS
+    stream->start = statClock();
+#else
+    stream->start = 0;
+#endif
+
+    ctx->error_token = NULL;
+    ctx->error_len = 0;
+}
+
+/* feedStream
+ * ...Evaluate the next piece of the expression. A piece may end in the
+ * ...middle of a token; that token is kept until the piece that
+ * ...finishes it arrives
+ * ...Parameters:
+ * ......CalcStream* stream -- stream from beginStream
+ * ......const char* piece -- characters of the piece, need not be
+ * ...... NUL-terminated and are never modified
+ * ......size_t len -- number of characters in piece
+ * ...Returns:
+ * ......CALC_OK so far, or the first failure, which ends the evaluation;
+ * ...... later pieces are then ignored
+ */
+CalcStatus feedStream(CalcStream* stream, const char* piece, size_t len)
+{
+    size_t first = 0;
+    size_t last;
+
+    if (stream->status != CALC_OK || len == 0)
+        return stream->status;
+
+    stream->bytes += len;
+
+    // Tokens never span the place before a character that splits tokens,
+    // so the text before the first such place finishes the carried token
+    // and the text after the last one may be cut off
+    while (first < len
+           && !splitsTokens(first > 0 ? piece[first - 1] : stream->last,
+                            piece[first]))
+        first++;
+
+    if (first == len)
+    {
+        if (!appendCarry(stream, piece, len))
+            streamError(stream, CALC_NO_MEMORY, NULL, 0);
+        stream->last = piece[len - 1];
+        return stream->status;
+    }
+
+    last = len - 1;
+    while (!splitsTokens(last > 0 ? piece[last - 1] : stream->last,
+                         piece[last]))
+        last--;
+
+    if (!appendCarry(stream, piece, first))
+    {
+        streamError(stream, CALC_NO_MEMORY, NULL, 0);
+        return stream->status;
+    }
+
+    evalSegment(stream, stream->ctx->carry, stream->carry_len);
+    evalSegment(stream, piece + first, last - first);
+
+    stream->carry_len = 0;
+    if (!appendCarry(stream, piece + last, len - last))
+        streamError(stream, CALC_NO_MEMORY, NULL, 0);
+    stream->last = piece[len - 1];
+
+    return stream->status;
+}
+
+/* endStream
+ * ...Finish the expression: evaluate the carried token and apply every
+ * ...pending operator. The stream may then be started again
+ * ...Parameters:
+ * ......CalcStream* stream -- stream from beginStream
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... for a bad token, ctx->error_token and ctx->error_len identify
+ * ...... its first STREAM_ERROR_SIZE characters
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ */
+CalcStatus endStream(CalcStream* stream, double* result)
+{
+    CalcContext* ctx = stream->ctx;
+    OpCode pending;
+    CalcStatus status;
+
+    *result = 0.0;
+
+    evalSegment(stream, ctx->carry, stream->carry_len);
+    stream->carry_len = 0;
+
+    if (stream->status == CALC_OK && stream->parse_operand)
+        streamError(stream, CALC_MISSING_OPERAND, NULL, 0);
+
+    while (stream->status == CALC_OK && stream->num_ops > 0)
+    {
+        pending = (OpCode)ctx->stacks.operators[stream->num_ops - 1];
+        if (pending == OP_OPEN || pending == OP_ARGS)
+            streamError(stream, CALC_UNBALANCED_PAREN, NULL, 0);
+        else
+            applyStreamOp(stream);
+    }
+
+    if (stream->status == CALC_OK && stream->mode != CALC_MODE_DOUBLE)
+    {
+        if ((status = resultPrecise(ctx, stream->mode, result)) != CALC_OK)
+            streamError(stream, status, NULL, 0);
+    }
+    else if (stream->status == CALC_OK)
+        *result = ctx->stacks.operands[0];
+
+#ifdef CALC_STATS
+    recordEval(&ctx->stats, stream->status, stream->bytes,
+               statClock() - stream->start);
+#endif
+
+    return stream->status;
+}
+
+/* evalSegment
+ * ...Evaluate the tokens of a segment that no token extends beyond,
+ * ...with the same grammar parseTree accepts
+ * ...Parameters:
+ * ......CalcStream* stream -- stream being fed
+ * ......const char* seg -- characters of the segment
+ * ......size_t len -- number of characters in seg
+ * ...Returns:
+ * ......Nothing, failures are recorded in stream->status
+ */
+static void evalSegment(CalcStream* stream, const char* seg, size_t len)
+{
+    const char* cursor = seg;
+    const char* end = seg + len;
+    const char* token;
+    size_t token_len;
+    double value;
+    bool is_number = false;
+    bool found;
+
+    if (len == 0)
+        return;
+
+    while (stream->status == CALC_OK)
+    {
+        STAT_START(scan_start);
+        if (stream->parse_operand)
+            found = nextOperand(&cursor, end, &token, &token_len,
+                                &value, &is_number);
+        else
+            found = nextToken(&cursor, end, &token, &token_len);
+        STAT_PHASE(&stream->ctx->stats, CALC_PHASE_TOKENIZE, scan_start);
+
+        if (!found)
+            return;
+
+        if (stream->parse_operand && is_number)
+            streamOperand(stream, value, token, token_len);
+        else
+            streamSymbol(stream, lookupOp(token, token_len), token, token_len);
+    }
+}
+
+/* streamOperand
+ * ...Push the next operand of a stream's expression
+ * ...Parameters:
+ * ......CalcStream* stream -- stream being fed
+ * ......double value -- the operand
+ * ......const char* token -- text of the operand for error messages, NULL
+ * ...... if there is none
+ * ......size_t len -- number of characters in token
+ * ...Returns:
+ * ......Nothing, failures are recorded in stream->status
+ */
+void streamOperand(CalcStream* stream, double value, const char* token,
+                   size_t len)
+{
+    char* ops;
+    CalcStatus status;
+
+    if (stream->status != CALC_OK)
+        return;
+
+    if (!stream->parse_operand)
+    {
+        streamError(stream, CALC_INVALID_OPERATOR, token, len);
+        return;
+    }
+
+    ops = stream->ctx->stacks.operators;
+    if (stream->num_ops > 0
+        && op_table[(OpCode)ops[stream->num_ops - 1]].function)
+    {   // a function name has to be followed by its arguments
+        streamError(stream, CALC_BAD_ARGUMENTS, token, len);
+        return;
+    }
+
+    if (!reserveStreamStacks(stream))
+        return;
+
+    if (stream->mode != CALC_MODE_DOUBLE
+        && (status = pushPrecise(stream->ctx, stream->mode,
+                                 stream->num_values, value, token, len))
+           != CALC_OK)
+    {
+        streamError(stream, status, token, len);
+        return;
+    }
+
+    stream->ctx->stacks.operands[stream->num_values++] = value;
+    stream->parse_operand = false;
+}
+
+/* streamSymbol
+ * ...Apply the next symbol of a stream's expression: where an operand
+ * ...is expected, an opening parenthesis, a sign or a function name;
+ * ...otherwise a binary operator, a closing parenthesis or a comma. A
+ * ...binary operator first applies every pending operator that binds
+ * ...first, and a closing parenthesis or comma everything back to its
+ * ...match
+ * ...Parameters:
+ * ......CalcStream* stream -- stream being fed
+ * ......OpCode op -- the symbol, as lookupOp names it; OP_NONE for a
+ * ...... token that is no symbol, which is invalid wherever it appears
+ * ......const char* token -- text of the symbol for error messages, NULL
+ * ...... if there is none
+ * ......size_t len -- number of characters in token
+ * ...Returns:
+ * ......Nothing, failures are recorded in stream->status
+ */
+void streamSymbol(CalcStream* stream, OpCode op, const char* token,
+                  size_t len)
+{
+    char* ops;
+    OpCode pending;
+    CalcStatus status;
+
+    if (stream->status != CALC_OK || !reserveStreamStacks(stream))
+        return;
+
+    ops = stream->ctx->stacks.operators;
+    pending = stream->num_ops > 0 ? (OpCode)ops[stream->num_ops - 1]
+                                  : OP_NONE;
+
+    if (stream->parse_operand)
+    {   // still expecting an operand after these
+        if (op_table[pending].function && op != OP_OPEN)
+            streamError(stream, CALC_BAD_ARGUMENTS, token, len);
+        else if (op == OP_SUB)
+            ops[stream->num_ops++] = OP_NEGATE;
+        else if (op == OP_OPEN || op_table[op].function)
+            ops[stream->num_ops++] = (char)op;
+        else if (op != OP_ADD) // unary + changes nothing
+            streamError(stream, CALC_INVALID_OPERAND, token, len);
+        return;
+    }
+
+    if (!validOperator(op))
+    {
+        streamError(stream, CALC_INVALID_OPERATOR, token, len);
+        return;
+    }
+
+    STAT_START(reduce_start);
+    while (stream->num_ops > 0
+           && bindsFirst((OpCode)ops[stream->num_ops - 1], op))
+    {
+        if (!applyStreamOp(stream))
+            return;
+    }
+    STAT_PHASE(&stream->ctx->stats, CALC_PHASE_REDUCE, reduce_start);
+
+    if (op == OP_CLOSE || op == OP_COMMA)
+    {
+        if ((status = closeGroup(ops, &stream->num_ops, op)) != CALC_OK)
+        {
+            streamError(stream, status, token, len);
+            return;
+        }
+
+        if (op == OP_CLOSE)
+        {
+            if (stream->num_ops > 0
+                && op_table[(OpCode)ops[stream->num_ops - 1]].function)
+                applyStreamOp(stream); // the call this ) ends
+            return; // still expecting an operator
+        }
+    }
+    else
+        ops[stream->num_ops++] = (char)op;
+
+    stream->parse_operand = true;
+}
+
+/* reserveStreamStacks
+ * ...Make room for one more pending operand and operator, and for the
+ * ...precise form of the operand outside CALC_MODE_DOUBLE
+ * ...Parameters:
+ * ......CalcStream* stream -- stream about to push
+ * ...Returns:
+ * ......false if the stacks could not be grown, true otherwise
+ */
+static bool reserveStreamStacks(CalcStream* stream)
+{
+    size_t depth = stream->num_values > stream->num_ops ? stream->num_values
+                                                        : stream->num_ops;
+
+    if (!reserveStacks(&stream->ctx->stacks, depth + 1)
+        || (stream->mode != CALC_MODE_DOUBLE
+            && !reservePrecise(stream->ctx, depth + 1)))
+    {
+        streamError(stream, CALC_NO_MEMORY, NULL, 0);
+        return false;
+    }
+
+    return true;
+}
+
+/* applyStreamOp
+ * ...Pop the top pending operator and apply it to the operands on top
+ * ...of the operand stack
+ * ...Parameters:
+ * ......CalcStream* stream -- stream with a pending operator or function
+ * ...Returns:
+ * ......false if the operator failed, true otherwise
+ */
+static bool applyStreamOp(CalcStream* stream)
+{
+    double* values = stream->ctx->stacks.operands;
+    OpCode op = (OpCode)stream->ctx->stacks.operators[--stream->num_ops];
+    size_t top = stream->num_values - 1;
+    CalcStatus status;
+
+    if (stream->mode != CALC_MODE_DOUBLE)
+    {
+        status = applyPrecise(stream->ctx, stream->mode, top, op);
+        stream->num_values -= op_table[op].arity - 1;
+        if (status != CALC_OK)
+        {
+            streamError(stream, status, NULL, 0);
+            return false;
+        }
+        return true;
+    }
+
+    if (op_table[op].arity == 1)
+    {
+        values[top] = applyUnary(values[top], op);
+        return true;
+    }
+
+    if (dividesByZero(values[top], op))
+    {
+        streamError(stream, CALC_DIVIDE_BY_ZERO, NULL, 0);
+        return false;
+    }
+
+    values[top - 1] = applyOp(values[top - 1], values[top], op);
+    stream->num_values--;
+
+    return true;
+}
+
+/* streamError
+ * ...Record the failure that ends a stream, copying the offending token
+ * ...because the piece it came from may be gone by the time it is shown
+ * ...Parameters:
+ * ......CalcStream* stream -- stream that failed
+ * ......CalcStatus status -- reason for failure
+ * ......const char* token -- offending token, NULL if there is none
+ * ......size_t len -- number of characters in token
+ * ...Returns:
+ * ......Nothing
+ */
+static void streamError(CalcStream* stream, CalcStatus status,
+                        const char* token, size_t len)
+{
+    stream->status = status;
+
+    if (token == NULL)
+        return;
+
+    if (len > STREAM_ERROR_SIZE)
+        len = STREAM_ERROR_SIZE;
+    memcpy(stream->error_buf, token, len);
+    stream->ctx->error_token = stream->error_buf;
+    stream->ctx->error_len = len;
+}
+
+/* splitsTokens
+ * ...Check if every token ends before a character: whitespace or a
+ * ...delimiter char, except a sign that may continue the
+ * ...exponent of a number such as 1e-5
+ * ...Parameters:
+ * ......char prev -- character before c
+ * ......char c -- character to check
+ * ...Returns:
+ * ......true if no token continues from prev into c, false otherwise
+ */
+static bool splitsTokens(char prev, char c)
+{
+    if ((c == '+' || c == '-') && (prev == 'e' || prev == 'E'))
+        return false;
+
+    return isspace((unsigned char)c) || isDelimiterChar(c);
+}
+
+/* appendCarry
+ * ...Add characters to the carried token, growing its buffer
+ * ...geometrically
+ * ...Parameters:
+ * ......CalcStream* stream -- stream whose carried token grows
+ * ......const char* str -- characters to add
+ * ......size_t len -- number of characters in str
+ * ...Returns:
+ * ......false if the buffer could not be grown, true otherwise
+ */
+static bool appendCarry(CalcStream* stream, const char* str, size_t len)
+{
+    CalcContext* ctx = stream->ctx;
+    size_t need = stream->carry_len + len;
+    size_t new_cap = ctx->carry_cap > 0 ? ctx->carry_cap : 64;
+    char* new_carry;
+
+    if (len == 0)
+        return true;
+    if (need < len)
+        return false; // overflowed
+
+    if (need > ctx->carry_cap)
+    {
+        while (new_cap < need)
+            new_cap = new_cap <= SIZE_MAX / 2 ? new_cap * 2 : need;
+
+        new_carry = (char *)realloc(ctx->carry, new_cap);
+        if (new_carry == NULL)
+            return false;
+        ctx->carry = new_carry;
+        ctx->carry_cap = new_cap;
+        STAT_ADD(ctx->stats.allocations, 1);
+    }
+
+    memcpy(ctx->carry + stream->carry_len, str, len);
+    stream->carry_len += len;
+
+    return true;
+}
@@ -0,0 +1,421 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Parses an expression into a tree of nodes taken from an   *
+ * arena in the context, and evaluates that tree. Nothing    *
+ * here recurses, so nesting depth is limited only by memory *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+static ExprNode* newNode(CalcContext*);
+static bool applyPending(CalcContext*, size_t*, size_t*);
+static bool isIdentifier(const char*, size_t);
+static int findVariable(const char*, size_t, const char* const*, int);
+
+/* parseTree
+ * ...Parse an expression into a tree. Operands are numbers, or variable
+ * ...names when var_names is given; a leading - negates an operand or a
+ * ...parenthesized group, and a function name is followed by its
+ * ...arguments in parentheses. Function names cannot be variables.
+ * ...The context's arena is reset first, so the tree of the previous
+ * ...call is gone
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context, holds the arena and the
+ * ...... parser stacks
+ * ......const char* exp -- characters of the expression, need not be
+ * ...... NUL-terminated and are never modified
+ * ......size_t len -- number of characters in exp
+ * ......const char* const* var_names -- variable names, NULL if the
+ * ...... expression may only contain numbers
+ * ......int num_vars -- number of entries in var_names
+ * ......ExprNode** root -- set to the root of the tree
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... for a bad token, ctx->error_token and ctx->error_len identify it
+ */
+CalcStatus parseTree(CalcContext* ctx, const char* exp, size_t len,
+                     const char* const* var_names, int num_vars,
+                     ExprNode** root)
+{
+    ExprStacks* stacks = &ctx->stacks;
+    ExprNode* node;
+    size_t num_tokens = 0;
+    size_t num_nodes = 0; // entries on the node stack
+    size_t num_ops = 0;   // entries on the operator stack
+    int var_dex;
+    OpCode op;
+    OpCode pending; // top of the operator stack
+
+    bool parse_operand = true;
+    bool found;
+    bool valid;
+    CalcStatus status = CALC_OK;
+
+    const char* cursor = exp;
+    const char* end = exp + len;
+    const char* token = NULL;
+    size_t token_len = 0;
+    double value;
+    bool is_number;
+
+    ctx->error_token = NULL;
+    ctx->error_len = 0;
+    resetNodes(ctx);
+
+    while (status == CALC_OK)
+    {
+        // Each token adds at most one entry to either stack
+        if (!reserveStacks(stacks, ++num_tokens))
+            return CALC_NO_MEMORY;
+
+        if (parse_operand)
+        {
+            STAT_START(scan_start);
+            found = nextOperand(&cursor, end, &token, &token_len,
+                                &value, &is_number);
+            STAT_PHASE(&ctx->stats, CALC_PHASE_TOKENIZE, scan_start);
+
+            if (!found)
+                break;
+
+            op = is_number ? OP_NONE : lookupOp(token, token_len);
+
+            pending = num_ops > 0 ? (OpCode)stacks->operators[num_ops - 1]
+                                  : OP_NONE;
+            if (op_table[pending].function && op != OP_OPEN)
+            {   // a function name has to be followed by its arguments
+                status = CALC_BAD_ARGUMENTS;
+                break;
+            }
+
+            if (op == OP_OPEN || op == OP_SUB || op == OP_ADD
+                || op_table[op].function)
+            {   // still expecting an operand after these
+                if (op == OP_SUB)
+                    stacks->operators[num_ops++] = OP_NEGATE;
+                else if (op != OP_ADD) // unary + changes nothing
+                    stacks->operators[num_ops++] = (char)op;
+                continue;
+            }
+
+            if ((node = newNode(ctx)) == NULL)
+                return CALC_NO_MEMORY;
+
+            if (is_number)
+            {
+                node->kind = NODE_NUMBER;
+                node->value = value;
+            }
+            else if (var_names == NULL || !isIdentifier(token, token_len))
+                status = CALC_INVALID_OPERAND;
+            else if ((var_dex = findVariable(token, token_len,
+                                             var_names, num_vars)) < 0)
+                status = CALC_UNKNOWN_VARIABLE;
+            else
+            {
+                node->kind = NODE_VAR;
+                node->var = var_dex;
+            }
+
+            stacks->nodes[num_nodes++] = node;
+        }
+        else // parsing operator
+        {
+            STAT_START(scan_start);
+            found = nextToken(&cursor, end, &token, &token_len);
+            STAT_PHASE(&ctx->stats, CALC_PHASE_TOKENIZE, scan_start);
+
+            if (!found)
+                break;
+
+            STAT_START(check_start);
+            op = lookupOp(token, token_len);
+            valid = validOperator(op);
+            STAT_PHASE(&ctx->stats, CALC_PHASE_VALIDATE, check_start);
+
+            if (!valid)
+            {
+                status = CALC_INVALID_OPERATOR;
+                break;
+            }
+
+            // Apply every pending operator that binds first; a closing
+            // parenthesis or comma applies everything back to its match
+            while (num_ops > 0
+                   && bindsFirst((OpCode)stacks->operators[num_ops - 1], op))
+            {
+                if (!applyPending(ctx, &num_nodes, &num_ops))
+                    return CALC_NO_MEMORY;
+            }
+
+            if (op == OP_CLOSE)
+            {
+                status = closeGroup(stacks->operators, &num_ops, op);
+                pending = num_ops > 0 ? (OpCode)stacks->operators[num_ops - 1]
+                                      : OP_NONE;
+                if (status == CALC_OK && op_table[pending].function
+                    && !applyPending(ctx, &num_nodes, &num_ops))
+                    return CALC_NO_MEMORY; // the call this ) ends
+                continue; // still expecting an operator
+            }
+
+            if (op == OP_COMMA) // the next argument follows
+                status = closeGroup(stacks->operators, &num_ops, op);
+            else
+                stacks->operators[num_ops++] = (char)op;
+        }
+
+        parse_operand = !parse_operand;
+    }
+
+    if (status != CALC_OK)
+    {
+        ctx->error_token = token;
+        ctx->error_len = token_len;
+        return status;
+    }
+
+    // Empty, or ends with an operator or an opening parenthesis
+    if (parse_operand)
+        return CALC_MISSING_OPERAND;
+
+    while (num_ops > 0)
+    {
+        pending = (OpCode)stacks->operators[num_ops - 1];
+        if (pending == OP_OPEN || pending == OP_ARGS)
+            return CALC_UNBALANCED_PAREN; // never closed
+
+        if (!applyPending(ctx, &num_nodes, &num_ops))
+            return CALC_NO_MEMORY;
+    }
+
+    *root = stacks->nodes[0];
+
+    return CALC_OK;
+}
+
+/* evalTree
+ * ...Evaluate the tree built by the last parseTree call. The parser
+ * ...allocates every node after its operands, so visiting the arena in
+ * ...allocation order is a post-order walk that needs no stack
+ * ...Parameters:
+ * ......CalcContext* ctx -- context holding the tree
+ * ......const double* bindings -- variable values, NULL if there are none
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, CALC_DIVIDE_BY_ZERO otherwise
+ * ...... answer is written to result if sucessful, left alone otherwise
+ */
+CalcStatus evalTree(CalcContext* ctx, const double* bindings,
+                    double* result)
+{
+    struct NodeBlock* block;
+    ExprNode* node = NULL;
+    ExprNode* last;
+
+    for (block = ctx->node_blocks; block != NULL; block = block->next)
+    {
+        last = block->nodes + (block == ctx->node_block ? ctx->node_used
+                                                          : NODE_BLOCK_SIZE);
+
+        for (node = block->nodes; node < last; node++)
+        {
+            switch (node->kind)
+            {
+                case NODE_NUMBER:
+                    break;
+
+                case NODE_VAR:
+                    node->value = bindings[node->var];
+                    break;
+
+                case NODE_UNARY:
+                    node->value = applyUnary(node->left->value, node->op);
+                    break;
+
+                case NODE_BINARY:
+                    if (dividesByZero(node->right->value, node->op))
+                        return CALC_DIVIDE_BY_ZERO;
+                    node->value = applyOp(node->left->value,
+                                          node->right->value, node->op);
+                    break;
+            }
+        }
+
+        if (block == ctx->node_block)
+            break;
+    }
+
+    // The root is the last node allocated
+    *result = node[-1].value;
+
+    return CALC_OK;
+}
+
+/* resetNodes
+ * ...Return every node in the arena at once, keeping its blocks for
+ * ...the next tree
+ * ...Parameters:
+ * ......CalcContext* ctx -- context whose arena is reset
+ * ...Returns:
+ * ......Nothing
+ */
+void resetNodes(CalcContext* ctx)
+{
+    ctx->node_block = NULL;
+    ctx->node_used = 0;
+}
+
+/* freeNodes
+ * ...Release every block of the arena
+ * ...Parameters:
+ * ......CalcContext* ctx -- context whose arena is released
+ * ...Returns:
+ * ......Nothing
+ */
+void freeNodes(CalcContext* ctx)
+{
+    struct NodeBlock* block = ctx->node_blocks;
+    struct NodeBlock* next;
+
+    while (block != NULL)
+    {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+
+    ctx->node_blocks = NULL;
+    resetNodes(ctx);
+}
+
+/* newNode
+ * ...Take the next node from the arena, moving on to the next block or
+ * ...allocating one when the current block is used up
+ * ...Parameters:
+ * ......CalcContext* ctx -- context holding the arena
+ * ...Returns:
+ * ......the new node, NULL if a block could not be allocated
+ */
+static ExprNode* newNode(CalcContext* ctx)
+{
+    struct NodeBlock** link;
+    ExprNode* node;
+
+    if (ctx->node_block == NULL || ctx->node_used == NODE_BLOCK_SIZE)
+    {
+        link = ctx->node_block == NULL ? &ctx->node_blocks
+                                       : &ctx->node_block->next;
+        if (*link == NULL)
+        {
+            *link = (struct NodeBlock *)malloc(sizeof(struct NodeBlock));
+            if (*link == NULL)
+                return NULL;
+            (*link)->next = NULL;
+            STAT_ADD(ctx->stats.allocations, 1);
+        }
+
+        ctx->node_block = *link;
+        ctx->node_used = 0;
+    }
+
+    node = &ctx->node_block->nodes[ctx->node_used++];
+    node->op = OP_NONE;
+    node->left = NULL;
+    node->right = NULL;
+
+    return node;
+}
+
+/* applyPending
+ * ...Pop the top pending operator and build its node from the operand
+ * ...nodes on top of the node stack
+ * ...Parameters:
+ * ......CalcContext* ctx -- context holding the parser stacks
+ * ......size_t* num_nodes -- entries on the node stack, updated
+ * ......size_t* num_ops -- entries on the operator stack, decremented
+ * ...Returns:
+ * ......false if the node could not be allocated, true otherwise
+ */
+static bool applyPending(CalcContext* ctx, size_t* num_nodes,
+                         size_t* num_ops)
+{
+    ExprNode** nodes = ctx->stacks.nodes;
+    OpCode op = (OpCode)ctx->stacks.operators[--*num_ops];
+    ExprNode* node = newNode(ctx);
+
+    if (node == NULL)
+        return false;
+
+    node->op = op;
+    if (op_table[op].arity == 1)
+    {
+        node->kind = NODE_UNARY;
+        node->left = nodes[*num_nodes - 1];
+    }
+    else
+    {
+        node->kind = NODE_BINARY;
+        node->left = nodes[*num_nodes - 2];
+        node->right = nodes[*num_nodes - 1];
+        --*num_nodes;
+    }
+
+    nodes[*num_nodes - 1] = node;
+
+    return true;
+}
+
+/* isIdentifier
+ * ...Check if a token is a variable name: a letter or underscore
+ * ...followed by letters, digits or underscores
+ * ...Parameters:
+ * ......const char* str -- token to check
+ * ......size_t len -- number of characters in str
+ * ...Returns:
+ * ......true if str is a variable name, false otherwise
+ */
+static bool isIdentifier(const char* str, size_t len)
+{
+    if (len == 0 || !(isalpha((unsigned char)str[0]) || str[0] == '_'))
+        return false;
+
+    for (size_t i = 1; i < len; i++)
+    {
+        if (!(isalnum((unsigned char)str[i]) || str[i] == '_'))
+            return false;
+    }
+
+    return true;
+}
+
+/* findVariable
+ * ...Look up a variable name
+ * ...Parameters:
+ * ......const char* name -- name to find, not NUL-terminated
+ * ......size_t len -- number of characters in name
+ * ......const char* const* var_names -- known variable names
+ * ......int num_vars -- number of entries in var_names
+ * ...Returns:
+ * ......the index of name in var_names, -1 otherwise
+ */
+static int findVariable(const char* name, size_t len,
+                        const char* const* var_names, int num_vars)
+{
+    for (int i = 0; i < num_vars; i++)
+    {
+        if (strncmp(var_names[i], name, len) == 0 && var_names[i][len] == '\0')
+            return i;
+    }
+
+    return -1;
+}
@@ -0,0 +1,103 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * Evaluates expressions in the binary token format, whose   *
+ * operands are already doubles, so nothing is tokenized or  *
+ * converted from text                                       *
+ *************************************************************/
+
+#include "calc.h"
+#include "calc_internal.h"
+
+#include <string.h>
+
+static double loadDouble(const unsigned char*);
+
+// Symbol applied for each code after WIRE_NUMBER
+static const unsigned char wire_symbols[] = {
+    [WIRE_ADD] = OP_ADD,
+    [WIRE_SUB] = OP_SUB,
+    [WIRE_MUL] = OP_MUL,
+    [WIRE_DIV] = OP_DIV,
+    [WIRE_OPEN] = OP_OPEN,
+    [WIRE_CLOSE] = OP_CLOSE,
+    [WIRE_MOD] = OP_MOD,
+    [WIRE_POW] = OP_POW,
+    [WIRE_COMMA] = OP_COMMA,
+    [WIRE_SQRT] = OP_SQRT,
+    [WIRE_LOG] = OP_LOG,
+    [WIRE_MIN] = OP_MIN,
+    [WIRE_MAX] = OP_MAX
+};
+
+/* evalBinary
+ * ...Evaluate an expression in the binary format described by WireCode,
+ * ...with the grammar and results of the stream evaluator (beginStream,
+ * ...feedStream): an expression with several errors may report a
+ * ...different one first than evalExpression, and outside
+ * ...CALC_MODE_DOUBLE each operand is the exact value of its double
+ * ...Parameters:
+ * ......CalcContext* ctx -- evaluator context
+ * ......const unsigned char* exp -- tokens of the expression
+ * ......size_t len -- number of bytes in exp
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise; an
+ * ...... unknown code is an invalid operand or operator depending on
+ * ...... where it appears, and a truncated number an invalid operand.
+ * ...... ctx->error_token is NULL, as there is no text to point to
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ */
+CalcStatus evalBinary(CalcContext* ctx, const unsigned char* exp, size_t len,
+                      double* result)
+{
+    CalcStream stream;
+    const unsigned char* end = exp + len;
+    unsigned code;
+
+    beginStream(ctx, &stream);
+    stream.bytes = len;
+
+    while (exp < end && stream.status == CALC_OK)
+    {
+        code = *exp++;
+
+        if (code == WIRE_NUMBER)
+        {
+            if (end - exp < 8)
+            {
+                stream.status = CALC_INVALID_OPERAND;
+                break;
+            }
+            streamOperand(&stream, loadDouble(exp), NULL, 0);
+            exp += 8;
+        }
+        else
+            streamSymbol(&stream, code < sizeof(wire_symbols)
+                                  ? (OpCode)wire_symbols[code] : OP_NONE,
+                         NULL, 0);
+    }
+
+    return endStream(&stream, result);
+}
+
+/* loadDouble
+ * ...Read a little-endian IEEE-754 double whatever the host byte order
+ * ...Parameters:
+ * ......const unsigned char* p -- the 8 bytes of the value
+ * ...Returns:
+ * ......the value
+ */
+static double loadDouble(const unsigned char* p)
+{
+    uint64_t bits = 0;
+    double value;
+
+    for (int i = 7; i >= 0; i--)
+        bits = bits << 8 | p[i];
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
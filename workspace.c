@@ -0,0 +1,106 @@
+/*************************************************************
+ * C Code Sample - Command Line Calculator                   *
+ * Author: Vincent Politzer <https://github.com/vjapolitzer> *
+ *                                                           *
+ * A default evaluator context for each thread, for callers  *
+ * that do not keep one of their own. It lives until the     *
+ * thread exits, so its buffers are reused between calls     *
+ *************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "calc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static pthread_key_t context_key;
+static pthread_once_t context_once = PTHREAD_ONCE_INIT;
+static bool context_key_ok = false;
+
+static void makeContextKey(void);
+static void releaseContext(void*);
+
+/* threadContext
+ * ...Find the calling thread's default context, creating it on first
+ * ...use. It is released when the thread exits
+ * ...Parameters:
+ * ......None
+ * ...Returns:
+ * ......the context, NULL if it cannot be created
+ */
+CalcContext* threadContext(void)
+{
+    CalcContext* ctx;
+
+    pthread_once(&context_once, makeContextKey);
+    if (!context_key_ok)
+        return NULL;
+
+    ctx = (CalcContext *)pthread_getspecific(context_key);
+    if (ctx != NULL)
+        return ctx;
+
+    ctx = (CalcContext *)malloc(sizeof(CalcContext));
+    if (ctx == NULL)
+        return NULL;
+    initContext(ctx);
+
+    if (pthread_setspecific(context_key, ctx) != 0)
+    {
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/* evalString
+ * ...Evaluate a NUL-terminated expression in the calling thread's
+ * ...default context, growing it as needed, as evalExpression would
+ * ...Parameters:
+ * ......const char* exp -- the expression
+ * ......double* result -- memory location to store result
+ * ...Returns:
+ * ......CALC_OK if sucessful, the reason for failure otherwise
+ * ...... answer is written to result if sucessful, 0.0 otherwise
+ * ...... threadContext()->error_token identifies a bad token
+ */
+CalcStatus evalString(const char* exp, double* result)
+{
+    CalcContext* ctx = threadContext();
+
+    if (ctx == NULL)
+    {
+        *result = 0.0;
+        return CALC_NO_MEMORY;
+    }
+
+    return evalExpression(ctx, exp, strlen(exp), result);
+}
+
+/* makeContextKey
+ * ...Create the key the default contexts are stored under, once
+ * ...Parameters:
+ * ......None
+ * ...Returns:
+ * ......Nothing
+ */
+static void makeContextKey(void)
+{
+    context_key_ok = pthread_key_create(&context_key, releaseContext) == 0;
+}
+
+/* releaseContext
+ * ...Free a thread's default context as the thread exits
+ * ...Parameters:
+ * ......void* arg -- the context
+ * ...Returns:
+ * ......Nothing
+ */
+static void releaseContext(void* arg)
+{
+    freeContext((CalcContext *)arg);
+    free(arg);
+}